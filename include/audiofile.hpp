@@ -29,6 +29,7 @@
 #include <string>
 #include <cstring>
 #include <fstream>
+#include <limits>
 #include <unordered_map>
 #include <iterator>
 #include <algorithm>
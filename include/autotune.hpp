@@ -0,0 +1,275 @@
+#pragma once
+#include "streamstats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace audio
+{
+namespace detail
+{
+
+// Decides, from successive Stream::Stats() snapshots, whether the device
+// buffer should grow or shrink. Growing is immediate (on any xrun, or when
+// the slowest callbacks eat most of the period); shrinking needs several
+// quiet windows in a row, and never goes back down to a size that has
+// already failed. That asymmetry is the hysteresis that stops it hunting.
+class BufferTuner
+{
+    unsigned int m_frames;
+    unsigned int m_minFrames;
+    unsigned int m_maxFrames;
+    unsigned int m_failedFrames = 0; // largest size that has xrun'd
+    unsigned int m_quietWindows = 0;
+
+  public:
+    static constexpr uint64_t MIN_WINDOW_CALLBACKS = 32;
+    static constexpr unsigned int QUIET_WINDOWS_TO_SHRINK = 3;
+    static constexpr double GROW_P99_LOAD = 0.8;
+    static constexpr double SHRINK_MEAN_LOAD = 0.25;
+    static constexpr double SHRINK_P99_LOAD = 0.5;
+
+    BufferTuner(unsigned int frames, unsigned int minFrames,
+                unsigned int maxFrames)
+        : m_frames(frames), m_minFrames(minFrames), m_maxFrames(maxFrames)
+    {
+        assert(minFrames > 0 && minFrames <= maxFrames);
+    }
+
+    unsigned int Frames() const noexcept { return m_frames; }
+
+    // Call when the device gave us something other than what we asked for.
+    void Accept(unsigned int frames) noexcept
+    {
+        m_frames = frames;
+        m_quietWindows = 0;
+    }
+
+    // Returns the buffer size to use from now on: Frames() if unchanged.
+    unsigned int Evaluate(const StreamStats &before, const StreamStats &now)
+    {
+        const uint64_t callbacks = now.callbackCount - before.callbackCount;
+        if (callbacks < MIN_WINDOW_CALLBACKS) return m_frames;
+
+        const uint64_t xruns =
+            (now.outputUnderflows - before.outputUnderflows) +
+            (now.inputOverflows - before.inputOverflows);
+        const uint64_t period = (now.periodNanos - before.periodNanos);
+        if (period == 0) return m_frames;
+        const double meanPeriod = (double)period / callbacks;
+        const double load =
+            (double)(now.busyNanos - before.busyNanos) / period;
+
+        // p99 of this window only, from the histogram difference
+        const uint64_t p99Count = callbacks - callbacks / 100;
+        uint64_t cumulative = 0;
+        double p99Load = 0;
+        for (unsigned int i = 0; i < StreamStats::HISTOGRAM_BUCKETS; ++i)
+        {
+            cumulative += now.histogram[i] - before.histogram[i];
+            if (cumulative >= p99Count)
+            {
+                p99Load = (double)(2ull << i) / meanPeriod;
+                break;
+            }
+        }
+
+        if (xruns > 0 || p99Load > GROW_P99_LOAD)
+        {
+            m_quietWindows = 0;
+            if (xruns > 0)
+            {
+                m_failedFrames = (std::max)(m_failedFrames, m_frames);
+            }
+            m_frames = (std::min)(m_frames * 2, m_maxFrames);
+            return m_frames;
+        }
+
+        if (load < SHRINK_MEAN_LOAD && p99Load < SHRINK_P99_LOAD)
+        {
+            if (++m_quietWindows >= QUIET_WINDOWS_TO_SHRINK)
+            {
+                m_quietWindows = 0;
+                const unsigned int smaller = m_frames / 2;
+                if (smaller >= m_minFrames && smaller > m_failedFrames)
+                {
+                    m_frames = smaller;
+                }
+            }
+        }
+        else
+        {
+            m_quietWindows = 0;
+        }
+        return m_frames;
+    }
+};
+
+// The tuned buffer size for each device, kept between runs in a small
+// text file of "<frames>\t<api>:<device name>" lines.
+class BufferSizeStore
+{
+    std::string m_path;
+
+    std::map<std::string, unsigned int> read() const
+    {
+        std::map<std::string, unsigned int> ret;
+        std::ifstream f(m_path);
+        std::string line;
+        while (std::getline(f, line))
+        {
+            const auto tab = line.find('\t');
+            if (tab == std::string::npos) continue;
+            const unsigned long frames = strtoul(line.c_str(), nullptr, 10);
+            if (frames > 0) ret[line.substr(tab + 1)] = (unsigned int)frames;
+        }
+        return ret;
+    }
+
+  public:
+    explicit BufferSizeStore(std::string path) : m_path(std::move(path)) {}
+
+    static std::string DefaultPath()
+    {
+#ifdef _WIN32
+        const char *dir = getenv("APPDATA");
+#else
+        const char *dir = getenv("XDG_CONFIG_HOME");
+        if (!dir || !*dir) dir = getenv("HOME");
+#endif
+        std::string ret = dir && *dir ? dir : ".";
+        return ret + "/.myaudio_buffer_sizes";
+    }
+
+    const std::string &Path() const noexcept { return m_path; }
+
+    // 0 if nothing has been stored for this device
+    unsigned int Load(const std::string &deviceKey) const
+    {
+        const auto all = read();
+        const auto it = all.find(deviceKey);
+        return it == all.end() ? 0 : it->second;
+    }
+
+    bool Save(const std::string &deviceKey, unsigned int frames) const
+    {
+        auto all = read();
+        all[deviceKey] = frames;
+        std::ofstream f(m_path, std::ios::trunc);
+        for (const auto &kv : all)
+        {
+            f << kv.second << '\t' << kv.first << '\n';
+        }
+        return f.good();
+    }
+};
+
+// Watches a stream from its own (non-realtime) thread and asks for it to
+// be reopened whenever the BufferTuner changes its mind.
+class AutoTuner
+{
+  public:
+    using StatsFn = std::function<StreamStats()>;
+    // Reopens the device with the given size; updates it with the size the
+    // device actually gave us. Returns false if the stream could not be
+    // reopened at all.
+    using ReopenFn = std::function<bool(unsigned int &)>;
+
+  private:
+    BufferTuner m_tuner;
+    BufferSizeStore m_store;
+    std::string m_deviceKey;
+    StatsFn m_stats;
+    ReopenFn m_reopen;
+    std::chrono::milliseconds m_window;
+    std::atomic<bool> m_running{false};
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_thread;
+
+    void monitor()
+    {
+        StreamStats before = m_stats();
+        while (m_running)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait_for(lock, m_window, [this] { return !m_running; });
+            }
+            if (!m_running) break;
+            const StreamStats now = m_stats();
+            const unsigned int was = m_tuner.Frames();
+            unsigned int want = m_tuner.Evaluate(before, now);
+            before = now;
+            if (want == was) continue;
+
+            std::cerr << "AutoTuner: buffer size " << was << " -> " << want
+                      << " frames for " << m_deviceKey << std::endl;
+            if (!m_reopen(want))
+            {
+                std::cerr << "AutoTuner: could not reopen the stream, "
+                             "giving up."
+                          << std::endl;
+                m_running = false;
+                break;
+            }
+            m_tuner.Accept(want);
+            m_store.Save(m_deviceKey, want);
+            before = m_stats();
+        }
+    }
+
+  public:
+    AutoTuner(std::string deviceKey, std::string storePath,
+              unsigned int frames, unsigned int minFrames,
+              unsigned int maxFrames, StatsFn stats, ReopenFn reopen,
+              std::chrono::milliseconds window = std::chrono::seconds(2))
+        : m_tuner(frames, minFrames, maxFrames),
+          m_store(std::move(storePath)), m_deviceKey(std::move(deviceKey)),
+          m_stats(std::move(stats)), m_reopen(std::move(reopen)),
+          m_window(window)
+    {
+    }
+    AutoTuner(const AutoTuner &) = delete;
+    AutoTuner &operator=(const AutoTuner &) = delete;
+    ~AutoTuner() { Stop(); }
+
+    // The size to open with: the stored one, if we have tuned this device
+    // before.
+    unsigned int InitialFrames(unsigned int fallback) const
+    {
+        const unsigned int stored = m_store.Load(m_deviceKey);
+        return stored ? stored : fallback;
+    }
+    void Accept(unsigned int frames) { m_tuner.Accept(frames); }
+    unsigned int Frames() const noexcept { return m_tuner.Frames(); }
+
+    void Start()
+    {
+        if (m_running) return;
+        m_running = true;
+        m_thread = std::thread([this] { monitor(); });
+    }
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_wake.notify_all();
+        if (m_thread.joinable()) m_thread.join();
+    }
+};
+
+} // namespace detail
+} // namespace audio
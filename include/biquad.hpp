@@ -0,0 +1,340 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include "lockfree.hpp"
+#include "samples.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+// Normalised (a0 == 1) biquad coefficients, with the usual designs from
+// the "Audio EQ Cookbook" (R. Bristow-Johnson).
+struct biquad_coeffs
+{
+    double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+
+    static biquad_coeffs lowpass(double fs, double f0, double q = M_SQRT1_2)
+    {
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double alpha = std::sin(w) / (2 * q);
+        return normalise((1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alpha, -2 * c,
+                         1 - alpha);
+    }
+    static biquad_coeffs highpass(double fs, double f0, double q = M_SQRT1_2)
+    {
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double alpha = std::sin(w) / (2 * q);
+        return normalise((1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + alpha,
+                         -2 * c, 1 - alpha);
+    }
+    // constant 0dB peak gain
+    static biquad_coeffs bandpass(double fs, double f0, double q)
+    {
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double alpha = std::sin(w) / (2 * q);
+        return normalise(alpha, 0, -alpha, 1 + alpha, -2 * c, 1 - alpha);
+    }
+    static biquad_coeffs notch(double fs, double f0, double q)
+    {
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double alpha = std::sin(w) / (2 * q);
+        return normalise(1, -2 * c, 1, 1 + alpha, -2 * c, 1 - alpha);
+    }
+    static biquad_coeffs allpass(double fs, double f0, double q)
+    {
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double alpha = std::sin(w) / (2 * q);
+        return normalise(1 - alpha, -2 * c, 1 + alpha, 1 + alpha, -2 * c,
+                         1 - alpha);
+    }
+    static biquad_coeffs peaking(double fs, double f0, double q,
+                                 double gainDb)
+    {
+        const double A = std::pow(10.0, gainDb / 40);
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double alpha = std::sin(w) / (2 * q);
+        return normalise(1 + alpha * A, -2 * c, 1 - alpha * A, 1 + alpha / A,
+                         -2 * c, 1 - alpha / A);
+    }
+    static biquad_coeffs lowShelf(double fs, double f0, double gainDb,
+                                  double q = M_SQRT1_2)
+    {
+        const double A = std::pow(10.0, gainDb / 40);
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double beta = 2 * std::sqrt(A) * std::sin(w) / (2 * q);
+        return normalise(A * ((A + 1) - (A - 1) * c + beta),
+                         2 * A * ((A - 1) - (A + 1) * c),
+                         A * ((A + 1) - (A - 1) * c - beta),
+                         (A + 1) + (A - 1) * c + beta,
+                         -2 * ((A - 1) + (A + 1) * c),
+                         (A + 1) + (A - 1) * c - beta);
+    }
+    static biquad_coeffs highShelf(double fs, double f0, double gainDb,
+                                   double q = M_SQRT1_2)
+    {
+        const double A = std::pow(10.0, gainDb / 40);
+        const double w = 2 * M_PI * f0 / fs, c = std::cos(w);
+        const double beta = 2 * std::sqrt(A) * std::sin(w) / (2 * q);
+        return normalise(A * ((A + 1) + (A - 1) * c + beta),
+                         -2 * A * ((A - 1) + (A + 1) * c),
+                         A * ((A + 1) + (A - 1) * c - beta),
+                         (A + 1) - (A - 1) * c + beta,
+                         2 * ((A - 1) - (A + 1) * c),
+                         (A + 1) - (A - 1) * c - beta);
+    }
+
+  private:
+    static biquad_coeffs normalise(double b0, double b1, double b2, double a0,
+                                   double a1, double a2)
+    {
+        biquad_coeffs ret;
+        ret.b0 = b0 / a0;
+        ret.b1 = b1 / a0;
+        ret.b2 = b2 / a0;
+        ret.a1 = a1 / a0;
+        ret.a2 = a2 / a0;
+        return ret;
+    }
+};
+
+// A cascade of nstages biquads on each of nch channels, in transposed
+// direct form II. Coefficients and state are stored stage by stage with
+// the channels side by side, so the inner loop runs across channels (no
+// dependency between them) and vectorises: N channels cost roughly N /
+// vector-width scalar filters. Planar buffers are transposed through a
+// small scratch block so they use the same kernel.
+//
+// set() is for a single control thread; new coefficients are queued, and
+// the audio thread glides every lane to its target over the smoothing
+// time, a sub-block at a time.
+template <typename T> class biquad_bank
+{
+    static_assert(std::is_floating_point<T>::value,
+                  "biquad_bank needs a floating point sample type");
+
+  public:
+    static constexpr int SUB_BLOCK = 32;
+
+  private:
+    enum
+    {
+        B0,
+        B1,
+        B2,
+        A1,
+        A2,
+        NCOEFFS
+    };
+
+    struct command
+    {
+        int ch; // -1: every channel
+        int stage;
+        T c[NCOEFFS];
+        bool smooth;
+    };
+
+    int m_nch;
+    int m_nstages;
+    int m_smoothSubBlocks;
+    lockfree::spsc_ring<command> m_commands;
+    // [coefficient][stage * nch + ch]
+    std::vector<T> m_coeffs[NCOEFFS];
+    std::vector<T> m_target[NCOEFFS];
+    std::vector<T> m_z1, m_z2;
+    std::vector<T> m_scratch; // SUB_BLOCK interleaved frames, for planar
+    int m_smoothLeft = 0;     // sub-blocks until m_coeffs reach m_target
+
+    static void to_array(const biquad_coeffs &bc, T *c)
+    {
+        c[B0] = (T)bc.b0;
+        c[B1] = (T)bc.b1;
+        c[B2] = (T)bc.b2;
+        c[A1] = (T)bc.a1;
+        c[A2] = (T)bc.a2;
+    }
+
+    void apply(const command &cmd)
+    {
+        if (cmd.stage < 0 || cmd.stage >= m_nstages) return;
+        if (cmd.ch >= m_nch) return;
+        const int first = cmd.ch < 0 ? 0 : cmd.ch;
+        const int last = cmd.ch < 0 ? m_nch : cmd.ch + 1;
+        for (int ch = first; ch < last; ++ch)
+        {
+            const int lane = cmd.stage * m_nch + ch;
+            for (int c = 0; c < NCOEFFS; ++c)
+            {
+                m_target[c][lane] = cmd.c[c];
+                if (!cmd.smooth) m_coeffs[c][lane] = cmd.c[c];
+            }
+        }
+        if (cmd.smooth) m_smoothLeft = m_smoothSubBlocks;
+    }
+
+    void pick_up_commands()
+    {
+        command cmd;
+        while (m_commands.pop(cmd))
+        {
+            apply(cmd);
+        }
+    }
+
+    void smooth_step()
+    {
+        if (m_smoothLeft <= 0) return;
+        const T frac = (T)1 / (T)m_smoothLeft;
+        const size_t n = m_coeffs[0].size();
+        for (int c = 0; c < NCOEFFS; ++c)
+        {
+            T *cur = m_coeffs[c].data();
+            const T *tgt = m_target[c].data();
+            for (size_t i = 0; i < n; ++i)
+            {
+                cur[i] += (tgt[i] - cur[i]) * frac;
+            }
+        }
+        --m_smoothLeft;
+    }
+
+    // n interleaved frames, in place
+    void run(T *x, int n)
+    {
+        const size_t nch = (size_t)m_nch;
+        const size_t nstages = (size_t)m_nstages;
+        // a stage at a time over the whole sub-block, so that stage's
+        // coefficients and state stay in L1
+        for (size_t s = 0; s < nstages; ++s)
+        {
+            const size_t o = s * nch;
+            const T *AUDIO_RESTRICT b0 = m_coeffs[B0].data() + o;
+            const T *AUDIO_RESTRICT b1 = m_coeffs[B1].data() + o;
+            const T *AUDIO_RESTRICT b2 = m_coeffs[B2].data() + o;
+            const T *AUDIO_RESTRICT a1 = m_coeffs[A1].data() + o;
+            const T *AUDIO_RESTRICT a2 = m_coeffs[A2].data() + o;
+            T *AUDIO_RESTRICT z1 = m_z1.data() + o;
+            T *AUDIO_RESTRICT z2 = m_z2.data() + o;
+            for (size_t i = 0; i < (size_t)n; ++i)
+            {
+                run_lanes(x + i * nch, nch, b0, b1, b2, a1, a2, z1, z2);
+            }
+        }
+    }
+
+    // one stage, one frame, every channel: the loop that vectorises
+    static void run_lanes(T *AUDIO_RESTRICT frame, size_t nch,
+                          const T *AUDIO_RESTRICT b0,
+                          const T *AUDIO_RESTRICT b1,
+                          const T *AUDIO_RESTRICT b2,
+                          const T *AUDIO_RESTRICT a1,
+                          const T *AUDIO_RESTRICT a2, T *AUDIO_RESTRICT z1,
+                          T *AUDIO_RESTRICT z2) noexcept
+    {
+        for (size_t ch = 0; ch < nch; ++ch)
+        {
+            const T in = frame[ch];
+            const T out = b0[ch] * in + z1[ch];
+            z1[ch] = b1[ch] * in - a1[ch] * out + z2[ch];
+            z2[ch] = b2[ch] * in - a2[ch] * out;
+            frame[ch] = out;
+        }
+    }
+
+  public:
+    biquad_bank(int nch, int nstages, float samplerate,
+                float smoothingSecs = 0.02f, size_t commandCapacity = 1024)
+        : m_nch(nch), m_nstages(nstages),
+          m_smoothSubBlocks((std::max)(
+              1, (int)(smoothingSecs * samplerate / SUB_BLOCK + 0.5f))),
+          m_commands(commandCapacity), m_z1((size_t)nch * nstages, 0),
+          m_z2((size_t)nch * nstages, 0),
+          m_scratch((size_t)nch * SUB_BLOCK, 0)
+    {
+        assert(nch > 0 && nstages > 0);
+        T identity[NCOEFFS];
+        to_array(biquad_coeffs{}, identity);
+        for (int c = 0; c < NCOEFFS; ++c)
+        {
+            m_coeffs[c].assign((size_t)nch * nstages, identity[c]);
+            m_target[c] = m_coeffs[c];
+        }
+    }
+    biquad_bank(const biquad_bank &) = delete;
+    biquad_bank &operator=(const biquad_bank &) = delete;
+
+    int channels() const noexcept { return m_nch; }
+    int stages() const noexcept { return m_nstages; }
+
+    // Control thread. ch == -1 sets that stage on every channel. Without
+    // smoothing the new coefficients take effect at the next block, which
+    // can click if the filter is already running. Returns false if the
+    // command queue is full.
+    bool set(int ch, int stage, const biquad_coeffs &c, bool smooth = true)
+    {
+        command cmd{ch, stage, {}, smooth};
+        to_array(c, cmd.c);
+        return m_commands.push(cmd);
+    }
+
+    // Clears the filter state. Not while the audio thread is processing.
+    void reset()
+    {
+        std::fill(m_z1.begin(), m_z1.end(), (T)0);
+        std::fill(m_z2.begin(), m_z2.end(), (T)0);
+    }
+
+    // nFrames of interleaved audio with channels() channels, in place
+    void processSamples(int nFrames, T *samples)
+    {
+        pick_up_commands();
+        while (nFrames > 0)
+        {
+            const int n = (std::min)(nFrames, (int)SUB_BLOCK);
+            smooth_step();
+            run(samples, n);
+            samples += n * m_nch;
+            nFrames -= n;
+        }
+    }
+
+    // nFrames of non-interleaved audio, in place: channels[ch] points at
+    // nFrames samples for each of the channels() channels.
+    void processPlanar(int nFrames, T *const *channels)
+    {
+        pick_up_commands();
+        const int nch = m_nch;
+        T *x = m_scratch.data();
+        for (int offset = 0; offset < nFrames; offset += SUB_BLOCK)
+        {
+            const int n = (std::min)(nFrames - offset, (int)SUB_BLOCK);
+            for (int ch = 0; ch < nch; ++ch)
+            {
+                const T *src = channels[ch] + offset;
+                for (int i = 0; i < n; ++i)
+                {
+                    x[i * nch + ch] = src[i];
+                }
+            }
+            smooth_step();
+            run(x, n);
+            for (int ch = 0; ch < nch; ++ch)
+            {
+                T *dst = channels[ch] + offset;
+                for (int i = 0; i < n; ++i)
+                {
+                    dst[i] = x[i * nch + ch];
+                }
+            }
+        }
+    }
+};
+
+} // namespace dsp
+} // namespace audio
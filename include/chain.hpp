@@ -0,0 +1,229 @@
+#pragma once
+#include "samples.hpp"
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace audio
+{
+namespace dsp
+{
+
+// Stateless per-sample stages, to be fused by chain(). Each is a literal
+// type: float operator()(float x, unsigned int ch) returns the sample of
+// channel ch after the stage. All are constexpr, so a whole chain can be
+// a compile-time constant.
+
+struct gain
+{
+    float g = 1.0f;
+    constexpr explicit gain(float gain_) : g(gain_) {}
+    constexpr float operator()(float x, unsigned int) const noexcept
+    {
+        return x * g;
+    }
+};
+
+namespace detail
+{
+// sin() on [0, pi/2], good to 1e-6, for constexpr use
+constexpr double sin_quadrant(double x) noexcept
+{
+    const double x2 = x * x;
+    return x * (1 - x2 / 6 *
+                        (1 - x2 / 20 *
+                                 (1 - x2 / 42 *
+                                          (1 - x2 / 72 *
+                                                   (1 - x2 / 110)))));
+}
+} // namespace detail
+
+// Constant-power (-3dB centre) stereo pan: -1 is hard left, +1 hard right.
+// Channels beyond the first two pass through.
+struct pan
+{
+    float left = 1.0f, right = 1.0f;
+    constexpr explicit pan(float position)
+        : left((float)detail::sin_quadrant(
+              (1 - clamp(position)) * 0.7853981633974483)),
+          right((float)detail::sin_quadrant(
+              (1 + clamp(position)) * 0.7853981633974483))
+    {
+    }
+    constexpr float operator()(float x, unsigned int ch) const noexcept
+    {
+        return ch == 0 ? x * left : (ch == 1 ? x * right : x);
+    }
+
+  private:
+    static constexpr float clamp(float p) noexcept
+    {
+        return p < -1 ? -1 : (p > 1 ? 1 : p);
+    }
+};
+
+// Cubic soft clipper: linear-ish near zero, reaching +-1 smoothly at
+// |drive * x| == 1 and staying there.
+struct soft_clip
+{
+    float drive = 1.0f;
+    constexpr soft_clip() = default;
+    constexpr explicit soft_clip(float drive_) : drive(drive_) {}
+    constexpr float operator()(float x, unsigned int) const noexcept
+    {
+        float t = x * drive;
+        t = t > 1 ? 1 : (t < -1 ? -1 : t);
+        return 1.5f * t - 0.5f * t * t * t;
+    }
+};
+
+struct hard_clip
+{
+    float limit = 1.0f;
+    constexpr hard_clip() = default;
+    constexpr explicit hard_clip(float limit_) : limit(limit_) {}
+    constexpr float operator()(float x, unsigned int) const noexcept
+    {
+        return x > limit ? limit : (x < -limit ? -limit : x);
+    }
+};
+
+// Marks the sample type a chain writes; the conversion itself is
+// from_float<T>, fused into the same loop.
+template <typename T> struct to
+{
+    using type = T;
+    constexpr float operator()(float x, unsigned int) const noexcept
+    {
+        return x;
+    }
+};
+
+namespace detail
+{
+template <typename S> struct output_of
+{
+    using type = void;
+};
+template <typename T> struct output_of<to<T>>
+{
+    using type = T;
+};
+template <typename... S> struct last
+{
+    using type = void;
+};
+template <typename S> struct last<S>
+{
+    using type = S;
+};
+template <typename S, typename... R> struct last<S, R...> : last<R...>
+{
+};
+} // namespace detail
+
+// Stages fused into one loop: each sample is read once (converted to
+// float), goes through every stage in registers, and is written once
+// (converted to the output type). The stages are inlined into the loop,
+// and with the channel fixed per lane in the mono and stereo loops, the
+// compiler can vectorise the lot. Build one with chain().
+template <typename... Stages> class fused_chain
+{
+    std::tuple<Stages...> m_stages;
+
+    template <size_t I = 0>
+    constexpr float apply(float x, unsigned int ch) const noexcept
+    {
+        if constexpr (I == sizeof...(Stages))
+        {
+            return x;
+        }
+        else
+        {
+            return apply<I + 1>(std::get<I>(m_stages)(x, ch), ch);
+        }
+    }
+
+    template <typename In, typename Out>
+    void run(const In *in, Out *out, size_t nFrames,
+             unsigned int nch) const noexcept
+    {
+        if (nch == 1)
+        {
+            for (size_t i = 0; i < nFrames; ++i)
+            {
+                out[i] = from_float<Out>(apply(to_float(in[i]), 0));
+            }
+        }
+        else if (nch == 2)
+        {
+            for (size_t i = 0; i < nFrames; ++i)
+            {
+                const float l = to_float(in[2 * i]);
+                const float r = to_float(in[2 * i + 1]);
+                out[2 * i] = from_float<Out>(apply(l, 0));
+                out[2 * i + 1] = from_float<Out>(apply(r, 1));
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < nFrames; ++i)
+            {
+                for (unsigned int ch = 0; ch < nch; ++ch)
+                {
+                    const size_t j = i * nch + ch;
+                    out[j] = from_float<Out>(apply(to_float(in[j]), ch));
+                }
+            }
+        }
+    }
+
+  public:
+    // the sample type written, if the chain ends in to<T>; else void
+    using output_type = typename detail::output_of<
+        typename detail::last<Stages...>::type>::type;
+
+    constexpr explicit fused_chain(Stages... stages)
+        : m_stages(std::move(stages)...)
+    {
+    }
+
+    // one sample of channel ch, through every stage
+    constexpr float operator()(float x, unsigned int ch = 0) const noexcept
+    {
+        return apply(x, ch);
+    }
+
+    // In place, on interleaved samples of any type (as for
+    // fader::processSamples).
+    template <typename T>
+    void processSamples(int nFrames, T *samples, int nch) const noexcept
+    {
+        static_assert(std::is_void<output_type>::value ||
+                          std::is_same<output_type, T>::value,
+                      "this chain converts to another sample type");
+        run(samples, samples, (size_t)nFrames, (unsigned int)nch);
+    }
+
+    // From one sample type to another: the one given by to<T>, if any.
+    template <typename In, typename Out>
+    void process(const In *in, Out *out, int nFrames, int nch) const noexcept
+    {
+        static_assert(std::is_void<output_type>::value ||
+                          std::is_same<output_type, Out>::value,
+                      "the output type differs from the chain's to<T>");
+        run(in, out, (size_t)nFrames, (unsigned int)nch);
+    }
+};
+
+// e.g. constexpr auto c = chain(gain(0.5f), pan(-0.3f), soft_clip(),
+//                              to<int16_t>());
+template <typename... Stages>
+constexpr fused_chain<Stages...> chain(Stages... stages)
+{
+    return fused_chain<Stages...>(std::move(stages)...);
+}
+
+} // namespace dsp
+} // namespace audio
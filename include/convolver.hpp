@@ -0,0 +1,456 @@
+#pragma once
+#include "audiofile.hpp"
+#include "fft.hpp"
+#include "lockfree.hpp"
+#include "resampler.hpp"
+#include "samples.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+namespace detail
+{
+// Uniformly partitioned overlap-save convolution (UPOLS) of nch
+// channels, one block of `part` frames at a time, with one stretch of
+// an impulse response: the building block of each convolver level.
+// The IR is cut into partitions of `part` samples, each held as the
+// spectrum of a 2 * part FFT; the spectra of past input blocks sit in
+// a frequency-domain delay line, so each block costs one forward and
+// one inverse FFT whatever the IR length, plus a complex
+// multiply-add per partition.
+class upols
+{
+    const unsigned int m_nch;
+    const unsigned int m_part;
+    const unsigned int m_bins;
+    unsigned int m_nparts = 0;
+    bool m_sharedIr = false;
+    real_fft m_fft;
+    std::vector<float> m_hRe, m_hIm;     // [ir channel][partition][bin]
+    std::vector<float> m_fdlRe, m_fdlIm; // [channel][partition][bin]
+    std::vector<float> m_input;          // [channel][2 * part]
+    std::vector<float> m_accRe, m_accIm, m_time;
+    unsigned int m_pos = 0; // the delay line slot of the newest block
+
+    static void mac(float *AUDIO_RESTRICT accRe, float *AUDIO_RESTRICT accIm,
+                    const float *xr, const float *xi, const float *hr,
+                    const float *hi, size_t n) noexcept
+    {
+        for (size_t k = 0; k < n; ++k)
+        {
+            accRe[k] += xr[k] * hr[k] - xi[k] * hi[k];
+            accIm[k] += xr[k] * hi[k] + xi[k] * hr[k];
+        }
+    }
+
+  public:
+    // ir: one channel, shared by all, or one per channel. The stretch
+    // used is [offset, offset + length).
+    upols(unsigned int nch, unsigned int part,
+          const std::vector<std::vector<float>> &ir, size_t offset,
+          size_t length)
+        : m_nch(nch), m_part(part), m_bins(part + 1), m_fft(2 * part)
+    {
+        assert(ir.size() == 1 || ir.size() == nch);
+        m_sharedIr = ir.size() == 1;
+        m_nparts = (unsigned int)((length + part - 1) / part);
+        assert(m_nparts > 0);
+        const size_t slots = (size_t)m_nparts * m_bins;
+        m_hRe.resize(slots * ir.size());
+        m_hIm.resize(slots * ir.size());
+        m_fdlRe.assign(slots * nch, 0.0f);
+        m_fdlIm.assign(slots * nch, 0.0f);
+        m_input.assign((size_t)nch * 2 * part, 0.0f);
+        m_accRe.resize(m_bins);
+        m_accIm.resize(m_bins);
+        m_time.resize((size_t)2 * part);
+
+        for (size_t c = 0; c < ir.size(); ++c)
+        {
+            for (unsigned int k = 0; k < m_nparts; ++k)
+            {
+                std::fill(m_time.begin(), m_time.end(), 0.0f);
+                const size_t from = offset + (size_t)k * part;
+                const size_t to = (std::min)(
+                    (std::min)(from + part, offset + length), ir[c].size());
+                for (size_t i = from; i < to; ++i)
+                {
+                    m_time[i - from] = ir[c][i];
+                }
+                const size_t slot = (c * m_nparts + k) * m_bins;
+                m_fft.forward(m_time.data(), &m_hRe[slot], &m_hIm[slot]);
+            }
+        }
+    }
+    upols(const upols &) = delete;
+    upols &operator=(const upols &) = delete;
+
+    unsigned int part() const noexcept { return m_part; }
+
+    // part() frames per channel, planar, in and out
+    void process(const float *in, float *out) noexcept
+    {
+        const unsigned int P = m_part, K = m_nparts;
+        for (unsigned int ch = 0; ch < m_nch; ++ch)
+        {
+            float *x = &m_input[(size_t)ch * 2 * P];
+            memmove(x, x + P, P * sizeof(float));
+            memcpy(x + P, in + (size_t)ch * P, P * sizeof(float));
+            const size_t line = (size_t)ch * K * m_bins;
+            m_fft.forward(x, &m_fdlRe[line + (size_t)m_pos * m_bins],
+                          &m_fdlIm[line + (size_t)m_pos * m_bins]);
+
+            std::fill(m_accRe.begin(), m_accRe.end(), 0.0f);
+            std::fill(m_accIm.begin(), m_accIm.end(), 0.0f);
+            const size_t h = (m_sharedIr ? 0 : (size_t)ch) * K * m_bins;
+            for (unsigned int k = 0; k < K; ++k)
+            {
+                const size_t s = line + (size_t)((m_pos + K - k) % K) * m_bins;
+                const size_t hk = h + (size_t)k * m_bins;
+                mac(m_accRe.data(), m_accIm.data(), &m_fdlRe[s], &m_fdlIm[s],
+                    &m_hRe[hk], &m_hIm[hk], m_bins);
+            }
+            m_fft.inverse(m_accRe.data(), m_accIm.data(), m_time.data());
+            // overlap-save: the first half wrapped round, and is junk
+            memcpy(out + (size_t)ch * P, m_time.data() + P, P * sizeof(float));
+        }
+        m_pos = (m_pos + 1) % K;
+    }
+};
+
+inline void deinterleave(const float *in, float *planar, unsigned int nch,
+                         unsigned int frames) noexcept
+{
+    for (unsigned int ch = 0; ch < nch; ++ch)
+    {
+        float *p = planar + (size_t)ch * frames;
+        for (unsigned int i = 0; i < frames; ++i)
+        {
+            p[i] = in[(size_t)i * nch + ch];
+        }
+    }
+}
+inline void interleave(const float *planar, float *out, unsigned int nch,
+                       unsigned int frames) noexcept
+{
+    for (unsigned int ch = 0; ch < nch; ++ch)
+    {
+        const float *p = planar + (size_t)ch * frames;
+        for (unsigned int i = 0; i < frames; ++i)
+        {
+            out[(size_t)i * nch + ch] = p[i];
+        }
+    }
+}
+} // namespace detail
+
+// An impulse response from a file, planar, at the stream's rate: resampled
+// (and rescaled, so its gain is unchanged) if the file's rate differs.
+inline std::vector<std::vector<float>>
+load_impulse(const AudioFile<float> &file, double samplerate)
+{
+    const unsigned int nch = (unsigned int)file.getNumChannels();
+    const size_t len = (size_t)file.getNumSamplesPerChannel();
+    if (nch == 0 || len == 0)
+    {
+        throw std::runtime_error("load_impulse: the file has no audio");
+    }
+    const double fileRate = file.getSampleRate();
+    if (samplerate <= 0 || fileRate == samplerate) return file.samples;
+
+    polyphase_resampler src(nch, fileRate, samplerate,
+                            ResamplerQuality::best);
+    const unsigned int outLen =
+        (unsigned int)std::ceil(len * samplerate / fileRate);
+    std::vector<float> in(src.required_input(outLen) * nch, 0.0f);
+    for (unsigned int ch = 0; ch < nch; ++ch)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            in[i * nch + ch] = file.samples[ch][i];
+        }
+    }
+    std::vector<float> out((size_t)outLen * nch);
+    src.process(in.data(), out.data(), outLen);
+    const float gain = (float)(fileRate / samplerate);
+    std::vector<std::vector<float>> ir(nch, std::vector<float>(outLen));
+    for (unsigned int ch = 0; ch < nch; ++ch)
+    {
+        for (size_t i = 0; i < outLen; ++i)
+        {
+            ir[ch][i] = out[i * nch + ch] * gain;
+        }
+    }
+    return ir;
+}
+
+// Convolution with long impulse responses (room correction, reverbs of
+// several seconds) at a latency of one block. The IR is split
+// non-uniformly: the head, up to twice the second level's partition
+// size, is convolved in the audio callback with partitions of blockSize;
+// each later level's partitions are GROWTH times larger than the last,
+// and it runs on a worker thread of its own, fed and drained through
+// lock-free rings. A level with partitions of P frames starts 2P into the
+// IR, which leaves its worker a whole period of P to deliver each block.
+// levels == 1 gives uniform partitioning, all of it in the callback.
+//
+// With background == false the tail levels run inline in process()
+// instead: for offline rendering, where the result must not depend on
+// thread timing.
+class convolver
+{
+  public:
+    static constexpr unsigned int GROWTH = 8;
+
+  private:
+    struct tail_level
+    {
+        std::unique_ptr<detail::upols> conv;
+        lockfree::spsc_ring<float> in;  // callback -> worker
+        lockfree::spsc_ring<float> out; // worker -> callback
+        std::vector<float> scratch, planarIn, planarOut;
+        size_t debt = 0; // frames the callback missed and must skip
+        std::thread thread;
+
+        tail_level(std::unique_ptr<detail::upols> c, unsigned int nch,
+                   unsigned int block, size_t delay)
+            : conv(std::move(c)),
+              in((size_t)nch * (2 * conv->part() + block)),
+              out((size_t)nch * (delay + conv->part() + 2 * block)),
+              scratch((size_t)nch * conv->part()),
+              planarIn(scratch.size()), planarOut(scratch.size())
+        {
+            // the stretch starts `delay` frames into the IR
+            std::vector<float> zeros((size_t)nch * delay, 0.0f);
+            out.push(zeros.data(), zeros.size());
+        }
+
+        // worker: one partition's worth, if it has arrived
+        bool pump(unsigned int nch) noexcept
+        {
+            const unsigned int P = conv->part();
+            if (in.size() < (size_t)P * nch) return false;
+            in.pop(scratch.data(), scratch.size());
+            detail::deinterleave(scratch.data(), planarIn.data(), nch, P);
+            conv->process(planarIn.data(), planarOut.data());
+            detail::interleave(planarOut.data(), scratch.data(), nch, P);
+            out.push(scratch.data(), scratch.size());
+            return true;
+        }
+    };
+
+    const unsigned int m_nch;
+    const unsigned int m_block;
+    const bool m_background;
+    const double m_rate;
+    std::unique_ptr<detail::upols> m_head;
+    std::vector<std::unique_ptr<tail_level>> m_tails;
+    std::atomic<bool> m_running{false};
+    std::atomic<unsigned long> m_late{0};
+    std::atomic<unsigned long> m_dropped{0};
+
+    // callback side: one block in, one block out
+    std::vector<float> m_inBlock, m_outBlock, m_planarIn, m_planarOut;
+    std::vector<float> m_tailScratch;
+    unsigned int m_fill = 0;
+
+    void run_block() noexcept
+    {
+        const unsigned int B = m_block;
+        detail::deinterleave(m_inBlock.data(), m_planarIn.data(), m_nch, B);
+        m_head->process(m_planarIn.data(), m_planarOut.data());
+        detail::interleave(m_planarOut.data(), m_outBlock.data(), m_nch, B);
+
+        const size_t n = (size_t)B * m_nch;
+        for (auto &t : m_tails)
+        {
+            // a whole block or none, so the ring stays frame-aligned (its
+            // capacity is odd). A dropped block's output never comes, so
+            // there is that much less to skip to stay in step.
+            if (t->in.capacity() - t->in.size() >= n)
+            {
+                t->in.push(m_inBlock.data(), n);
+            }
+            else
+            {
+                ++m_dropped;
+                t->debt -= (std::min)(t->debt, (size_t)B);
+            }
+            if (!m_background)
+            {
+                while (t->pump(m_nch))
+                {
+                }
+            }
+            // skip what was missed before, to stay in step
+            size_t avail = t->out.size() / m_nch;
+            while (t->debt > 0 && avail > 0)
+            {
+                const size_t skip = (std::min)(
+                    (std::min)(t->debt, avail), (size_t)B);
+                t->out.pop(m_tailScratch.data(), skip * m_nch);
+                t->debt -= skip;
+                avail -= skip;
+            }
+            const size_t got = (std::min)(avail, (size_t)B);
+            t->out.pop(m_tailScratch.data(), got * m_nch);
+            const float *y = m_tailScratch.data();
+            float *o = m_outBlock.data();
+            for (size_t i = 0; i < got * m_nch; ++i)
+            {
+                o[i] += y[i];
+            }
+            if (got < B)
+            {
+                t->debt += B - got;
+                ++m_late;
+            }
+        }
+    }
+
+    void worker(tail_level *t)
+    {
+        // a quarter of a partition period, as for RenderAhead
+        const auto nap = std::chrono::microseconds(
+            (long long)(250000.0 * t->conv->part() / m_rate));
+        while (m_running)
+        {
+            if (!t->pump(m_nch)) std::this_thread::sleep_for(nap);
+        }
+    }
+
+  public:
+    // ir: planar, one channel (used for every channel) or nch of them.
+    // blockSize must be a power of two; samplerate only sets how often the
+    // workers look for work.
+    convolver(unsigned int nch, const std::vector<std::vector<float>> &ir,
+              unsigned int blockSize = 256, unsigned int levels = 3,
+              bool background = true, double samplerate = 48000)
+        : m_nch(nch), m_block(blockSize), m_background(background),
+          m_rate(samplerate), m_inBlock((size_t)nch * blockSize, 0.0f),
+          m_outBlock(m_inBlock.size(), 0.0f), m_planarIn(m_inBlock.size()),
+          m_planarOut(m_inBlock.size()), m_tailScratch(m_inBlock.size())
+    {
+        if (ir.empty() || (ir.size() != 1 && ir.size() != nch))
+        {
+            throw std::runtime_error(
+                "convolver: the impulse response has " +
+                std::to_string(ir.size()) + " channels, for a stream of " +
+                std::to_string(nch));
+        }
+        if (blockSize < 2 || (blockSize & (blockSize - 1)) != 0)
+        {
+            throw std::runtime_error(
+                "convolver: blockSize must be a power of two");
+        }
+        size_t len = 1;
+        for (const auto &c : ir)
+        {
+            len = (std::max)(len, c.size());
+        }
+        size_t begin = 0;
+        unsigned int part = blockSize;
+        for (unsigned int level = 0; begin < len; ++level)
+        {
+            const bool last = level + 1 >= levels;
+            const size_t end =
+                last ? len : (std::min)(len, (size_t)2 * part * GROWTH);
+            auto conv = std::make_unique<detail::upols>(nch, part, ir, begin,
+                                                        end - begin);
+            if (level == 0)
+            {
+                m_head = std::move(conv);
+            }
+            else
+            {
+                m_tails.push_back(std::make_unique<tail_level>(
+                    std::move(conv), nch, blockSize, begin));
+            }
+            begin = end;
+            part *= GROWTH;
+        }
+        if (m_background)
+        {
+            m_running = true;
+            for (auto &t : m_tails)
+            {
+                tail_level *p = t.get();
+                t->thread = std::thread([this, p] { worker(p); });
+            }
+        }
+    }
+    // from a file, resampled to the stream's rate if need be
+    convolver(unsigned int nch, const AudioFile<float> &ir,
+              double samplerate, unsigned int blockSize = 256,
+              unsigned int levels = 3, bool background = true)
+        : convolver(nch, load_impulse(ir, samplerate), blockSize, levels,
+                    background, samplerate)
+    {
+    }
+    convolver(const convolver &) = delete;
+    convolver &operator=(const convolver &) = delete;
+    ~convolver()
+    {
+        m_running = false;
+        for (auto &t : m_tails)
+        {
+            if (t->thread.joinable()) t->thread.join();
+        }
+    }
+
+    unsigned int channels() const noexcept { return m_nch; }
+    // in frames: the output is the convolution delayed by this much
+    unsigned int latency() const noexcept { return m_block; }
+    // partition sizes, head first
+    std::vector<unsigned int> partitions() const
+    {
+        std::vector<unsigned int> v{m_head->part()};
+        for (const auto &t : m_tails)
+        {
+            v.push_back(t->conv->part());
+        }
+        return v;
+    }
+    // blocks for which a worker was late, and had its part left out
+    unsigned long late() const noexcept { return m_late; }
+    // blocks a worker was too far behind to take at all
+    unsigned long dropped() const noexcept { return m_dropped; }
+
+    // Audio callback: any number of interleaved frames; in and out may be
+    // the same buffer.
+    void process(const float *in, float *out, unsigned int frames) noexcept
+    {
+        while (frames > 0)
+        {
+            const unsigned int n = (std::min)(frames, m_block - m_fill);
+            const size_t off = (size_t)m_fill * m_nch, len = (size_t)n * m_nch;
+            memcpy(m_inBlock.data() + off, in, len * sizeof(float));
+            memcpy(out, m_outBlock.data() + off, len * sizeof(float));
+            in += len;
+            out += len;
+            frames -= n;
+            m_fill += n;
+            if (m_fill == m_block)
+            {
+                run_block();
+                m_fill = 0;
+            }
+        }
+    }
+};
+
+} // namespace dsp
+} // namespace audio
@@ -0,0 +1,231 @@
+#pragma once
+#include "lockfree.hpp"
+#include "resampler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+// Proportional-integral control of a resampling ratio. The error is in
+// seconds of latency; the output is the fractional speed-up to apply
+// (0.0001 == 100ppm). The defaults give a loop time constant of about 20s
+// (natural frequency 0.05 rad/s, damping 0.7): slow enough that the pitch
+// change is inaudible, fast enough to settle within a minute.
+class pi_controller
+{
+    double m_kp;
+    double m_ki;
+    double m_limit;
+    double m_integral = 0;
+
+  public:
+    pi_controller(double kp = 0.07, double ki = 0.0025, double limit = 0.005)
+        : m_kp(kp), m_ki(ki), m_limit(limit)
+    {
+    }
+
+    // error: measured - wanted; dt: seconds since the last update
+    double update(double error, double dt) noexcept
+    {
+        const double p = m_kp * error;
+        const double integral = m_integral + m_ki * error * dt;
+        const double out = p + integral;
+        // anti-windup: only integrate while the output is not pinned
+        if (std::fabs(out) < m_limit) m_integral = integral;
+        return (std::max)(-m_limit, (std::min)(m_limit, p + m_integral));
+    }
+    void reset() noexcept { m_integral = 0; }
+};
+
+// Joins a capture stream and a playback stream that run from different
+// clocks. The capture side write()s into a lock-free ring; the playback
+// side read()s through a polyphase_resampler whose ratio is steered, by
+// a pi_controller, to hold the capture-to-playback latency at the target.
+//
+// When both sides pass their stream timestamps (StreamCallbackInfo's
+// inputCaptureNanos and outputDacNanos) the latency is measured exactly,
+// end to end: from the capture time of the next frame to be read to the
+// time it will reach the DAC, so the target must allow for both devices'
+// own latency. Without them it falls back to the ring's fill level, which
+// jumps by a block at every callback and so is low-pass filtered first.
+//
+// write() is for one capture thread and read() for one playback thread.
+class drift_bridge
+{
+    const unsigned int m_nch;
+    const double m_inRate;
+    const double m_outRate;
+    const double m_target; // seconds
+    lockfree::spsc_ring<float> m_ring;
+    polyphase_resampler m_src;
+    pi_controller m_pi;
+    std::vector<float> m_scratch;
+
+    // written by the capture side, under a sequence count so the playback
+    // side can read the fill level and timestamp as a consistent pair
+    std::atomic<unsigned int> m_seq{0};
+    std::atomic<long long> m_lastFrameNanos{0}; // just after the last frame
+    std::atomic<unsigned long> m_overflows{0};
+
+    // playback side
+    long long m_goodFrameNanos = 0; // from the last consistent snapshot
+    bool m_primed = false;
+    double m_smoothed = 0; // filtered latency, for the fill-level fallback
+    std::atomic<double> m_latency{0};
+    std::atomic<double> m_correction{0};
+    std::atomic<unsigned long> m_underruns{0};
+
+    // Playback side. The capture thread may be preempted mid write(), so
+    // this never waits on it: after a few tries it settles for the fill
+    // level now and the last consistent timestamp, which at worst is a
+    // block out for one update of a loop that takes seconds to respond.
+    void snapshot(size_t &fill, long long &lastFrameNanos) noexcept
+    {
+        static constexpr int TRIES = 4;
+        for (int i = 0; i < TRIES; ++i)
+        {
+            const unsigned int seq = m_seq.load(std::memory_order_acquire);
+            if (seq & 1) continue;
+            fill = m_ring.size() / m_nch;
+            lastFrameNanos = m_lastFrameNanos.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) == seq)
+            {
+                m_goodFrameNanos = lastFrameNanos;
+                return;
+            }
+        }
+        fill = m_ring.size() / m_nch;
+        lastFrameNanos = m_goodFrameNanos;
+    }
+
+    void unprime() noexcept
+    {
+        m_primed = false;
+        m_src.reset();
+        // leave the controller's integral alone: the drift it has learnt
+        // is still the drift
+    }
+
+  public:
+    // targetLatency is in seconds. maxBlockFrames bounds the frames in a
+    // single read(); the ring holds four times the target, or at least a
+    // few blocks.
+    drift_bridge(unsigned int nch, double inRate, double outRate,
+                 double targetLatency, unsigned int maxBlockFrames = 4096,
+                 ResamplerQuality quality = ResamplerQuality::medium)
+        : m_nch(nch), m_inRate(inRate), m_outRate(outRate),
+          m_target(targetLatency),
+          m_ring((size_t)nch * (std::max)((size_t)(4 * targetLatency * inRate),
+                                          (size_t)4 * maxBlockFrames)),
+          m_src(nch, inRate, outRate, quality)
+    {
+        assert(nch > 0 && targetLatency > 0);
+        m_scratch.resize(
+            (size_t)nch *
+            ((size_t)std::ceil(maxBlockFrames * (inRate / outRate) * 1.01) +
+             m_src.taps() + 2));
+    }
+    drift_bridge(const drift_bridge &) = delete;
+    drift_bridge &operator=(const drift_bridge &) = delete;
+
+    // Capture thread. captureNanos is the steady_clock time of the first
+    // frame, or 0 if not known. Returns the frames accepted: fewer than
+    // given only if the ring overflowed.
+    unsigned int write(const float *in, unsigned int frames,
+                       long long captureNanos = 0) noexcept
+    {
+        const unsigned int seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        // whole frames only, so the channels never get out of step
+        const size_t room = (m_ring.capacity() - m_ring.size()) / m_nch;
+        const size_t pushed =
+            m_ring.push(in, (std::min)((size_t)frames, room) * m_nch) / m_nch;
+        if (captureNanos != 0)
+        {
+            m_lastFrameNanos.store(
+                captureNanos + (long long)(frames * 1e9 / m_inRate),
+                std::memory_order_relaxed);
+        }
+        m_seq.store(seq + 2, std::memory_order_release);
+        if (pushed < frames) ++m_overflows;
+        return (unsigned int)pushed;
+    }
+
+    // Playback thread: frames interleaved frames into out. dacNanos is the
+    // steady_clock time the first of them will be heard, or 0 if not
+    // known. Plays silence until the latency has built up to the target,
+    // and again after an underrun.
+    void read(float *out, unsigned int frames, long long dacNanos = 0) noexcept
+    {
+        size_t fill = 0;
+        long long lastFrameNanos = 0;
+        snapshot(fill, lastFrameNanos);
+
+        const double dt = frames / m_outRate;
+        double latency;
+        if (dacNanos != 0 && lastFrameNanos != 0)
+        {
+            latency = (double)(dacNanos - lastFrameNanos) * 1e-9 +
+                      (double)fill / m_inRate;
+        }
+        else
+        {
+            const double level = (double)fill / m_inRate;
+            if (!m_primed) m_smoothed = level;
+            // one-pole low-pass, ~1s time constant
+            const double a = (std::min)(1.0, dt / 1.0);
+            m_smoothed += a * (level - m_smoothed);
+            latency = m_smoothed;
+        }
+
+        if (!m_primed)
+        {
+            if (latency < m_target)
+            {
+                std::fill(out, out + (size_t)frames * m_nch, 0.0f);
+                return;
+            }
+            m_primed = true;
+        }
+
+        const double correction = m_pi.update(latency - m_target, dt);
+        m_src.ratio(m_inRate / m_outRate * (1.0 + correction));
+        m_latency.store(latency, std::memory_order_relaxed);
+        m_correction.store(correction, std::memory_order_relaxed);
+
+        const size_t need = m_src.required_input(frames);
+        if (need > fill || need * m_nch > m_scratch.size())
+        {
+            ++m_underruns;
+            std::fill(out, out + (size_t)frames * m_nch, 0.0f);
+            unprime();
+            return;
+        }
+        m_ring.pop(m_scratch.data(), need * m_nch);
+        m_src.process(m_scratch.data(), out, frames);
+    }
+
+    // any thread
+    double latency() const noexcept
+    {
+        return m_latency.load(std::memory_order_relaxed);
+    }
+    // the current speed-up of the capture side: ~ the clock drift
+    double correction() const noexcept
+    {
+        return m_correction.load(std::memory_order_relaxed);
+    }
+    unsigned long underruns() const noexcept { return m_underruns; }
+    unsigned long overflows() const noexcept { return m_overflows; }
+};
+
+} // namespace dsp
+} // namespace audio
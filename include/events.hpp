@@ -0,0 +1,132 @@
+#pragma once
+#include "lockfree.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace audio
+{
+
+// A parameter change due at a given frame of the stream: frame 0 is the
+// first frame the stream played (its stream time, times the rate). What
+// target and value mean is up to the callback that receives it.
+struct StreamEvent
+{
+    uint64_t frame = 0;
+    unsigned int target = 0;
+    float value = 0;
+};
+
+// Timed events for one stream. Any thread may Post(); the audio thread
+// calls Process() once per buffer, which applies each event at its exact
+// frame by splitting the buffer at event boundaries and rendering the
+// pieces in between. Posting goes through a lock-free MPMC queue; the
+// audio thread moves what it finds into a binary heap ordered by frame
+// (and, for equal frames, by arrival). Both are sized up front, so
+// nothing allocates on the audio thread. Events that arrive after their
+// frame has played are applied at the start of the next buffer and
+// counted by Late().
+class EventQueue
+{
+    struct pending
+    {
+        StreamEvent event;
+        uint64_t seq;
+    };
+    struct later
+    {
+        bool operator()(const pending &a, const pending &b) const noexcept
+        {
+            return a.event.frame != b.event.frame
+                ? a.event.frame > b.event.frame
+                : a.seq > b.seq;
+        }
+    };
+
+    lockfree::mpmc_queue<StreamEvent> m_posted;
+    std::vector<pending> m_heap; // audio thread
+    uint64_t m_seq = 0;
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_late{0};
+
+    void drain() noexcept
+    {
+        StreamEvent e;
+        while (m_posted.pop(e))
+        {
+            if (m_heap.size() == m_heap.capacity())
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            m_heap.push_back(pending{e, m_seq++});
+            std::push_heap(m_heap.begin(), m_heap.end(), later());
+        }
+    }
+
+  public:
+    explicit EventQueue(size_t capacity) : m_posted(capacity)
+    {
+        m_heap.reserve(m_posted.capacity());
+    }
+    EventQueue(const EventQueue &) = delete;
+    EventQueue &operator=(const EventQueue &) = delete;
+
+    // Any thread. False, and counted as dropped, if the queue is full.
+    bool Post(const StreamEvent &event) noexcept
+    {
+        if (m_posted.push(event)) return true;
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Audio thread: a buffer of frames starting at stream frame
+    // firstFrame. Calls apply(const StreamEvent&) for each event due in
+    // it, in order, and render(offset, count) for each run of frames
+    // between them; the runs cover the buffer exactly once.
+    template <typename Apply, typename Render>
+    void Process(uint64_t firstFrame, unsigned int frames, Apply &&apply,
+                 Render &&render)
+    {
+        drain();
+        const uint64_t end = firstFrame + frames;
+        unsigned int done = 0;
+        while (!m_heap.empty() && m_heap.front().event.frame < end)
+        {
+            const StreamEvent e = m_heap.front().event;
+            std::pop_heap(m_heap.begin(), m_heap.end(), later());
+            m_heap.pop_back();
+            if (e.frame < firstFrame)
+            {
+                m_late.fetch_add(1, std::memory_order_relaxed);
+            }
+            const unsigned int at = e.frame > firstFrame
+                ? (unsigned int)(e.frame - firstFrame)
+                : 0u;
+            if (at > done)
+            {
+                render(done, at - done);
+                done = at;
+            }
+            apply(e);
+        }
+        if (done < frames || frames == 0)
+        {
+            render(done, frames - done);
+        }
+    }
+
+    // events lost to a full queue
+    uint64_t Dropped() const noexcept
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+    // events applied after their frame
+    uint64_t Late() const noexcept
+    {
+        return m_late.load(std::memory_order_relaxed);
+    }
+};
+
+} // namespace audio
@@ -0,0 +1,389 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include "lockfree.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+enum class FadeCurve : uint8_t
+{
+    linear,
+    equalPower,  // sin/cos law: constant power when crossfading two sources
+    exponential, // linear in dB over 60dB: sounds even to the ear
+    sCurve       // smoothstep: gentle at both ends
+};
+
+namespace detail
+{
+
+// Each curve maps ramp progress [0, 1] to [0, 1]. Falling ramps use the
+// curve mirrored (1 - c(1 - p)), which is what makes equal-power fade
+// out as cos and exponential fall fast then tail off. Built once, on
+// first use; lookups after that never allocate.
+class fade_curve_tables
+{
+  public:
+    static constexpr int SIZE = 512;
+    static constexpr int NCURVES = 4;
+
+  private:
+    // [curve * 2 + falling][SIZE + 1], so lookup can always read i + 1
+    std::array<std::array<float, SIZE + 2>, NCURVES * 2> m_tables{};
+
+    static double shape(FadeCurve c, double p)
+    {
+        switch (c)
+        {
+        case FadeCurve::equalPower:
+            return std::sin(p * M_PI / 2.0);
+        case FadeCurve::exponential:
+            return (std::pow(10.0, 3.0 * p) - 1.0) / 999.0;
+        case FadeCurve::sCurve:
+            return p * p * (3.0 - 2.0 * p);
+        case FadeCurve::linear:
+        default:
+            return p;
+        }
+    }
+
+    fade_curve_tables()
+    {
+        for (int c = 0; c < NCURVES; ++c)
+        {
+            auto &rising = m_tables[c * 2];
+            auto &falling = m_tables[c * 2 + 1];
+            for (int i = 0; i <= SIZE; ++i)
+            {
+                const double p = (double)i / SIZE;
+                rising[i] = (float)shape((FadeCurve)c, p);
+                falling[i] = (float)(1.0 - shape((FadeCurve)c, 1.0 - p));
+            }
+            rising[SIZE + 1] = rising[SIZE];
+            falling[SIZE + 1] = falling[SIZE];
+        }
+    }
+
+  public:
+    static const fade_curve_tables &get()
+    {
+        static const fade_curve_tables tables;
+        return tables;
+    }
+
+    static int index(FadeCurve c, bool falling) noexcept
+    {
+        return (int)c * 2 + (falling ? 1 : 0);
+    }
+
+    // table is from index(); p in [0, 1]
+    float lookup(int table, float p) const noexcept
+    {
+        const float x = p * SIZE;
+        const int i = (int)x;
+        const float *t = m_tables[table].data();
+        return t[i] + (t[i + 1] - t[i]) * (x - (float)i);
+    }
+};
+
+} // namespace detail
+
+// Independent gain ramps for many channels at once. Per-channel state is
+// kept as parallel arrays (one array per field, indexed by channel), so
+// each block is two passes: one over the channels to find every gain at
+// the start and end of a short sub-block from the curve tables, then one
+// over the samples that multiplies each frame by the row of gains. Curved
+// ramps are followed exactly at sub-block boundaries and linearly in
+// between.
+//
+// arm() and set() are for a single control thread; they queue a command
+// that the audio thread applies at the start of its next block.
+template <typename T> class fader_bank
+{
+    static_assert(std::is_floating_point<T>::value,
+                  "fader_bank needs a floating point sample type");
+
+  public:
+    static constexpr int SUB_BLOCK = 32;
+
+  private:
+    struct command
+    {
+        int ch;
+        T dest;
+        int frames; // 0: jump straight there
+        FadeCurve curve;
+    };
+
+    const detail::fade_curve_tables &m_tables;
+    int m_nch;
+    lockfree::spsc_ring<command> m_commands;
+
+    // audio thread state, one entry per channel
+    std::vector<T> m_gain;
+    std::vector<T> m_from;
+    std::vector<T> m_range; // to - from
+    std::vector<float> m_pos;
+    std::vector<float> m_posInc;
+    std::vector<int> m_left;
+    std::vector<int> m_table;
+    std::vector<T> m_step; // per frame, for the current sub-block
+    std::vector<T> m_row;  // scratch: the gains for the current frame
+    std::vector<int> m_active; // channels with a ramp in progress
+    bool m_allUnity = false;
+
+    // published once per block
+    std::vector<std::atomic<T>> m_publishedGain;
+    std::vector<std::atomic<bool>> m_publishedActive;
+
+    void apply(const command &c)
+    {
+        if (c.ch < 0 || c.ch >= m_nch) return;
+        const int ch = c.ch;
+        const bool wasActive = m_left[ch] > 0;
+        if (c.frames <= 0)
+        {
+            m_gain[ch] = c.dest;
+            m_left[ch] = 0;
+        }
+        else
+        {
+            m_from[ch] = m_gain[ch];
+            m_range[ch] = c.dest - m_gain[ch];
+            m_pos[ch] = 0;
+            m_posInc[ch] = 1.0f / (float)c.frames;
+            m_left[ch] = c.frames;
+            m_table[ch] =
+                detail::fade_curve_tables::index(c.curve, m_range[ch] < 0);
+        }
+        const bool isActive = m_left[ch] > 0;
+        if (isActive && !wasActive)
+        {
+            m_active.push_back(ch); // never reallocates: reserved nch
+        }
+        else if (!isActive && wasActive)
+        {
+            m_active.erase(std::find(m_active.begin(), m_active.end(), ch));
+        }
+    }
+
+    void pick_up_commands()
+    {
+        command c;
+        bool any = false;
+        while (m_commands.pop(c))
+        {
+            apply(c);
+            any = true;
+        }
+        if (any) update_unity();
+    }
+
+    void update_unity()
+    {
+        m_allUnity = m_active.empty() &&
+                     std::all_of(m_gain.begin(), m_gain.end(),
+                                 [](T g) { return g == (T)1; });
+    }
+
+    // Works out m_step for the next n frames and moves every active ramp
+    // on by n frames. m_gain[] is left at the start of the sub-block.
+    void plan_sub_block(int n)
+    {
+        for (int ch : m_active)
+        {
+            T end;
+            if (m_left[ch] <= n)
+            {
+                end = m_from[ch] + m_range[ch];
+            }
+            else
+            {
+                const float p = m_pos[ch] + m_posInc[ch] * (float)n;
+                end = m_from[ch] +
+                      m_range[ch] * (T)m_tables.lookup(m_table[ch], p);
+            }
+            m_step[ch] = (end - m_gain[ch]) / (T)n;
+        }
+    }
+
+    // after the samples for the sub-block have been done
+    void finish_sub_block(int n)
+    {
+        bool finished = false;
+        for (int ch : m_active)
+        {
+            m_gain[ch] += m_step[ch] * (T)n;
+            m_step[ch] = 0;
+            m_pos[ch] += m_posInc[ch] * (float)n;
+            m_left[ch] -= n;
+            if (m_left[ch] <= 0)
+            {
+                m_left[ch] = 0;
+                m_gain[ch] = m_from[ch] + m_range[ch];
+                finished = true;
+            }
+        }
+        if (finished)
+        {
+            m_active.erase(std::remove_if(m_active.begin(), m_active.end(),
+                                          [this](int ch) {
+                                              return m_left[ch] == 0;
+                                          }),
+                           m_active.end());
+            update_unity();
+        }
+    }
+
+    void publish()
+    {
+        for (int ch = 0; ch < m_nch; ++ch)
+        {
+            m_publishedGain[ch].store(m_gain[ch], std::memory_order_relaxed);
+            m_publishedActive[ch].store(m_left[ch] > 0,
+                                        std::memory_order_relaxed);
+        }
+    }
+
+  public:
+    explicit fader_bank(int nch, T initialGain = 1,
+                        size_t commandCapacity = 1024)
+        : m_tables(detail::fade_curve_tables::get()), m_nch(nch),
+          m_commands(commandCapacity), m_gain(nch, initialGain),
+          m_from(nch, initialGain), m_range(nch, 0), m_pos(nch, 0),
+          m_posInc(nch, 0), m_left(nch, 0), m_table(nch, 0), m_step(nch, 0),
+          m_row(nch, 0), m_publishedGain(nch), m_publishedActive(nch)
+    {
+        assert(nch > 0);
+        m_active.reserve(nch);
+        update_unity();
+        publish();
+    }
+    fader_bank(const fader_bank &) = delete;
+    fader_bank &operator=(const fader_bank &) = delete;
+
+    int channels() const noexcept { return m_nch; }
+
+    // Control thread. Ramps channel ch from wherever it is when the audio
+    // thread next runs. Returns false if the command queue is full.
+    bool arm(int ch, T dest, float samplerate, float secToDest,
+             FadeCurve curve = FadeCurve::linear)
+    {
+        const int frames = secToDest > 0 && samplerate > 0
+                               ? (int)(secToDest * samplerate + 0.5f)
+                               : 0;
+        if (!m_commands.push(command{ch, dest, frames, curve})) return false;
+        if (frames > 0 && ch >= 0 && ch < m_nch)
+        {
+            m_publishedActive[ch].store(true, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Control thread. Jumps channel ch straight to gain.
+    bool set(int ch, T gain)
+    {
+        return m_commands.push(command{ch, gain, 0, FadeCurve::linear});
+    }
+
+    // as of the last processed block; any thread
+    T volume(int ch) const noexcept
+    {
+        return m_publishedGain[ch].load(std::memory_order_relaxed);
+    }
+    bool active(int ch) const noexcept
+    {
+        return m_publishedActive[ch].load(std::memory_order_relaxed);
+    }
+
+    // nFrames of interleaved audio with channels() channels
+    void processSamples(int nFrames, T *samples)
+    {
+        pick_up_commands();
+        const int nch = m_nch;
+        T *row = m_row.data();
+        const T *step = m_step.data();
+        while (nFrames > 0 && !m_active.empty())
+        {
+            const int n = (std::min)(nFrames, (int)SUB_BLOCK);
+            plan_sub_block(n);
+            std::copy(m_gain.begin(), m_gain.end(), row);
+            for (int i = 0; i < n; ++i)
+            {
+                T *frame = samples + i * nch;
+                for (int ch = 0; ch < nch; ++ch)
+                {
+                    frame[ch] *= row[ch];
+                    row[ch] += step[ch];
+                }
+            }
+            finish_sub_block(n);
+            samples += n * nch;
+            nFrames -= n;
+        }
+        publish();
+
+        if (nFrames <= 0 || m_allUnity) return;
+        const T *gain = m_gain.data();
+        for (int i = 0; i < nFrames; ++i)
+        {
+            T *frame = samples + i * nch;
+            for (int ch = 0; ch < nch; ++ch)
+            {
+                frame[ch] *= gain[ch];
+            }
+        }
+    }
+
+    // nFrames of non-interleaved audio: channels[ch] points at nFrames
+    // samples for each of the channels() channels.
+    void processPlanar(int nFrames, T *const *channels)
+    {
+        pick_up_commands();
+        int offset = 0;
+        while (nFrames > 0 && !m_active.empty())
+        {
+            const int n = (std::min)(nFrames, (int)SUB_BLOCK);
+            plan_sub_block(n);
+            for (int ch = 0; ch < m_nch; ++ch)
+            {
+                T *s = channels[ch] + offset;
+                const T g = m_gain[ch];
+                const T step = m_step[ch];
+                if (step == 0 && g == (T)1) continue;
+                for (int i = 0; i < n; ++i)
+                {
+                    s[i] *= g + step * (T)i;
+                }
+            }
+            finish_sub_block(n);
+            offset += n;
+            nFrames -= n;
+        }
+        publish();
+
+        if (nFrames <= 0 || m_allUnity) return;
+        for (int ch = 0; ch < m_nch; ++ch)
+        {
+            const T g = m_gain[ch];
+            if (g == (T)1) continue;
+            T *s = channels[ch] + offset;
+            for (int i = 0; i < nFrames; ++i)
+            {
+                s[i] *= g;
+            }
+        }
+    }
+};
+
+} // namespace dsp
+} // namespace audio
@@ -0,0 +1,207 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+// Fast Fourier transform of real signals, of any power-of-two size. The
+// N real inputs are packed as N/2 complex ones, transformed by a radix-4
+// (with one radix-2 stage for odd powers) Stockham FFT and then split
+// into the N/2 + 1 bins of the real spectrum. The data is kept as
+// separate real and imaginary arrays and the Stockham ordering needs no
+// bit reversal, so the inner loops are unit-stride and vectorise. All the
+// twiddles are precomputed: nothing allocates after construction.
+class real_fft
+{
+    unsigned int m_size;
+    unsigned int m_half;
+    std::vector<unsigned int> m_radix;  // per stage: 4 or 2
+    std::vector<float> m_twRe, m_twIm;  // per radix-4 stage: w, w^2, w^3
+    std::vector<float> m_splitRe, m_splitIm; // e^(-2 pi i k / N)
+    std::vector<float> m_xr, m_xi, m_yr, m_yi;
+
+    // The complex FFT of m_half points in m_xr/m_xi. Returns which pair
+    // of buffers holds the result.
+    bool complex_forward() noexcept
+    {
+        float *xr = m_xr.data(), *xi = m_xi.data();
+        float *yr = m_yr.data(), *yi = m_yi.data();
+        size_t n = m_half, s = 1, tw = 0;
+        bool inX = true;
+        for (unsigned int radix : m_radix)
+        {
+            if (radix == 4)
+            {
+                const size_t n1 = n / 4;
+                for (size_t p = 0; p < n1; ++p)
+                {
+                    const float *wr = &m_twRe[tw + 3 * p];
+                    const float *wi = &m_twIm[tw + 3 * p];
+                    const float *ar = xr + s * p, *ai = xi + s * p;
+                    const float *br = ar + s * n1, *bi = ai + s * n1;
+                    const float *cr = br + s * n1, *ci = bi + s * n1;
+                    const float *dr = cr + s * n1, *di = ci + s * n1;
+                    float *y0r = yr + s * 4 * p, *y0i = yi + s * 4 * p;
+                    float *y1r = y0r + s, *y1i = y0i + s;
+                    float *y2r = y1r + s, *y2i = y1i + s;
+                    float *y3r = y2r + s, *y3i = y2i + s;
+                    for (size_t q = 0; q < s; ++q)
+                    {
+                        const float apcR = ar[q] + cr[q], apcI = ai[q] + ci[q];
+                        const float amcR = ar[q] - cr[q], amcI = ai[q] - ci[q];
+                        const float bpdR = br[q] + dr[q], bpdI = bi[q] + di[q];
+                        // j (b - d)
+                        const float jR = di[q] - bi[q], jI = br[q] - dr[q];
+                        y0r[q] = apcR + bpdR;
+                        y0i[q] = apcI + bpdI;
+                        const float t1R = amcR - jR, t1I = amcI - jI;
+                        y1r[q] = wr[0] * t1R - wi[0] * t1I;
+                        y1i[q] = wr[0] * t1I + wi[0] * t1R;
+                        const float t2R = apcR - bpdR, t2I = apcI - bpdI;
+                        y2r[q] = wr[1] * t2R - wi[1] * t2I;
+                        y2i[q] = wr[1] * t2I + wi[1] * t2R;
+                        const float t3R = amcR + jR, t3I = amcI + jI;
+                        y3r[q] = wr[2] * t3R - wi[2] * t3I;
+                        y3i[q] = wr[2] * t3I + wi[2] * t3R;
+                    }
+                }
+                tw += 3 * n1;
+                n /= 4;
+                s *= 4;
+            }
+            else
+            {
+                // the last stage, n == 2
+                for (size_t q = 0; q < s; ++q)
+                {
+                    const float ar = xr[q], ai = xi[q];
+                    const float br = xr[q + s], bi = xi[q + s];
+                    yr[q] = ar + br;
+                    yi[q] = ai + bi;
+                    yr[q + s] = ar - br;
+                    yi[q + s] = ai - bi;
+                }
+                n /= 2;
+                s *= 2;
+            }
+            std::swap(xr, yr);
+            std::swap(xi, yi);
+            inX = !inX;
+        }
+        return inX;
+    }
+
+  public:
+    explicit real_fft(unsigned int size) : m_size(size), m_half(size / 2)
+    {
+        if (size < 4 || (size & (size - 1)) != 0)
+        {
+            throw std::runtime_error("real_fft: size must be a power of two, "
+                                     "4 or more, not " +
+                                     std::to_string(size));
+        }
+        for (unsigned int n = m_half; n > 1;)
+        {
+            if (n >= 4)
+            {
+                m_radix.push_back(4);
+                for (unsigned int p = 0; p < n / 4; ++p)
+                {
+                    for (unsigned int k = 1; k <= 3; ++k)
+                    {
+                        const double a = -2.0 * M_PI * p * k / n;
+                        m_twRe.push_back((float)std::cos(a));
+                        m_twIm.push_back((float)std::sin(a));
+                    }
+                }
+                n /= 4;
+            }
+            else
+            {
+                m_radix.push_back(2);
+                n /= 2;
+            }
+        }
+        for (unsigned int k = 0; k <= m_half; ++k)
+        {
+            const double a = -2.0 * M_PI * k / size;
+            m_splitRe.push_back((float)std::cos(a));
+            m_splitIm.push_back((float)std::sin(a));
+        }
+        m_xr.resize(m_half);
+        m_xi.resize(m_half);
+        m_yr.resize(m_half);
+        m_yi.resize(m_half);
+    }
+
+    unsigned int size() const noexcept { return m_size; }
+    // the number of frequency bins: DC to Nyquist
+    unsigned int bins() const noexcept { return m_half + 1; }
+
+    // size() real samples in; bins() complex bins out, unscaled.
+    void forward(const float *in, float *re, float *im) noexcept
+    {
+        for (size_t k = 0; k < m_half; ++k)
+        {
+            m_xr[k] = in[2 * k];
+            m_xi[k] = in[2 * k + 1];
+        }
+        const bool inX = complex_forward();
+        const float *zr = inX ? m_xr.data() : m_yr.data();
+        const float *zi = inX ? m_xi.data() : m_yi.data();
+        // X[k] = E[k] + W^k O[k], where E and O are the transforms of the
+        // even and odd samples, recovered from Z[k] and conj(Z[N/2 - k])
+        for (size_t k = 0; k <= m_half; ++k)
+        {
+            const size_t a = k == m_half ? 0 : k;
+            const size_t b = k == 0 ? 0 : m_half - k;
+            const float eR = 0.5f * (zr[a] + zr[b]);
+            const float eI = 0.5f * (zi[a] - zi[b]);
+            const float oR = 0.5f * (zi[a] + zi[b]);
+            const float oI = -0.5f * (zr[a] - zr[b]);
+            re[k] = eR + m_splitRe[k] * oR - m_splitIm[k] * oI;
+            im[k] = eI + m_splitRe[k] * oI + m_splitIm[k] * oR;
+        }
+    }
+
+    // bins() complex bins in; size() real samples out: the exact inverse
+    // of forward(), scaling included.
+    void inverse(const float *re, const float *im, float *out) noexcept
+    {
+        // rebuild Z[k] = E[k] + i O[k], then take its inverse as the
+        // conjugate of the forward transform of its conjugate
+        for (size_t k = 0; k < m_half; ++k)
+        {
+            const size_t b = m_half - k;
+            const float eR = 0.5f * (re[k] + re[b]);
+            const float eI = 0.5f * (im[k] - im[b]);
+            const float dR = 0.5f * (re[k] - re[b]);
+            const float dI = 0.5f * (im[k] + im[b]);
+            // O = D conj(W^k)
+            const float oR = dR * m_splitRe[k] + dI * m_splitIm[k];
+            const float oI = dI * m_splitRe[k] - dR * m_splitIm[k];
+            m_xr[k] = eR - oI;
+            m_xi[k] = -(eI + oR);
+        }
+        const bool inX = complex_forward();
+        const float *zr = inX ? m_xr.data() : m_yr.data();
+        const float *zi = inX ? m_xi.data() : m_yi.data();
+        const float scale = 1.0f / m_half;
+        for (size_t k = 0; k < m_half; ++k)
+        {
+            out[2 * k] = zr[k] * scale;
+            out[2 * k + 1] = -zi[k] * scale;
+        }
+    }
+};
+
+} // namespace dsp
+} // namespace audio
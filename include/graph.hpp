@@ -0,0 +1,672 @@
+#pragma once
+#include "biquad.hpp"
+#include "lockfree.hpp"
+#include "myaudio.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace audio
+{
+
+namespace detail
+{
+// one step of a spin-wait: tells the core to ease off, where it can
+static inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+    defined(_M_IX86)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// The calling thread's scheduling class and priority, in one value that
+// can be handed to another thread through an atomic.
+static inline long long thread_scheduling() noexcept
+{
+#if defined(_WIN32)
+    return GetThreadPriority(GetCurrentThread());
+#else
+    int policy = 0;
+    sched_param p{};
+    if (pthread_getschedparam(pthread_self(), &policy, &p) != 0) return 0;
+    return (long long)policy << 32 | (unsigned int)p.sched_priority;
+#endif
+}
+// ... and onto the calling thread. False if the system would not (most
+// often for want of the right to realtime scheduling).
+static inline bool set_thread_scheduling(long long s) noexcept
+{
+#if defined(_WIN32)
+    return SetThreadPriority(GetCurrentThread(), (int)s) != 0;
+#else
+    sched_param p{};
+    p.sched_priority = (int)(s & 0xffffffff);
+    return pthread_setschedparam(pthread_self(), (int)(s >> 32), &p) == 0;
+#endif
+}
+} // namespace detail
+
+// A DSP processing graph: nodes (sources, faders, filters, mixers)
+// connected as a DAG, run each callback across a pool of worker threads.
+//
+// The control thread edits the graph (add(), connect(), output(), ...)
+// and then commit()s: the graph is compiled into a schedule, with every
+// buffer allocated and every node's inputs resolved, and the schedule is
+// published to the audio thread with a single atomic exchange. The audio
+// thread picks it up at the start of its next process(), and hands the
+// old one back to be freed by the control thread.
+//
+// In process() the nodes with no inputs are queued on the audio thread's
+// work-stealing deque and the workers are released. Each thread runs
+// what is on its own deque, or steals from the others, and queues any
+// node whose last input it has just produced, so independent branches
+// run in parallel. The workers are spawned up front and spin (then
+// yield, then nap) between callbacks; the audio thread takes part too,
+// and returns once every node has run and every worker has let go.
+//
+// So the audio thread waits on the workers, and a worker preempted in
+// the middle of a node stalls the callback. The workers therefore take
+// on the scheduling of the thread that calls process(): realtime, on a
+// stream opened with RTAUDIO_SCHEDULE_REALTIME. Where the system refuses
+// (no realtime rights), they run at normal priority, and the callback
+// can miss its deadline under load; realtime_workers() tells which.
+//
+// All nodes process interleaved float frames with the graph's channel
+// count. process() and OnAudioCallback() are for one audio thread; all
+// the rest is for one control thread.
+class graph : public AudioCallback
+{
+  public:
+    using node_id = unsigned int;
+    static constexpr node_id NO_NODE = ~0u;
+
+    struct buffers
+    {
+        const float *const *inputs; // one per incoming edge
+        unsigned int nInputs;
+        float *output;
+        unsigned int frames;
+        unsigned int channels;
+    };
+
+    // Override process(). It is called on whichever thread gets to the
+    // node first, so it must be realtime safe and must not depend on
+    // thread-local state.
+    class node
+    {
+      public:
+        virtual ~node() = default;
+        virtual void process(const buffers &b) noexcept = 0;
+    };
+
+    // output = the sum of the inputs (or silence, with none)
+    static void mix_inputs(const buffers &b) noexcept
+    {
+        const size_t n = (size_t)b.frames * b.channels;
+        if (b.nInputs == 0)
+        {
+            std::fill(b.output, b.output + n, 0.0f);
+            return;
+        }
+        memcpy(b.output, b.inputs[0], n * sizeof(float));
+        for (unsigned int i = 1; i < b.nInputs; ++i)
+        {
+            const float *in = b.inputs[i];
+            for (size_t j = 0; j < n; ++j)
+            {
+                b.output[j] += in[j];
+            }
+        }
+    }
+
+    // fn(output, frames, channels); ignores any inputs
+    class source_node : public node
+    {
+        std::function<void(float *, unsigned int, unsigned int)> m_fn;
+
+      public:
+        explicit source_node(
+            std::function<void(float *, unsigned int, unsigned int)> fn)
+            : m_fn(std::move(fn))
+        {
+        }
+        void process(const buffers &b) noexcept override
+        {
+            m_fn(b.output, b.frames, b.channels);
+        }
+    };
+
+    // the sum of the inputs, each with a gain that can be changed from
+    // any thread
+    class mixer_node : public node
+    {
+        std::vector<std::atomic<float>> m_gains;
+
+      public:
+        explicit mixer_node(unsigned int maxInputs, float gain = 1.0f)
+            : m_gains(maxInputs)
+        {
+            for (auto &g : m_gains)
+            {
+                g.store(gain, std::memory_order_relaxed);
+            }
+        }
+        void gain(unsigned int input, float g) noexcept
+        {
+            m_gains[input].store(g, std::memory_order_relaxed);
+        }
+        float gain(unsigned int input) const noexcept
+        {
+            return m_gains[input].load(std::memory_order_relaxed);
+        }
+        void process(const buffers &b) noexcept override
+        {
+            const size_t n = (size_t)b.frames * b.channels;
+            std::fill(b.output, b.output + n, 0.0f);
+            const unsigned int nin =
+                (std::min)(b.nInputs, (unsigned int)m_gains.size());
+            for (unsigned int i = 0; i < nin; ++i)
+            {
+                const float g = m_gains[i].load(std::memory_order_relaxed);
+                const float *in = b.inputs[i];
+                for (size_t j = 0; j < n; ++j)
+                {
+                    b.output[j] += g * in[j];
+                }
+            }
+        }
+    };
+
+    // a dsp::fader over the sum of the inputs
+    class fader_node : public node
+    {
+        dsp::fader<float> m_fader;
+
+      public:
+        fader_node(float initial, float samplerate, unsigned int nch)
+            : m_fader(initial, 0.0f, samplerate, (int)nch)
+        {
+        }
+        dsp::fader<float> &fader() noexcept { return m_fader; }
+        void process(const buffers &b) noexcept override
+        {
+            mix_inputs(b);
+            m_fader.processSamples((int)b.frames, b.output, (int)b.channels);
+        }
+    };
+
+    // a dsp::biquad_bank over the sum of the inputs
+    class filter_node : public node
+    {
+        dsp::biquad_bank<float> m_bank;
+
+      public:
+        filter_node(unsigned int nch, unsigned int stages, float samplerate)
+            : m_bank((int)nch, (int)stages, samplerate)
+        {
+        }
+        dsp::biquad_bank<float> &bank() noexcept { return m_bank; }
+        void process(const buffers &b) noexcept override
+        {
+            mix_inputs(b);
+            m_bank.processSamples((int)b.frames, b.output);
+        }
+    };
+
+  private:
+    // a compiled graph: immutable once published, except for the
+    // per-callback counters
+    struct schedule
+    {
+        std::vector<std::shared_ptr<node>> nodes;
+        std::vector<std::vector<const float *>> inputs;
+        std::vector<std::vector<unsigned int>> dependents;
+        std::vector<unsigned int> nDeps; // distinct upstream nodes
+        std::unique_ptr<std::atomic<unsigned int>[]> pending;
+        std::vector<unsigned int> roots;
+        std::vector<float> memory; // every node's output buffer
+        size_t stride = 0;         // floats per buffer
+        int output = -1;           // index of the output node
+    };
+
+    const unsigned int m_nch;
+    const unsigned int m_maxFrames;
+    const unsigned int m_maxNodes;
+
+    // control thread
+    struct edit_node
+    {
+        node_id id;
+        std::shared_ptr<node> n;
+    };
+    std::vector<edit_node> m_nodes;
+    std::vector<std::pair<node_id, node_id>> m_edges; // in connect() order
+    node_id m_next = 0;
+    node_id m_output = NO_NODE;
+
+    // publication
+    std::atomic<schedule *> m_pending{nullptr};
+    lockfree::spsc_ring<schedule *> m_retired; // audio -> control
+    schedule *m_current = nullptr;             // audio thread
+
+    // the pool
+    std::vector<std::unique_ptr<lockfree::ws_deque<unsigned int>>> m_deques;
+    std::vector<std::thread> m_workers;
+    std::atomic<bool> m_quit{false};
+    std::atomic<unsigned int> m_generation{0};
+    std::atomic<bool> m_open{false};
+    std::atomic<unsigned int> m_busy{0};
+    std::atomic<unsigned int> m_done{0};
+    schedule *m_job = nullptr; // set before m_open
+    unsigned int m_frames = 0;
+    std::vector<float> m_scratch; // OnAudioCallback, for other formats
+
+    // the audio thread's scheduling, for the workers to take on
+    static constexpr long long UNKNOWN = -1;
+    std::atomic<long long> m_scheduling{UNKNOWN};
+    std::atomic<unsigned int> m_matched{0}; // workers that took it on
+    std::thread::id m_audioThread;          // audio thread
+
+    const edit_node *find(node_id id) const noexcept
+    {
+        for (const auto &e : m_nodes)
+        {
+            if (e.id == id) return &e;
+        }
+        return nullptr;
+    }
+
+    // is there a path from a to b?
+    bool reaches(node_id a, node_id b) const
+    {
+        std::vector<node_id> todo{a}, seen;
+        while (!todo.empty())
+        {
+            const node_id n = todo.back();
+            todo.pop_back();
+            if (n == b) return true;
+            if (std::find(seen.begin(), seen.end(), n) != seen.end()) continue;
+            seen.push_back(n);
+            for (const auto &e : m_edges)
+            {
+                if (e.first == n) todo.push_back(e.second);
+            }
+        }
+        return false;
+    }
+
+    schedule *compile() const
+    {
+        auto s = std::make_unique<schedule>();
+        const size_t n = m_nodes.size();
+        // Kahn's algorithm, keeping the order nodes were added in where
+        // there is a choice
+        std::vector<unsigned int> indeg(n, 0);
+        auto index_of = [this](node_id id) {
+            for (size_t i = 0; i < m_nodes.size(); ++i)
+            {
+                if (m_nodes[i].id == id) return (unsigned int)i;
+            }
+            return ~0u;
+        };
+        for (const auto &e : m_edges)
+        {
+            ++indeg[index_of(e.second)];
+        }
+        std::vector<unsigned int> order, slot(n, ~0u);
+        std::vector<bool> placed(n, false);
+        while (order.size() < n)
+        {
+            size_t before = order.size();
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                if (placed[i] || indeg[i] != 0) continue;
+                placed[i] = true;
+                slot[i] = (unsigned int)order.size();
+                order.push_back(i);
+                for (const auto &e : m_edges)
+                {
+                    if (e.first == m_nodes[i].id) --indeg[index_of(e.second)];
+                }
+            }
+            if (order.size() == before)
+            {
+                throw std::runtime_error("graph: the graph has a cycle");
+            }
+        }
+
+        s->stride = (size_t)m_nch * m_maxFrames;
+        s->memory.assign(s->stride * n, 0.0f);
+        s->nodes.resize(n);
+        s->inputs.resize(n);
+        s->dependents.resize(n);
+        s->nDeps.assign(n, 0);
+        s->pending.reset(new std::atomic<unsigned int>[n]);
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            s->nodes[slot[i]] = m_nodes[i].n;
+        }
+        for (const auto &e : m_edges)
+        {
+            const unsigned int from = slot[index_of(e.first)];
+            const unsigned int to = slot[index_of(e.second)];
+            s->inputs[to].push_back(&s->memory[s->stride * from]);
+            auto &d = s->dependents[from];
+            if (std::find(d.begin(), d.end(), to) == d.end())
+            {
+                d.push_back(to);
+                ++s->nDeps[to];
+            }
+        }
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            if (s->nDeps[i] == 0) s->roots.push_back(i);
+        }
+        if (m_output != NO_NODE) s->output = (int)slot[index_of(m_output)];
+        return s.release();
+    }
+
+    void collect() noexcept
+    {
+        schedule *s = nullptr;
+        while (m_retired.pop(s))
+        {
+            delete s;
+        }
+    }
+
+    void run(schedule &s, unsigned int i, unsigned int self) noexcept
+    {
+        const auto &in = s.inputs[i];
+        const buffers b{in.data(), (unsigned int)in.size(),
+                        &s.memory[s.stride * i], m_frames, m_nch};
+        s.nodes[i]->process(b);
+        for (unsigned int d : s.dependents[i])
+        {
+            if (s.pending[d].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                m_deques[self]->push(d);
+            }
+        }
+        m_done.fetch_add(1, std::memory_order_release);
+    }
+
+    void run_tasks(unsigned int self) noexcept
+    {
+        schedule &s = *m_job;
+        const unsigned int n = (unsigned int)s.nodes.size();
+        const unsigned int nq = (unsigned int)m_deques.size();
+        unsigned int idx = 0;
+        while (m_done.load(std::memory_order_acquire) < n)
+        {
+            bool got = m_deques[self]->pop(idx);
+            for (unsigned int k = 1; !got && k < nq; ++k)
+            {
+                got = m_deques[(self + k) % nq]->steal(idx);
+            }
+            if (got)
+                run(s, idx, self);
+            else
+                detail::cpu_relax();
+        }
+    }
+
+    void worker(unsigned int self)
+    {
+        unsigned int seen = m_generation.load();
+        unsigned int idle = 0;
+        long long scheduling = UNKNOWN;
+        bool matched = false;
+        while (!m_quit.load(std::memory_order_relaxed))
+        {
+            const long long want = m_scheduling.load(std::memory_order_relaxed);
+            if (want != scheduling)
+            {
+                scheduling = want;
+                const bool ok = detail::set_thread_scheduling(want);
+                if (ok && !matched) m_matched.fetch_add(1);
+                if (!ok && matched) m_matched.fetch_sub(1);
+                matched = ok;
+            }
+            if (m_generation.load(std::memory_order_acquire) != seen &&
+                m_open.load())
+            {
+                // announce ourselves before looking at the job, so the
+                // audio thread cannot close it and move on unseen
+                m_busy.fetch_add(1);
+                const unsigned int gen = m_generation.load();
+                if (m_open.load() && gen != seen)
+                {
+                    seen = gen;
+                    run_tasks(self);
+                }
+                m_busy.fetch_sub(1);
+                idle = 0;
+                continue;
+            }
+            // spin through the gap between callbacks, but not forever
+            if (++idle < 4096)
+                detail::cpu_relax();
+            else if (idle < 8192)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    void render(float *out, unsigned int frames) noexcept
+    {
+        // once per audio thread: a reopened stream may run on a new one
+        const auto self = std::this_thread::get_id();
+        if (self != m_audioThread)
+        {
+            m_audioThread = self;
+            m_scheduling.store(detail::thread_scheduling(),
+                               std::memory_order_relaxed);
+        }
+        schedule &s = *m_current;
+        const unsigned int n = (unsigned int)s.nodes.size();
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            s.pending[i].store(s.nDeps[i], std::memory_order_relaxed);
+        }
+        m_done.store(0, std::memory_order_relaxed);
+        m_job = &s;
+        m_frames = frames;
+        for (auto it = s.roots.rbegin(); it != s.roots.rend(); ++it)
+        {
+            m_deques[0]->push(*it);
+        }
+        m_generation.fetch_add(1, std::memory_order_release);
+        m_open.store(true);
+        run_tasks(0);
+        m_open.store(false);
+        while (m_busy.load() != 0)
+        {
+            detail::cpu_relax();
+        }
+        const size_t len = (size_t)frames * m_nch;
+        if (s.output >= 0)
+            memcpy(out, &s.memory[s.stride * s.output], len * sizeof(float));
+        else
+            std::fill(out, out + len, 0.0f);
+    }
+
+  public:
+    // one per core, the audio thread's included
+    static unsigned int default_workers() noexcept
+    {
+        const unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    // workers: threads besides the audio thread; maxNodes bounds the size
+    // of any one schedule.
+    graph(unsigned int nch, unsigned int maxFrames,
+          unsigned int workers = default_workers(),
+          unsigned int maxNodes = 1024)
+        : m_nch(nch), m_maxFrames(maxFrames), m_maxNodes(maxNodes),
+          m_retired(16), m_scratch((size_t)nch * maxFrames)
+    {
+        assert(nch > 0 && maxFrames > 0);
+        for (unsigned int i = 0; i <= workers; ++i)
+        {
+            m_deques.push_back(
+                std::make_unique<lockfree::ws_deque<unsigned int>>(maxNodes));
+        }
+        for (unsigned int i = 1; i <= workers; ++i)
+        {
+            m_workers.emplace_back([this, i] { worker(i); });
+        }
+    }
+    graph(const graph &) = delete;
+    graph &operator=(const graph &) = delete;
+    ~graph()
+    {
+        m_quit = true;
+        for (auto &t : m_workers)
+        {
+            t.join();
+        }
+        collect();
+        delete m_pending.exchange(nullptr);
+        delete m_current;
+    }
+
+    unsigned int channels() const noexcept { return m_nch; }
+    unsigned int workers() const noexcept
+    {
+        return (unsigned int)m_workers.size();
+    }
+    // Whether every worker runs with the audio thread's scheduling (see
+    // above). False until the workers have seen a process().
+    bool realtime_workers() const noexcept
+    {
+        return m_matched.load() == m_workers.size();
+    }
+
+    // Control thread. Edits take effect at the next commit().
+    node_id add(std::shared_ptr<node> n)
+    {
+        if (!n) throw std::runtime_error("graph: null node");
+        if (m_nodes.size() >= m_maxNodes)
+        {
+            throw std::runtime_error("graph: more than " +
+                                     std::to_string(m_maxNodes) + " nodes");
+        }
+        m_nodes.push_back(edit_node{m_next, std::move(n)});
+        return m_next++;
+    }
+    void remove(node_id id)
+    {
+        auto touches = [id](const std::pair<node_id, node_id> &e) {
+            return e.first == id || e.second == id;
+        };
+        m_edges.erase(std::remove_if(m_edges.begin(), m_edges.end(), touches),
+                      m_edges.end());
+        m_nodes.erase(std::remove_if(m_nodes.begin(), m_nodes.end(),
+                                     [id](const edit_node &e) {
+                                         return e.id == id;
+                                     }),
+                      m_nodes.end());
+        if (m_output == id) m_output = NO_NODE;
+    }
+    // from's output becomes the next input of to
+    void connect(node_id from, node_id to)
+    {
+        if (!find(from) || !find(to))
+        {
+            throw std::runtime_error("graph: connect() to a missing node");
+        }
+        if (from == to || reaches(to, from))
+        {
+            throw std::runtime_error("graph: connecting " +
+                                     std::to_string(from) + " to " +
+                                     std::to_string(to) + " makes a cycle");
+        }
+        m_edges.emplace_back(from, to);
+    }
+    void disconnect(node_id from, node_id to)
+    {
+        m_edges.erase(std::remove(m_edges.begin(), m_edges.end(),
+                                  std::make_pair(from, to)),
+                      m_edges.end());
+    }
+    // the node whose output is the stream's
+    void output(node_id id)
+    {
+        if (!find(id)) throw std::runtime_error("graph: no such node");
+        m_output = id;
+    }
+
+    // Compiles the edits so far and publishes them to the audio thread.
+    void commit()
+    {
+        collect();
+        schedule *s = compile();
+        // one the audio thread never picked up can go straight away
+        delete m_pending.exchange(s, std::memory_order_acq_rel);
+    }
+
+    // Audio thread: frames interleaved float frames of the output node.
+    void process(float *out, unsigned int frames) noexcept
+    {
+        // commit() collects the retired schedules before publishing, so
+        // the ring is only full if nobody has committed for a long while
+        if (m_retired.size() < m_retired.capacity())
+        {
+            schedule *s =
+                m_pending.exchange(nullptr, std::memory_order_acq_rel);
+            if (s)
+            {
+                if (m_current) m_retired.push(m_current);
+                m_current = s;
+            }
+        }
+        while (frames > 0)
+        {
+            const unsigned int n = (std::min)(frames, m_maxFrames);
+            if (m_current)
+                render(out, n);
+            else
+                std::fill(out, out + (size_t)n * m_nch, 0.0f);
+            out += (size_t)n * m_nch;
+            frames -= n;
+        }
+    }
+
+    // As a stream's callback, in whatever format the stream runs.
+    int OnAudioCallback(const StreamCallbackInfo &info) override
+    {
+        assert(info.format.Channels == m_nch);
+        auto render = [this](float *out, unsigned int n) { process(out, n); };
+        detail::render_float(info, m_scratch, render);
+        return 0;
+    }
+};
+
+} // namespace audio
@@ -0,0 +1,402 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace audio
+{
+namespace lockfree
+{
+
+// Keep producer and consumer indices on separate cache lines so the
+// realtime thread and the worker do not fight over the same line.
+static constexpr size_t CACHE_LINE_SIZE = 64;
+
+static inline size_t next_pow2(size_t v)
+{
+    size_t ret = 1;
+    while (ret < v)
+        ret <<= 1;
+    return ret;
+}
+
+// Single-producer, single-consumer ring of trivially copyable items.
+// All storage is allocated in the constructor: push() and pop() never
+// allocate, never lock, and are safe to call from the audio callback.
+template <typename T> class spsc_ring
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "spsc_ring requires a trivially copyable type");
+
+    std::vector<T> m_items;
+    size_t m_mask = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_write{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_read{0};
+
+  public:
+    explicit spsc_ring(size_t capacity)
+        : m_items(next_pow2(capacity + 1)), m_mask(m_items.size() - 1)
+    {
+    }
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring &operator=(const spsc_ring &) = delete;
+
+    size_t capacity() const noexcept { return m_mask; }
+
+    // producer only
+    bool push(const T &item) noexcept
+    {
+        const size_t w = m_write.load(std::memory_order_relaxed);
+        const size_t next = (w + 1) & m_mask;
+        if (next == m_read.load(std::memory_order_acquire)) return false;
+        m_items[w] = item;
+        m_write.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only
+    bool pop(T &item) noexcept
+    {
+        const size_t r = m_read.load(std::memory_order_relaxed);
+        if (r == m_write.load(std::memory_order_acquire)) return false;
+        item = m_items[r];
+        m_read.store((r + 1) & m_mask, std::memory_order_release);
+        return true;
+    }
+
+    // producer only. Pushes as many of the n items as fit; returns how
+    // many that was.
+    size_t push(const T *items, size_t n) noexcept
+    {
+        const size_t w = m_write.load(std::memory_order_relaxed);
+        const size_t r = m_read.load(std::memory_order_acquire);
+        const size_t space = m_mask - ((w - r) & m_mask);
+        n = n < space ? n : space;
+        const size_t first = n < m_items.size() - w ? n : m_items.size() - w;
+        std::copy(items, items + first, m_items.data() + w);
+        std::copy(items + first, items + n, m_items.data());
+        m_write.store((w + n) & m_mask, std::memory_order_release);
+        return n;
+    }
+
+    // consumer only. Pops up to n items; returns how many it did.
+    size_t pop(T *items, size_t n) noexcept
+    {
+        const size_t r = m_read.load(std::memory_order_relaxed);
+        const size_t w = m_write.load(std::memory_order_acquire);
+        const size_t avail = (w - r) & m_mask;
+        n = n < avail ? n : avail;
+        const size_t first = n < m_items.size() - r ? n : m_items.size() - r;
+        std::copy(m_items.data() + r, m_items.data() + r + first, items);
+        std::copy(m_items.data(), m_items.data() + (n - first), items + first);
+        m_read.store((r + n) & m_mask, std::memory_order_release);
+        return n;
+    }
+
+    // approximate when called from a third thread
+    size_t size() const noexcept
+    {
+        const size_t w = m_write.load(std::memory_order_acquire);
+        const size_t r = m_read.load(std::memory_order_acquire);
+        return (w - r) & m_mask;
+    }
+    bool empty() const noexcept { return size() == 0; }
+};
+
+// Hands the latest value from one writer thread to one reader thread
+// without either ever waiting. Three slots: the writer fills its back
+// slot then swaps it with the middle one; the reader swaps its front slot
+// with the middle one whenever there is something new there. The back
+// slot the writer gets after publish() holds an older value, so it must
+// be written in full each time.
+template <typename T> class triple_buffer
+{
+    static constexpr unsigned int INDEX = 3;
+    static constexpr unsigned int FRESH = 4;
+
+    T m_slots[3];
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> m_middle{1};
+    alignas(CACHE_LINE_SIZE) unsigned int m_back = 2; // writer's
+    alignas(CACHE_LINE_SIZE) unsigned int m_front = 0; // reader's
+
+  public:
+    explicit triple_buffer(const T &initial = T())
+        : m_slots{initial, initial, initial}
+    {
+    }
+    triple_buffer(const triple_buffer &) = delete;
+    triple_buffer &operator=(const triple_buffer &) = delete;
+
+    // writer only
+    T &back() noexcept { return m_slots[m_back]; }
+    void publish() noexcept
+    {
+        m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) &
+                 INDEX;
+    }
+
+    // reader only: the most recently published value
+    const T &read() noexcept
+    {
+        if (m_middle.load(std::memory_order_relaxed) & FRESH)
+        {
+            m_front =
+                m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+        }
+        return m_slots[m_front];
+    }
+};
+
+// Chase-Lev work-stealing deque of a fixed capacity (a power of two), for
+// trivially copyable items. The owning thread push()es and pop()s at the
+// bottom; any other thread may steal() from the top. Lock-free; nothing
+// allocates after construction. push() fails when full.
+template <typename T> class ws_deque
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "ws_deque requires a trivially copyable type");
+
+    std::vector<std::atomic<T>> m_items;
+    const long long m_mask;
+    alignas(CACHE_LINE_SIZE) std::atomic<long long> m_top{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<long long> m_bottom{0};
+
+  public:
+    explicit ws_deque(size_t capacity)
+        : m_items(next_pow2(capacity)), m_mask((long long)m_items.size() - 1)
+    {
+    }
+    ws_deque(const ws_deque &) = delete;
+    ws_deque &operator=(const ws_deque &) = delete;
+
+    // owner only
+    bool push(const T &item) noexcept
+    {
+        const long long b = m_bottom.load(std::memory_order_relaxed);
+        const long long t = m_top.load(std::memory_order_acquire);
+        if (b - t > m_mask) return false;
+        m_items[b & m_mask].store(item, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // owner only: the most recently pushed item
+    bool pop(T &item) noexcept
+    {
+        const long long b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long t = m_top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = m_items[b & m_mask].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // the last one: race any thieves for it
+            const bool won = m_top.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst,
+                std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // any thread: the oldest item
+    bool steal(T &item) noexcept
+    {
+        long long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const long long b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) return false;
+        item = m_items[t & m_mask].load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(t, t + 1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed);
+    }
+
+    bool empty() const noexcept
+    {
+        return m_bottom.load(std::memory_order_relaxed) <=
+               m_top.load(std::memory_order_relaxed);
+    }
+};
+
+// Bounded multi-producer, multi-consumer queue (Vyukov's): each cell
+// carries a sequence number that says whether it is free for the next
+// push or full for the next pop, so producers and consumers only contend
+// on their own index. Lock-free; all storage is allocated up front.
+template <typename T> class mpmc_queue
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "mpmc_queue requires a trivially copyable type");
+
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        T item;
+    };
+    std::vector<cell> m_cells;
+    const size_t m_mask;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_push{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_pop{0};
+
+  public:
+    explicit mpmc_queue(size_t capacity)
+        : m_cells(next_pow2((std::max)(capacity, (size_t)2))),
+          m_mask(m_cells.size() - 1)
+    {
+        for (size_t i = 0; i < m_cells.size(); ++i)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    mpmc_queue(const mpmc_queue &) = delete;
+    mpmc_queue &operator=(const mpmc_queue &) = delete;
+
+    size_t capacity() const noexcept { return m_cells.size(); }
+
+    // false if full
+    bool push(const T &item) noexcept
+    {
+        size_t pos = m_push.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell &c = m_cells[pos & m_mask];
+            const size_t seq = c.seq.load(std::memory_order_acquire);
+            const auto diff = (std::ptrdiff_t)(seq - pos);
+            if (diff == 0)
+            {
+                if (m_push.compare_exchange_weak(pos, pos + 1,
+                                                 std::memory_order_relaxed))
+                {
+                    c.item = item;
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_push.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // false if empty
+    bool pop(T &item) noexcept
+    {
+        size_t pos = m_pop.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell &c = m_cells[pos & m_mask];
+            const size_t seq = c.seq.load(std::memory_order_acquire);
+            const auto diff = (std::ptrdiff_t)(seq - (pos + 1));
+            if (diff == 0)
+            {
+                if (m_pop.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed))
+                {
+                    item = c.item;
+                    c.seq.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_pop.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Read-copy-update publication of a T to one realtime reader. Writers
+// build the new T off the audio thread and publish() it with a single
+// pointer store; the reader read()s the current pointer when it starts
+// work and calls quiesce() when it holds no pointer any more (at the end
+// of a callback, say), or only the one it names. A replaced T is kept
+// until the reader has passed a quiescent point after its replacement,
+// not still holding it; collect(), on any non-realtime thread, then
+// releases it. The reader side never locks or allocates, and never runs
+// a destructor.
+template <typename T> class rcu
+{
+    std::atomic<T *> m_current;
+    std::atomic<uint64_t> m_epoch{0};       // quiescent points passed
+    std::atomic<const T *> m_kept{nullptr}; // held across the last one
+    mutable std::mutex m_lock;              // writers
+    std::shared_ptr<T> m_owner;
+    std::vector<std::pair<uint64_t, std::shared_ptr<T>>> m_retired;
+
+  public:
+    explicit rcu(std::shared_ptr<T> initial)
+        : m_current(initial.get()), m_owner(std::move(initial))
+    {
+    }
+    rcu(const rcu &) = delete;
+    rcu &operator=(const rcu &) = delete;
+
+    // reader
+    T *read() const noexcept { return m_current.load(); }
+    // keep: a pointer read() returned that the reader goes on using
+    void quiesce(const T *keep = nullptr) noexcept
+    {
+        m_kept.store(keep); // seen by any collect() that sees the epoch
+        m_epoch.store(m_epoch.load(std::memory_order_relaxed) + 1);
+    }
+
+    // Writers. The old T is retired, not released: see collect().
+    void publish(std::shared_ptr<T> next)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_current.store(next.get());
+        // a reader that saw the old pointer quiesces after this epoch
+        m_retired.emplace_back(m_epoch.load(), std::move(m_owner));
+        m_owner = std::move(next);
+    }
+    std::shared_ptr<T> current() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_owner;
+    }
+
+    // Releases what the reader can no longer hold. Returns how many are
+    // still waiting for it.
+    size_t collect()
+    {
+        std::vector<std::shared_ptr<T>> done; // destroyed unlocked
+        std::lock_guard<std::mutex> lock(m_lock);
+        const uint64_t now = m_epoch.load();
+        const T *kept = m_kept.load();
+        auto it = std::stable_partition(
+            m_retired.begin(), m_retired.end(), [now, kept](const auto &r) {
+                return r.first >= now || r.second.get() == kept;
+            });
+        for (auto i = it; i != m_retired.end(); ++i)
+        {
+            done.push_back(std::move(i->second));
+        }
+        m_retired.erase(it, m_retired.end());
+        return m_retired.size();
+    }
+};
+
+} // namespace lockfree
+} // namespace audio
@@ -0,0 +1,406 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include "biquad.hpp"
+#include "lockfree.hpp"
+#include "samples.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+// What a loudness_meter last measured. Levels are linear (1.0 == full
+// scale); loudness is in LUFS, and -infinity before there is any signal.
+struct MeterReadings
+{
+    // per channel, over the last update (100ms)
+    std::vector<float> peak;
+    std::vector<float> truePeak; // 4x oversampled, per ITU-R BS.1770-4
+    std::vector<float> rms;
+    float maxTruePeak = 0; // all channels, since the meter started
+
+    double momentary = -std::numeric_limits<double>::infinity(); // 400ms
+    double shortTerm = -std::numeric_limits<double>::infinity(); // 3s
+    double integrated = -std::numeric_limits<double>::infinity(); // gated
+
+    uint64_t frames = 0;       // metered so far
+    uint64_t droppedFrames = 0; // the callback found the queue full
+};
+
+inline double to_db(double linear)
+{
+    return linear > 0 ? 20.0 * std::log10(linear)
+                      : -std::numeric_limits<double>::infinity();
+}
+
+// Level and loudness metering (EBU R128 / ITU-R BS.1770-4) that keeps the
+// audio callback's share down to a block copy: push() only queues the
+// samples on a lock-free ring. A meter thread (or anyone calling
+// process()) does the K-weighting, gating and true-peak oversampling, and
+// publishes a MeterReadings every 100ms through a triple buffer, which
+// one reader thread picks up with readings() without ever locking.
+class loudness_meter
+{
+  public:
+    static constexpr unsigned int CHUNK = 1024;  // frames per pass
+    static constexpr unsigned int TP_PHASES = 4; // true-peak oversampling
+    static constexpr unsigned int TP_TAPS = 12;  // per phase
+
+  private:
+    // the integrated loudness histogram: 0.1 LU bins from -70 to +10 LUFS
+    static constexpr double HIST_MIN = -70.0;
+    static constexpr double HIST_STEP = 0.1;
+    static constexpr unsigned int HIST_BINS = 800;
+    static constexpr unsigned int SHORT_TERM_BLOCKS = 30; // of 100ms
+    static constexpr unsigned int MOMENTARY_BLOCKS = 4;
+
+    const unsigned int m_nch;
+    const double m_samplerate;
+    lockfree::spsc_ring<float> m_ring;
+    std::atomic<uint64_t> m_dropped{0};
+    lockfree::triple_buffer<MeterReadings> m_published;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+
+    // meter thread state
+    std::vector<float> m_weights;
+    biquad_bank<float> m_kweighting;
+    std::array<float, TP_PHASES * TP_TAPS> m_tpCoeffs{};
+    std::vector<float> m_tpHistory; // per channel, TP_TAPS - 1 samples
+    std::vector<float> m_chunk;     // CHUNK interleaved frames
+    std::vector<float> m_line;      // one channel: history + chunk
+    const unsigned int m_blockFrames; // 100ms
+    unsigned int m_blockCount = 0;
+    std::vector<double> m_energy;  // K-weighted, per channel, this block
+    std::vector<double> m_squares; // unweighted, per channel, this block
+    std::vector<float> m_peak, m_truePeak;
+    float m_maxTruePeak = 0;
+    std::array<double, SHORT_TERM_BLOCKS> m_blockPower{};
+    unsigned int m_blocksSeen = 0;
+    std::array<uint64_t, HIST_BINS> m_histCount{};
+    std::array<double, HIST_BINS> m_histPower{};
+    uint64_t m_frames = 0;
+
+    static double lufs(double power)
+    {
+        return power > 0 ? -0.691 + 10.0 * std::log10(power)
+                         : -std::numeric_limits<double>::infinity();
+    }
+
+    // The BS.1770 K-weighting pre-filter and RLB high-pass, for any rate
+    // (these reproduce the coefficients the standard gives for 48kHz).
+    static biquad_coeffs kweight_shelf(double fs)
+    {
+        const double f0 = 1681.974450955533, G = 3.999843853973347;
+        const double Q = 0.7071752369554196;
+        const double K = std::tan(M_PI * f0 / fs);
+        const double Vh = std::pow(10.0, G / 20.0);
+        const double Vb = std::pow(Vh, 0.4996667741545416);
+        const double a0 = 1.0 + K / Q + K * K;
+        biquad_coeffs c;
+        c.b0 = (Vh + Vb * K / Q + K * K) / a0;
+        c.b1 = 2.0 * (K * K - Vh) / a0;
+        c.b2 = (Vh - Vb * K / Q + K * K) / a0;
+        c.a1 = 2.0 * (K * K - 1.0) / a0;
+        c.a2 = (1.0 - K / Q + K * K) / a0;
+        return c;
+    }
+    static biquad_coeffs kweight_highpass(double fs)
+    {
+        const double f0 = 38.13547087602444, Q = 0.5003270373238773;
+        const double K = std::tan(M_PI * f0 / fs);
+        const double a0 = 1.0 + K / Q + K * K;
+        biquad_coeffs c;
+        c.b0 = 1.0;
+        c.b1 = -2.0;
+        c.b2 = 1.0;
+        c.a1 = 2.0 * (K * K - 1.0) / a0;
+        c.a2 = (1.0 - K / Q + K * K) / a0;
+        return c;
+    }
+
+    void design_true_peak()
+    {
+        // windowed-sinc interpolator: phase p of output sample n sits at
+        // n - (TP_TAPS / 2 - 1) + p / TP_PHASES in input samples
+        const double half = TP_TAPS / 2.0;
+        for (unsigned int p = 0; p < TP_PHASES; ++p)
+        {
+            for (unsigned int k = 0; k < TP_TAPS; ++k)
+            {
+                const double t =
+                    (half - 1) + (double)p / TP_PHASES - (double)k;
+                const double x = M_PI * t;
+                const double sinc = t == 0 ? 1.0 : std::sin(x) / x;
+                const double w = 0.5 + 0.5 * std::cos(M_PI * t / half);
+                m_tpCoeffs[p * TP_TAPS + k] = (float)(sinc * w);
+            }
+        }
+    }
+
+    void true_peak(unsigned int ch, const float *x, unsigned int n)
+    {
+        float *line = m_line.data();
+        float *hist = m_tpHistory.data() + (size_t)ch * (TP_TAPS - 1);
+        std::copy(hist, hist + TP_TAPS - 1, line);
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            line[TP_TAPS - 1 + i] = x[(size_t)i * m_nch + ch];
+        }
+        float tp = m_truePeak[ch];
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            const float *w = line + i;
+            for (unsigned int p = 0; p < TP_PHASES; ++p)
+            {
+                const float *c = &m_tpCoeffs[p * TP_TAPS];
+                float acc = 0;
+                for (unsigned int k = 0; k < TP_TAPS; ++k)
+                {
+                    acc += w[k] * c[k];
+                }
+                tp = (std::max)(tp, std::fabs(acc));
+            }
+        }
+        m_truePeak[ch] = tp;
+        std::copy(line + n, line + n + TP_TAPS - 1, hist);
+    }
+
+    // n interleaved frames, all within the current 100ms block
+    void measure(float *x, unsigned int n)
+    {
+        for (unsigned int ch = 0; ch < m_nch; ++ch)
+        {
+            float peak = m_peak[ch];
+            double sq = 0;
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                const float v = x[(size_t)i * m_nch + ch];
+                peak = (std::max)(peak, std::fabs(v));
+                sq += (double)v * v;
+            }
+            m_peak[ch] = peak;
+            m_squares[ch] += sq;
+            true_peak(ch, x, n);
+        }
+        m_kweighting.processSamples((int)n, x);
+        for (unsigned int ch = 0; ch < m_nch; ++ch)
+        {
+            double e = 0;
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                const float v = x[(size_t)i * m_nch + ch];
+                e += (double)v * v;
+            }
+            m_energy[ch] += e;
+        }
+        m_blockCount += n;
+        m_frames += n;
+        if (m_blockCount == m_blockFrames) end_block();
+    }
+
+    void end_block()
+    {
+        double power = 0;
+        for (unsigned int ch = 0; ch < m_nch; ++ch)
+        {
+            power += m_weights[ch] * m_energy[ch] / m_blockFrames;
+        }
+        m_blockPower[m_blocksSeen % SHORT_TERM_BLOCKS] = power;
+        ++m_blocksSeen;
+
+        auto mean_of_last = [this](unsigned int nblocks) {
+            const unsigned int n = (std::min)(nblocks, m_blocksSeen);
+            double sum = 0;
+            for (unsigned int i = 1; i <= n; ++i)
+            {
+                sum += m_blockPower[(m_blocksSeen - i) % SHORT_TERM_BLOCKS];
+            }
+            return n ? sum / n : 0.0;
+        };
+        const double momentary = mean_of_last(MOMENTARY_BLOCKS);
+        const double shortTerm = mean_of_last(SHORT_TERM_BLOCKS);
+
+        // 400ms gating blocks, overlapping by 75%
+        if (m_blocksSeen >= MOMENTARY_BLOCKS)
+        {
+            const double l = lufs(momentary);
+            if (l >= HIST_MIN)
+            {
+                const unsigned int bin = (std::min)(
+                    HIST_BINS - 1, (unsigned int)((l - HIST_MIN) / HIST_STEP));
+                ++m_histCount[bin];
+                m_histPower[bin] += momentary;
+            }
+        }
+
+        MeterReadings &r = m_published.back();
+        r.peak = m_peak;
+        r.truePeak = m_truePeak;
+        r.rms.resize(m_nch);
+        for (unsigned int ch = 0; ch < m_nch; ++ch)
+        {
+            r.rms[ch] = (float)std::sqrt(m_squares[ch] / m_blockFrames);
+            m_maxTruePeak = (std::max)(m_maxTruePeak, m_truePeak[ch]);
+        }
+        r.maxTruePeak = m_maxTruePeak;
+        r.momentary = lufs(momentary);
+        r.shortTerm = lufs(shortTerm);
+        r.integrated = integrated();
+        r.frames = m_frames;
+        r.droppedFrames = m_dropped.load(std::memory_order_relaxed);
+        m_published.publish();
+
+        m_blockCount = 0;
+        std::fill(m_energy.begin(), m_energy.end(), 0.0);
+        std::fill(m_squares.begin(), m_squares.end(), 0.0);
+        std::fill(m_peak.begin(), m_peak.end(), 0.0f);
+        std::fill(m_truePeak.begin(), m_truePeak.end(), 0.0f);
+    }
+
+    // absolute gate at -70 LUFS (the histogram starts there), then a
+    // relative gate 10 LU below the loudness of what passed that
+    double integrated() const
+    {
+        uint64_t count = 0;
+        double sum = 0;
+        for (unsigned int b = 0; b < HIST_BINS; ++b)
+        {
+            count += m_histCount[b];
+            sum += m_histPower[b];
+        }
+        if (count == 0) return -std::numeric_limits<double>::infinity();
+        const double gate = lufs(sum / count) - 10.0;
+        count = 0;
+        sum = 0;
+        for (unsigned int b = 0; b < HIST_BINS; ++b)
+        {
+            if (HIST_MIN + (b + 0.5) * HIST_STEP < gate) continue;
+            count += m_histCount[b];
+            sum += m_histPower[b];
+        }
+        return count ? lufs(sum / count)
+                     : -std::numeric_limits<double>::infinity();
+    }
+
+  public:
+    // ringSeconds of audio can be queued between meter passes. Throws
+    // std::runtime_error for more than MAX_CONVERT_CHANNELS channels.
+    loudness_meter(unsigned int nch, double samplerate,
+                   double ringSeconds = 1.0)
+        : m_nch(nch), m_samplerate(samplerate),
+          m_ring((size_t)(ringSeconds * samplerate) * nch),
+          m_published(MeterReadings{std::vector<float>(nch),
+                                    std::vector<float>(nch),
+                                    std::vector<float>(nch)}),
+          m_weights(nch, 1.0f),
+          m_kweighting((int)nch, 2, (float)samplerate),
+          m_tpHistory((size_t)nch * (TP_TAPS - 1), 0.0f),
+          m_chunk((size_t)CHUNK * nch), m_line(CHUNK + TP_TAPS - 1),
+          m_blockFrames((unsigned int)std::lround(samplerate / 10)),
+          m_energy(nch, 0.0), m_squares(nch, 0.0), m_peak(nch, 0.0f),
+          m_truePeak(nch, 0.0f)
+    {
+        assert(nch > 0 && samplerate > 0);
+        if (nch > MAX_CONVERT_CHANNELS)
+        {
+            // see to_float_frames()
+            throw std::runtime_error("loudness_meter: too many channels");
+        }
+        m_kweighting.set(-1, 0, kweight_shelf(samplerate), false);
+        m_kweighting.set(-1, 1, kweight_highpass(samplerate), false);
+        design_true_peak();
+        if (nch == 6)
+        {
+            // 5.1 (L R C LFE Ls Rs): no LFE, surrounds +1.5dB
+            m_weights = {1.0f, 1.0f, 1.0f, 0.0f, 1.41f, 1.41f};
+        }
+    }
+    loudness_meter(const loudness_meter &) = delete;
+    loudness_meter &operator=(const loudness_meter &) = delete;
+    ~loudness_meter() { stop(); }
+
+    unsigned int channels() const noexcept { return m_nch; }
+
+    // Per-channel loudness weights (BS.1770's G). Before metering starts.
+    void weights(const std::vector<float> &w)
+    {
+        assert(w.size() == m_nch);
+        m_weights = w;
+    }
+
+    // Audio callback: queue frames of interleaved float samples. Never
+    // blocks; if the meter has fallen behind, what does not fit is
+    // dropped (and counted).
+    void push(const float *interleaved, unsigned int frames) noexcept
+    {
+        const size_t n = (size_t)frames * m_nch;
+        // whole frames only, so the channels never get out of step
+        const size_t pushed = m_ring.push(
+            interleaved, (std::min)(n, m_ring.capacity() - m_ring.size()) /
+                             m_nch * m_nch);
+        if (pushed < n)
+        {
+            m_dropped.fetch_add((n - pushed) / m_nch,
+                                std::memory_order_relaxed);
+        }
+    }
+
+    // the same, from any sample type (see to_float)
+    template <typename T>
+    void push(const T *interleaved, unsigned int frames) noexcept
+    {
+        to_float_frames(interleaved, frames, m_nch,
+                        [this](const float *f, unsigned int n) { push(f, n); });
+    }
+
+    // Meter thread: measures everything queued so far.
+    void process()
+    {
+        for (;;)
+        {
+            const unsigned int want =
+                (std::min)(CHUNK, m_blockFrames - m_blockCount);
+            const size_t got =
+                m_ring.pop(m_chunk.data(), (size_t)want * m_nch) / m_nch;
+            if (got == 0) return;
+            measure(m_chunk.data(), (unsigned int)got);
+        }
+    }
+
+    // Runs process() on a thread of its own, a few times per update.
+    void start()
+    {
+        if (m_running) return;
+        m_running = true;
+        m_thread = std::thread([this] {
+            while (m_running)
+            {
+                process();
+                std::this_thread::sleep_for(std::chrono::milliseconds(25));
+            }
+        });
+    }
+    void stop()
+    {
+        m_running = false;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    // Reader thread (one only): the latest readings.
+    const MeterReadings &readings() noexcept { return m_published.read(); }
+};
+
+} // namespace dsp
+} // namespace audio
@@ -1,11 +1,26 @@
 #pragma once
 #define _USE_MATH_DEFINES
 #include "../rtAudio/RtAudio.h"
+#include "autotune.hpp"
+#include "chain.hpp"
+#include "events.hpp"
+#include "lockfree.hpp"
+#include "oscillator.hpp"
+#include "resampler.hpp"
+#include "router.hpp"
+#include "streamstats.hpp"
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstring>
 #include <functional> // std::reference_wrapper
+#include <memory>
+#include <mutex>
+#include <numeric> // std::gcd
+#include <sstream>
 #include <thread>
 #include <vector>
 
@@ -25,96 +40,245 @@ static inline float next_sine_sample(unsigned int &sample_num,
 {
     if (sample_num >= samplerate) sample_num = 0;
 
-    return (float)sin(freq * 2 * M_PI * sample_num++ / samplerate);
+    // exact phase from integer arithmetic, then the shared sine table
+    const double pos = (double)((uint64_t)freq * sample_num++ % samplerate) /
+                       samplerate * wavetable::SIZE;
+    const float *t = wavetable::sine().data();
+    const unsigned int i = (unsigned int)pos;
+    return t[i] + (t[i + 1] - t[i]) * (float)(pos - i);
 }
 
+template <typename T>
+static inline bool is_almost_equal(T a, T b,
+                                   T epsilon = (T)0.0001) noexcept
+{
+    return std::fabs(a - b) <= epsilon;
+}
+
+// Linear gain ramp. arm() may be called from any (one) control thread;
+// the audio thread picks the new target up at the start of its next
+// block. Processing is done a block at a time: the gains for a stretch of
+// the ramp are computed into a small array first (start + i * step), so
+// both that and the multiply are plain loops the compiler vectorises. A
+// finished ramp is a constant-gain multiply, and unity gain is a no-op.
 template <typename T> class fader
 {
+    static constexpr int BLOCK = 64;
+
+    // control thread -> audio thread mailbox, guarded by a sequence count
+    // (odd while arm() is writing)
+    std::atomic<unsigned int> m_armSeq{0};
+    std::atomic<T> m_armDest{0};
+    std::atomic<float> m_armSecs{0};
+    std::atomic<float> m_armRate{0};
+    unsigned int m_seenSeq = 0;
+
+    // audio thread state
     T m_destValue;
-    float m_secToDest;
-    std::atomic<int> m_steps;
-    float m_samplerate;
-    float m_startValue = 0;
-    float m_step = 0;
-    float m_vol = 0;
+    T m_vol = 0;
+    T m_step = 0;
+    int m_framesLeft = 0;
     int m_nch = 2;
-    void calc()
+    int m_chanPos = 0; // for the per-sample processSample()
+
+    // published once per block for volume() and active()
+    std::atomic<T> m_publishedVol{0};
+    std::atomic<bool> m_publishedActive{false};
+
+    void start_ramp(T destValue, float secToDest, float samplerate)
+    {
+        m_destValue = destValue;
+        m_chanPos = 0;
+        if (secToDest <= 0 || samplerate <= 0)
+        {
+            m_vol = destValue;
+            m_framesLeft = 0;
+            return;
+        }
+        m_framesLeft = (int)(secToDest * samplerate + 0.5f);
+        if (m_framesLeft <= 0)
+        {
+            m_vol = destValue;
+            m_framesLeft = 0;
+            return;
+        }
+        m_step = (m_destValue - m_vol) / m_framesLeft;
+    }
+
+    // audio thread: take a new target from arm(), if there is one
+    void pick_up_arm() noexcept
+    {
+        const unsigned int seq = m_armSeq.load(std::memory_order_acquire);
+        if (seq == m_seenSeq || (seq & 1)) return;
+        const T dest = m_armDest.load(std::memory_order_relaxed);
+        const float secs = m_armSecs.load(std::memory_order_relaxed);
+        const float rate = m_armRate.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_armSeq.load(std::memory_order_relaxed) != seq) return; // torn
+        m_seenSeq = seq;
+        start_ramp(dest, secs, rate);
+    }
+
+    void publish() noexcept
+    {
+        m_publishedVol.store(m_vol, std::memory_order_relaxed);
+        m_publishedActive.store(m_framesLeft > 0, std::memory_order_relaxed);
+    }
+
+    void advance_frames(int n) noexcept
     {
-        if (m_secToDest <= 0 || m_samplerate <= 0) return;
-        const float fsteps = (m_secToDest * m_samplerate) * m_nch;
-        m_steps = (int)(fsteps + 0.5f);
-        m_step = (m_destValue - m_startValue) / m_steps;
-        m_vol = m_startValue;
+        m_framesLeft -= n;
+        if (m_framesLeft <= 0)
+        {
+            m_framesLeft = 0;
+            m_vol = m_destValue;
+        }
+        else
+        {
+            m_vol += m_step * n;
+            if (m_vol < 0) m_vol = 0;
+        }
+    }
+
+    // gains[i] for the next n frames of the ramp
+    void ramp_gains(T *gains, int n) const noexcept
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            gains[i] = m_vol + m_step * (T)i;
+        }
     }
 
   public:
-    fader() : m_destValue(0), m_secToDest(0), m_steps(0), m_samplerate(0) {}
+    fader() : m_destValue(0) {}
     fader(T destValue, float secToDest, float samplerate, int nch = 2)
-        : m_destValue(destValue), m_secToDest(secToDest), m_steps(0),
-          m_samplerate(samplerate), m_nch(nch), m_vol(0)
+        : m_destValue(destValue), m_nch(nch)
     {
-        calc();
+        start_ramp(destValue, secToDest, samplerate);
+        publish();
     }
 
-    T volume() const noexcept { return m_vol; }
+    // the gain as of the last processed block; any thread
+    T volume() const noexcept
+    {
+        return m_publishedVol.load(std::memory_order_relaxed);
+    }
+
+    // control thread. Ramps from wherever the gain is when the audio
+    // thread next processes a block.
     void arm(T destval, float samplerate, float secToDest)
     {
-        m_startValue = m_vol;
-        m_destValue = destval;
-        m_samplerate = samplerate;
-        m_secToDest = secToDest;
-        calc();
+        const unsigned int seq = m_armSeq.load(std::memory_order_relaxed);
+        m_armSeq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_armDest.store(destval, std::memory_order_relaxed);
+        m_armSecs.store(secToDest, std::memory_order_relaxed);
+        m_armRate.store(samplerate, std::memory_order_relaxed);
+        m_armSeq.store(seq + 2, std::memory_order_release);
+        m_publishedActive.store(true, std::memory_order_relaxed);
     }
 
+    // One sample of an interleaved stream with the channel count given at
+    // construction. Prefer processSamples(), which does a block at a time.
     PA_FORCE_INLINE void processSample(T &sample)
     {
-        if (m_steps > 0)
+        if (m_chanPos == 0) pick_up_arm();
+        sample *= m_vol;
+        if (m_framesLeft == 0) return;
+        if (++m_chanPos >= m_nch)
         {
-            sample *= m_vol;
-            m_vol += m_step;
-            if (m_vol < 0) m_vol = 0;
-            --m_steps;
-            if (m_steps <= 0)
-            {
-                m_vol = this->m_destValue;
-                return;
-            }
+            m_chanPos = 0;
+            advance_frames(1);
+            publish();
         }
     }
 
+    // nFrames of interleaved audio with nch channels
     void processSamples(int nFrames, T *samples, const int nch)
     {
-        while (nFrames > 0)
+        pick_up_arm();
+        T gains[BLOCK];
+        while (nFrames > 0 && m_framesLeft > 0)
         {
-            if (active())
+            const int n = (std::min)((std::min)(nFrames, m_framesLeft), BLOCK);
+            ramp_gains(gains, n);
+            if (nch == 2)
             {
-                for (auto ch = 0; ch < nch; ++ch)
+                for (int i = 0; i < n; ++i)
                 {
-                    T &val = *samples++;
-                    processSample(val);
+                    samples[2 * i] *= gains[i];
+                    samples[2 * i + 1] *= gains[i];
                 }
-                nFrames--;
             }
             else
             {
-                if (!is_almost_equal(1.0f, m_destValue))
+                for (int i = 0; i < n; ++i)
                 {
-                    for (auto ch = 0; ch < nch; ++ch)
+                    for (int ch = 0; ch < nch; ++ch)
                     {
-                        *samples = *samples * m_vol;
-                        ++samples;
+                        samples[i * nch + ch] *= gains[i];
                     }
-                    nFrames--;
                 }
-                else
+            }
+            samples += n * nch;
+            nFrames -= n;
+            advance_frames(n);
+        }
+        publish();
+
+        if (nFrames <= 0 || is_almost_equal((T)1, m_vol))
+        {
+            return; // nothing to do here: just multiply by one.
+        }
+        const T g = m_vol;
+        const int nsamples = nFrames * nch;
+        for (int i = 0; i < nsamples; ++i)
+        {
+            samples[i] *= g;
+        }
+    }
+
+    // nFrames of non-interleaved audio: channels[ch] points at nFrames
+    // samples for each of the nch channels.
+    void processPlanar(int nFrames, T *const *channels, const int nch)
+    {
+        pick_up_arm();
+        T gains[BLOCK];
+        int offset = 0;
+        while (nFrames > 0 && m_framesLeft > 0)
+        {
+            const int n = (std::min)((std::min)(nFrames, m_framesLeft), BLOCK);
+            ramp_gains(gains, n);
+            for (int ch = 0; ch < nch; ++ch)
+            {
+                T *s = channels[ch] + offset;
+                for (int i = 0; i < n; ++i)
                 {
-                    return; // nothing to do here: just multiply by one.
+                    s[i] *= gains[i];
                 }
             }
-        };
+            offset += n;
+            nFrames -= n;
+            advance_frames(n);
+        }
+        publish();
+
+        if (nFrames <= 0 || is_almost_equal((T)1, m_vol)) return;
+        const T g = m_vol;
+        for (int ch = 0; ch < nch; ++ch)
+        {
+            T *s = channels[ch] + offset;
+            for (int i = 0; i < nFrames; ++i)
+            {
+                s[i] *= g;
+            }
+        }
     }
 
-    bool active() const noexcept { return m_steps > 0; }
+    bool active() const noexcept
+    {
+        return m_publishedActive.load(std::memory_order_relaxed);
+    }
 };
 } // namespace dsp
 
@@ -224,6 +388,7 @@ enum class AudioFormat : RtAudioFormat
     SINT8 = 0x1,
     SINT16 = 2,
     SINT24 = 0x4,
+    SINT32 = 0x8,
     FLOAT32 = 0x10,
     FLOAT64 = 0x20
 };
@@ -238,6 +403,8 @@ static inline unsigned long AudioFormatToBits(const AudioFormat &fmt)
         return 16;
     case AudioFormat::SINT24:
         return 24;
+    case AudioFormat::SINT32:
+        return 32;
     case AudioFormat::FLOAT32:
         return 32;
     case AudioFormat::FLOAT64:
@@ -385,6 +552,40 @@ struct FormatType
     return FormatType{};
 }
 
+enum class FormatPreference
+{
+    // keep the requested format; the device gets whichever of its native
+    // formats is cheapest to convert to.
+    cheapestConversion,
+    // if the device does not take the requested format, switch the
+    // requested format to the native one nearest to it, so that no
+    // conversion happens at all.
+    noConversion
+};
+
+// The outcome of DeviceInstance::NegotiateFormat(), for diagnostics.
+struct FormatNegotiation
+{
+    AudioFormat requested = AudioFormat::FLOAT32;
+    AudioFormat userFormat = AudioFormat::FLOAT32; // what the callback sees
+    AudioFormat deviceFormat = AudioFormat::FLOAT32;
+    RtAudioFormat nativeFormats = 0;
+    unsigned int cost = 0; // RtAudio::getFormatConversionCost()
+    bool convert() const noexcept { return userFormat != deviceFormat; }
+
+    std::string toString() const
+    {
+        std::stringstream ss;
+        ss << "requested " << AudioFormatToBits(requested) << "-bit, user "
+           << AudioFormatToBits(userFormat) << "-bit, device "
+           << AudioFormatToBits(deviceFormat) << "-bit ("
+           << (convert() ? "converting" : "no conversion")
+           << ", cost=" << cost << "); native: "
+           << formatsToString(nativeFormats);
+        return ss.str();
+    }
+};
+
 struct DeviceInstance
 {
     DeviceInstance(const SystemDevice &sd,
@@ -431,6 +632,34 @@ struct DeviceInstance
         return m_format;
     }
 
+    // the sample formats the device reported when it was enumerated
+    RtAudioFormat NativeFormats() const noexcept
+    {
+        return m_sysDevice.info.nativeFormats;
+    }
+
+    // Picks the sample formats for the user and the device side. With
+    // FormatPreference::noConversion, Format().Format may be changed.
+    FormatNegotiation NegotiateFormat(
+        FormatPreference pref = FormatPreference::cheapestConversion)
+    {
+        FormatNegotiation ret;
+        ret.requested = m_format.Format;
+        ret.nativeFormats = NativeFormats();
+        const auto requested = (RtAudioFormat)m_format.Format;
+        auto device = RtAudio::getCheapestFormat(requested, ret.nativeFormats);
+        if (device == 0) device = requested; // not probed: let RtAudio decide
+        if (pref == FormatPreference::noConversion)
+        {
+            m_format.Format = static_cast<AudioFormat>(device);
+        }
+        ret.userFormat = m_format.Format;
+        ret.deviceFormat = static_cast<AudioFormat>(device);
+        ret.cost = RtAudio::getFormatConversionCost(
+            (RtAudioFormat)ret.userFormat, device);
+        return ret;
+    }
+
     DeviceInstance(const DeviceInstance &rhs)
         : m_sysDevice(rhs.m_sysDevice), m_StreamOptions(rhs.m_StreamOptions),
           m_format(rhs.m_format)
@@ -639,8 +868,10 @@ enum class AudioCallbackStatus : unsigned int
     RTAUDIO_INPUT_OVERFLOW = 0x1, // Input data was discarded because of an
     // overflow condition at the
     // driver.
-    RTAUDIO_OUTPUT_UNDERFLOW = 0x2 // The output buffer ran low, likely
+    RTAUDIO_OUTPUT_UNDERFLOW = 0x2, // The output buffer ran low, likely
     // causing a gap in the output sound.
+    RTAUDIO_BUFFER_SIZE_CHANGED = 0x4 // The device's buffer size changed
+    // (JACK): frames is the new size, from this callback on.
 };
 [[maybe_unused]] inline AudioCallbackStatus operator|(AudioCallbackStatus &lhs,
                                                       AudioCallbackStatus &rhs)
@@ -658,6 +889,80 @@ struct StreamCallbackInfo
     double streamTime = 0.0;
     AudioCallbackStatus status = AudioCallbackStatus::none;
     FormatType format = {};
+    // CLOCK_MONOTONIC (std::chrono::steady_clock) nanoseconds at which the
+    // first output frame will hit the DAC, and at which the first input
+    // frame was captured. Zero when not known (e.g. render-ahead blocks).
+    long long outputDacNanos = 0;
+    long long inputCaptureNanos = 0;
+};
+
+// Override this in your own class to accept the callback
+struct AudioCallback
+{
+    virtual int OnAudioCallback(const StreamCallbackInfo &info) = 0;
+    // A StreamEvent fallen due, between the callbacks for the frames
+    // before it and those from its frame on. See StreamConfig.
+    virtual void OnEvent(const StreamEvent &) {}
+    FormatType format = {};
+};
+
+// Optional behaviour for a Stream, fixed at the time the Stream is opened.
+struct StreamConfig
+{
+    // When non-zero, the AudioCallback is called on a worker thread which
+    // renders this many blocks ahead of the device. The realtime callback
+    // then only copies finished blocks out, at the cost of
+    // RenderAheadBlocks * bufferFrames extra latency. Output streams only.
+    unsigned int RenderAheadBlocks = 0;
+
+    // The device buffer size asked for when the stream is opened.
+    unsigned int BufferFrames = 1024;
+
+    // When set, the stream opens at BufferFrames (or at the size last
+    // tuned for this device) and a monitor thread then halves or doubles
+    // the buffer, within [MinBufferFrames, MaxBufferFrames], according to
+    // callback load and xruns. Each step closes and reopens the device with
+    // the same callback; the chosen size is saved per device in the file
+    // AutoTuneStorePath (empty means BufferSizeStore::DefaultPath()).
+    bool AutoTuneBufferFrames = false;
+    unsigned int MinBufferFrames = 32;
+    unsigned int MaxBufferFrames = 8192;
+    std::string AutoTuneStorePath;
+
+    // When set, and the device reports a preferred sample rate different
+    // from the stream's, the device is opened at its preferred rate (as
+    // FLOAT32) and the callback's output is converted with a
+    // dsp::polyphase_resampler. The callback still sees the format it
+    // asked for. Interleaved output streams only.
+    bool ResampleToPreferredRate = false;
+    dsp::ResamplerQuality ResampleQuality = dsp::ResamplerQuality::medium;
+
+    // When non-zero, the stream keeps an EventQueue of this many slots:
+    // Stream::PostEvent() then schedules an event for a given stream
+    // frame, and the callback is split at that frame so that OnEvent()
+    // arrives exactly there. The callback must then accept buffers
+    // shorter than the device's. Interleaved only.
+    size_t EventQueueCapacity = 0;
+
+    // When set, the callback runs behind a SwappableCallback, so that
+    // Stream::SwapCallback() can replace it, crossfading if asked, while
+    // the stream runs.
+    bool HotSwapCallback = false;
+
+    // When not empty, the callback renders Routing.inputs() channels and
+    // the device is opened with Routing.outputs(), mixed through the
+    // matrix (and converted to the device's format) on the way out: for
+    // up- and down-mixes and for any channel to any device channel(s).
+    // Interleaved output streams only.
+    dsp::routing_matrix Routing;
+
+    // When non-zero, the callback is always given blocks of exactly this
+    // many frames, whatever the device buffer size: device periods are
+    // re-blocked through a pre-allocated buffer, which renders each block
+    // up to BlockFrames - gcd(BlockFrames, device frames) frames early.
+    // With render-ahead, this is its block size. Not with events (which
+    // split blocks). Interleaved output streams only.
+    unsigned int BlockFrames = 0;
 };
 
 namespace detail
@@ -669,54 +974,795 @@ static void static_error_callback(RtAudioError::Type type,
     throw std::runtime_error(s.data());
 }
 
+// n frames of the (interleaved) buffers in info, from frame offset on,
+// with the times moved on to match.
+static inline StreamCallbackInfo slice(const StreamCallbackInfo &info,
+                                       unsigned int offset,
+                                       unsigned int n) noexcept
+{
+    StreamCallbackInfo part = info;
+    const size_t skip = (size_t)offset * info.format.Channels *
+        (info.format.BitsPerSample() / 8);
+    if (part.outputBuffer)
+    {
+        part.outputBuffer = (const char *)info.outputBuffer + skip;
+    }
+    if (part.inputBuffer)
+    {
+        part.inputBuffer = (const char *)info.inputBuffer + skip;
+    }
+    part.frames = n;
+    if (offset == 0) return part;
+    const double rate = info.format.SamplesPerSec;
+    part.streamTime += offset / rate;
+    const auto nanos = (long long)std::llround(offset * 1e9 / rate);
+    if (part.outputDacNanos) part.outputDacNanos += nanos;
+    if (part.inputCaptureNanos) part.inputCaptureNanos += nanos;
+    part.status = AudioCallbackStatus::none;
+    return part;
+}
+
+// Calls pcb for the buffer in info, whose first frame is stream frame
+// firstFrame. With events, the buffer is handed over in slices split at
+// each due event, with OnEvent() in between. Returns the first non-zero
+// result of the callback.
+static inline int deliver(AudioCallback *pcb, const StreamCallbackInfo &info,
+                          EventQueue *events, uint64_t firstFrame)
+{
+    if (!events) return pcb->OnAudioCallback(info);
+    int ret = 0;
+    events->Process(
+        firstFrame, info.frames,
+        [pcb](const StreamEvent &e) { pcb->OnEvent(e); },
+        [&](unsigned int offset, unsigned int n) {
+            const int rv = pcb->OnAudioCallback(slice(info, offset, n));
+            if (ret == 0) ret = rv;
+        });
+    return ret;
+}
+
+// Runs the user's AudioCallback on a worker thread, into a pool of
+// pre-allocated blocks. The realtime side (pull()) never allocates,
+// never locks and never calls user code: it copies ready blocks out
+// and hands the emptied blocks back to the worker.
+class RenderAhead : public no_copy<RenderAhead>
+{
+    AudioCallback *m_pcb;
+    EventQueue *m_events;
+    const FormatType m_format;
+    const unsigned int m_blockFrames;
+    const unsigned int m_frameBytes;
+    const unsigned int m_nBlocks;
+    std::vector<char> m_pool;
+    lockfree::spsc_ring<unsigned int> m_free;  // RT -> worker
+    lockfree::spsc_ring<unsigned int> m_ready; // worker -> RT
+    std::atomic<bool> m_running{false};
+    std::atomic<unsigned int> m_pendingStatus{0};
+    std::atomic<int> m_result{0};
+    std::atomic<unsigned long> m_underruns{0};
+    std::thread m_thread;
+    double m_renderTime = 0;
+    uint64_t m_renderFrame = 0;
+
+    // only touched by the realtime thread
+    static constexpr unsigned int NO_BLOCK = ~0u;
+    unsigned int m_current = NO_BLOCK;
+    unsigned int m_offset = 0;
+
+    char *block(unsigned int idx) noexcept
+    {
+        return m_pool.data() + (size_t)idx * m_blockFrames * m_frameBytes;
+    }
+
+    void render(unsigned int idx)
+    {
+        const auto status = m_pendingStatus.exchange(0);
+        StreamCallbackInfo info{block(idx), nullptr, m_blockFrames,
+                                m_renderTime, AudioCallbackStatus(status)};
+        info.format = m_format;
+        m_renderTime += (double)m_blockFrames / m_format.SamplesPerSec;
+        const int rv = deliver(m_pcb, info, m_events, m_renderFrame);
+        m_renderFrame += m_blockFrames;
+        if (rv != 0) m_result = rv;
+    }
+
+    void worker()
+    {
+        using namespace std::chrono;
+        // a quarter of a block period: often enough to never starve the
+        // device, rarely enough not to burn a core.
+        const auto nap = microseconds(
+            (long long)(250000.0 * m_blockFrames / m_format.SamplesPerSec));
+        while (m_running)
+        {
+            unsigned int idx = NO_BLOCK;
+            if (m_result != 0 || !m_free.pop(idx))
+            {
+                std::this_thread::sleep_for(nap);
+                continue;
+            }
+            render(idx);
+            m_ready.push(idx);
+        }
+    }
+
+  public:
+    // Events, if given, are delivered in render time: block k starts at
+    // stream frame k * blockFrames, as the device starts on block 0.
+    RenderAhead(AudioCallback *pcb, const FormatType &fmt,
+                unsigned int blockFrames, unsigned int blocksAhead,
+                EventQueue *events = nullptr)
+        : m_pcb(pcb), m_events(events), m_format(fmt),
+          m_blockFrames(blockFrames),
+          m_frameBytes(fmt.Channels * (fmt.BitsPerSample() / 8)),
+          m_nBlocks(blocksAhead + 1),
+          m_pool((size_t)m_nBlocks * blockFrames * m_frameBytes),
+          m_free(m_nBlocks), m_ready(m_nBlocks)
+    {
+        assert(m_pcb && blockFrames > 0 && blocksAhead > 0);
+        for (unsigned int i = 0; i < m_nBlocks; ++i)
+        {
+            m_free.push(i);
+        }
+    }
+    ~RenderAhead() { Stop(); }
+
+    // Renders the whole pool before returning, so the device does not
+    // start on silence.
+    void Start()
+    {
+        if (m_running) return;
+        unsigned int idx = NO_BLOCK;
+        while (m_free.pop(idx))
+        {
+            render(idx);
+            m_ready.push(idx);
+        }
+        m_running = true;
+        m_thread = std::thread([this] { worker(); });
+    }
+
+    void Stop()
+    {
+        m_running = false;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    unsigned long Underruns() const noexcept { return m_underruns; }
+    unsigned int BlockFrames() const noexcept { return m_blockFrames; }
+
+    // realtime thread only. Handles any device buffer size, not just
+    // multiples of the block size.
+    int pull(void *outputBuffer, unsigned int frames,
+             RtAudioStreamStatus status) noexcept
+    {
+        if (status) m_pendingStatus |= status;
+        char *dst = (char *)outputBuffer;
+        while (frames > 0)
+        {
+            if (m_current == NO_BLOCK)
+            {
+                if (!m_ready.pop(m_current))
+                {
+                    m_current = NO_BLOCK;
+                    memset(dst, 0, (size_t)frames * m_frameBytes);
+                    if (m_result != 0) return m_result;
+                    ++m_underruns;
+                    return 0;
+                }
+                m_offset = 0;
+            }
+            const auto n = (std::min)(frames, m_blockFrames - m_offset);
+            const size_t nbytes = (size_t)n * m_frameBytes;
+            memcpy(dst, block(m_current) + (size_t)m_offset * m_frameBytes,
+                   nbytes);
+            dst += nbytes;
+            frames -= n;
+            m_offset += n;
+            if (m_offset == m_blockFrames)
+            {
+                m_free.push(m_current);
+                m_current = NO_BLOCK;
+            }
+        }
+        return 0;
+    }
+};
+
+// any AudioFormat to float
+static inline void to_float(const void *src, AudioFormat fmt, float *dst,
+                            size_t n) noexcept
+{
+    switch (fmt)
+    {
+    case AudioFormat::SINT8:
+        dsp::to_float((const int8_t *)src, dst, n);
+        break;
+    case AudioFormat::SINT16:
+        dsp::to_float((const int16_t *)src, dst, n);
+        break;
+    case AudioFormat::SINT24:
+        dsp::to_float((const S24 *)src, dst, n);
+        break;
+    case AudioFormat::SINT32:
+        dsp::to_float((const int32_t *)src, dst, n);
+        break;
+    case AudioFormat::FLOAT64:
+        dsp::to_float((const double *)src, dst, n);
+        break;
+    case AudioFormat::FLOAT32:
+    default:
+        memcpy(dst, src, n * sizeof(float));
+        break;
+    }
+}
+
+// float to any AudioFormat
+static inline void from_float(const float *src, void *dst, AudioFormat fmt,
+                              size_t n) noexcept
+{
+    switch (fmt)
+    {
+    case AudioFormat::SINT8:
+        dsp::from_float(src, (int8_t *)dst, n);
+        break;
+    case AudioFormat::SINT16:
+        dsp::from_float(src, (int16_t *)dst, n);
+        break;
+    case AudioFormat::SINT24:
+        dsp::from_float(src, (S24 *)dst, n);
+        break;
+    case AudioFormat::SINT32:
+        dsp::from_float(src, (int32_t *)dst, n);
+        break;
+    case AudioFormat::FLOAT64:
+        dsp::from_float(src, (double *)dst, n);
+        break;
+    case AudioFormat::FLOAT32:
+    default:
+        memcpy(dst, src, n * sizeof(float));
+        break;
+    }
+}
+
+// For AudioCallbacks that render float: fills info's buffer through
+// render(float *out, unsigned int frames). Float streams are rendered
+// into directly; others a scratch buffer (of whole frames) at a time,
+// then converted.
+template <typename Render>
+void render_float(const StreamCallbackInfo &info, std::vector<float> &scratch,
+                  Render &&render)
+{
+    char *out = (char *)info.outputBuffer;
+    if (info.format.Format == AudioFormat::FLOAT32)
+    {
+        render((float *)out, info.frames);
+        return;
+    }
+    const unsigned int nch = info.format.Channels;
+    const unsigned int most = (unsigned int)(scratch.size() / nch);
+    const size_t frameBytes = (size_t)nch * (info.format.BitsPerSample() / 8);
+    unsigned int frames = info.frames;
+    while (frames > 0)
+    {
+        const unsigned int n = (std::min)(frames, most);
+        render(scratch.data(), n);
+        from_float(scratch.data(), out, info.format.Format, (size_t)n * nch);
+        out += n * frameBytes;
+        frames -= n;
+    }
+}
+
 } // namespace detail
 
-// Override this in your own class to accept the callback
-struct AudioCallback
+// An AudioCallback standing in for another which can be replaced while
+// the stream runs. Swap() publishes the new callback with one atomic
+// store (lockfree::rcu); the audio thread picks it up at its next
+// callback and, if asked, crossfades from the old one (equal power) over
+// that many frames, calling both meanwhile. The old callback is kept
+// alive until the audio thread has finished with it, and released by the
+// next Swap() or Collect(). Events go to every callback playing.
+class SwappableCallback : public AudioCallback,
+                          public no_copy<SwappableCallback>
 {
-    virtual int OnAudioCallback(const StreamCallbackInfo &info) = 0;
-    FormatType format = {};
+    static constexpr unsigned int FADE_SLICE = 256;
+
+    lockfree::rcu<AudioCallback> m_slot;
+    std::atomic<unsigned int> m_nextFade{0};
+
+    // audio thread only
+    AudioCallback *m_active;
+    AudioCallback *m_fadingOut = nullptr;
+    unsigned int m_fadeFrames = 0;
+    unsigned int m_fadePos = 0;
+    std::vector<char> m_old;
+    std::vector<float> m_oldF, m_newF;
+
+    int crossfade(const StreamCallbackInfo &info)
+    {
+        const unsigned int nch = format.Channels;
+        const AudioFormat fmt = info.format.Format;
+        int ret = 0;
+        unsigned int done = 0;
+        while (done < info.frames && m_fadingOut)
+        {
+            const unsigned int n = (std::min)(
+                {info.frames - done, FADE_SLICE, m_fadeFrames - m_fadePos});
+            const auto part = detail::slice(info, done, n);
+            auto old = part;
+            old.outputBuffer = m_old.data();
+            m_fadingOut->OnAudioCallback(old);
+            ret = m_active->OnAudioCallback(part);
+            const size_t ns = (size_t)n * nch;
+            detail::to_float(m_old.data(), fmt, m_oldF.data(), ns);
+            detail::to_float(part.outputBuffer, fmt, m_newF.data(), ns);
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                const double t =
+                    M_PI_2 * (m_fadePos + i + 0.5) / m_fadeFrames;
+                const float in = (float)std::sin(t), out = (float)std::cos(t);
+                for (unsigned int ch = 0; ch < nch; ++ch)
+                {
+                    const size_t j = (size_t)i * nch + ch;
+                    m_newF[j] = m_newF[j] * in + m_oldF[j] * out;
+                }
+            }
+            detail::from_float(m_newF.data(), (void *)part.outputBuffer, fmt,
+                               ns);
+            done += n;
+            m_fadePos += n;
+            if (m_fadePos == m_fadeFrames) m_fadingOut = nullptr;
+            if (ret != 0) return ret;
+        }
+        if (done < info.frames)
+        {
+            ret = m_active->OnAudioCallback(
+                detail::slice(info, done, info.frames - done));
+        }
+        return ret;
+    }
+
+  public:
+    // fmt: the format the stream's callbacks see
+    SwappableCallback(std::shared_ptr<AudioCallback> initial,
+                      const FormatType &fmt)
+        : m_slot(std::move(initial)), m_active(m_slot.read())
+    {
+        assert(m_active);
+        format = fmt;
+        m_active->format = fmt;
+        const size_t n = (size_t)FADE_SLICE * fmt.Channels;
+        m_old.resize(n * (fmt.BitsPerSample() / 8));
+        m_oldF.resize(n);
+        m_newF.resize(n);
+    }
+
+    // Any non-realtime thread. next is given this callback's format.
+    void Swap(std::shared_ptr<AudioCallback> next,
+              unsigned int crossfadeFrames = 0)
+    {
+        if (!next)
+        {
+            throw std::runtime_error("SwappableCallback: no callback");
+        }
+        next->format = format;
+        m_nextFade = crossfadeFrames;
+        m_slot.publish(std::move(next));
+        m_slot.collect();
+    }
+    // Any non-realtime thread: releases the callbacks the audio thread
+    // is done with. Returns how many it still may be using.
+    size_t Collect() { return m_slot.collect(); }
+    std::shared_ptr<AudioCallback> Current() const
+    {
+        return m_slot.current();
+    }
+
+    int OnAudioCallback(const StreamCallbackInfo &info) override
+    {
+        AudioCallback *cur = m_slot.read();
+        if (cur != m_active)
+        {
+            // a swap during a crossfade cuts the oldest callback short
+            const unsigned int fade = m_nextFade;
+            m_fadingOut = fade > 0 && info.outputBuffer ? m_active : nullptr;
+            m_fadeFrames = fade;
+            m_fadePos = 0;
+            m_active = cur;
+        }
+        const int ret = m_fadingOut ? crossfade(info)
+                                    : m_active->OnAudioCallback(info);
+        // While fading, the old callback is still in use. Otherwise only
+        // m_active is, and goes on being even if a Swap() has replaced it
+        // meanwhile: the next callback fades out from it.
+        if (!m_fadingOut) m_slot.quiesce(m_active);
+        return ret;
+    }
+    void OnEvent(const StreamEvent &e) override
+    {
+        if (m_fadingOut) m_fadingOut->OnEvent(e);
+        m_active->OnEvent(e);
+    }
+};
+
+namespace detail
+{
+
+// Hands the callback blocks of exactly blockFrames, whatever the device
+// asks for. A block is rendered when the last one runs out and what the
+// device does not take yet waits in a pre-allocated buffer; so output is
+// never delayed, but is rendered up to blockFrames - gcd(blockFrames,
+// device frames) frames early. Device periods that start on a block
+// boundary are rendered straight into the device buffer.
+class StreamReblocker : public no_copy<StreamReblocker>
+{
+    const unsigned int m_blockFrames;
+    const size_t m_frameBytes;
+    std::vector<char> m_block;
+    unsigned int m_left = 0; // frames of m_block not yet taken
+
+  public:
+    StreamReblocker(unsigned int blockFrames, const FormatType &fmt)
+        : m_blockFrames(blockFrames),
+          m_frameBytes((size_t)fmt.Channels * (fmt.BitsPerSample() / 8)),
+          m_block((size_t)blockFrames * m_frameBytes)
+    {
+        assert(blockFrames > 0);
+    }
+
+    unsigned int BlockFrames() const noexcept { return m_blockFrames; }
+    // rendered, but not yet handed on
+    unsigned int Buffered() const noexcept { return m_left; }
+
+    // realtime thread. render(buffer, frames) is only ever asked for
+    // BlockFrames(), and returns the callback's result.
+    template <typename Render>
+    int pull(void *out, unsigned int frames, Render &&render)
+    {
+        char *dst = (char *)out;
+        int ret = 0;
+        while (frames > 0)
+        {
+            if (m_left == 0 && frames >= m_blockFrames)
+            {
+                const int rv = render(dst, m_blockFrames);
+                if (ret == 0) ret = rv;
+                dst += m_blockFrames * m_frameBytes;
+                frames -= m_blockFrames;
+                continue;
+            }
+            if (m_left == 0)
+            {
+                const int rv = render(m_block.data(), m_blockFrames);
+                if (ret == 0) ret = rv;
+                m_left = m_blockFrames;
+            }
+            const unsigned int n = (std::min)(frames, m_left);
+            memcpy(dst,
+                   m_block.data() + (m_blockFrames - m_left) * m_frameBytes,
+                   n * m_frameBytes);
+            dst += n * m_frameBytes;
+            frames -= n;
+            m_left -= n;
+        }
+        return ret;
+    }
 };
 
+// Calls f with a null pointer to fmt's sample type, to pick a template.
+template <typename F>
+static inline void with_sample_type(AudioFormat fmt, F &&f)
+{
+    switch (fmt)
+    {
+    case AudioFormat::SINT8:
+        f((int8_t *)nullptr);
+        break;
+    case AudioFormat::SINT16:
+        f((int16_t *)nullptr);
+        break;
+    case AudioFormat::SINT24:
+        f((S24 *)nullptr);
+        break;
+    case AudioFormat::SINT32:
+        f((int32_t *)nullptr);
+        break;
+    case AudioFormat::FLOAT64:
+        f((double *)nullptr);
+        break;
+    case AudioFormat::FLOAT32:
+    default:
+        f((float *)nullptr);
+        break;
+    }
+}
+
+// The last stage before the device when StreamConfig::Routing is set:
+// pulls the user's channels a slice at a time and mixes them through the
+// matrix into the device's channels, converting between the two sample
+// formats in the same pass.
+class StreamRouter : public no_copy<StreamRouter>
+{
+    static constexpr unsigned int SLICE_FRAMES = 256;
+
+    dsp::routing_matrix m_matrix;
+    const AudioFormat m_in, m_out;
+    const size_t m_inFrameBytes, m_outFrameBytes;
+    std::vector<char> m_userBuffer;
+
+  public:
+    StreamRouter(const dsp::routing_matrix &matrix, AudioFormat in,
+                 AudioFormat out)
+        : m_matrix(matrix), m_in(in), m_out(out),
+          m_inFrameBytes((size_t)matrix.inputs() * AudioFormatToBits(in) / 8),
+          m_outFrameBytes((size_t)matrix.outputs() * AudioFormatToBits(out) /
+                          8),
+          m_userBuffer(SLICE_FRAMES * m_inFrameBytes)
+    {
+    }
+
+    // realtime thread. render(buffer, frames) must fill buffer with that
+    // many frames of the matrix's inputs, and returns the callback's
+    // result.
+    template <typename Render>
+    int pull(void *out, unsigned int frames, Render &&render)
+    {
+        char *dst = (char *)out;
+        while (frames > 0)
+        {
+            const unsigned int n = (std::min)(frames, SLICE_FRAMES);
+            const int ret = render(m_userBuffer.data(), n);
+            const char *src = m_userBuffer.data();
+            with_sample_type(m_in, [&](auto *i) {
+                using In = std::remove_pointer_t<decltype(i)>;
+                with_sample_type(m_out, [&](auto *o) {
+                    using Out = std::remove_pointer_t<decltype(o)>;
+                    m_matrix.process((const In *)src, (Out *)dst, n);
+                });
+            });
+            dst += n * m_outFrameBytes;
+            frames -= n;
+            if (ret != 0) return ret;
+        }
+        return 0;
+    }
+};
+
+// Sits between the user's callback, running at the user's sample rate and
+// format, and a device opened as FLOAT32 at its own rate. All buffers are
+// allocated up front; pull() does the device side a slice at a time.
+class StreamResampler : public no_copy<StreamResampler>
+{
+    static constexpr unsigned int SLICE_FRAMES = 512;
+
+    dsp::polyphase_resampler m_src;
+    const FormatType m_userFormat;
+    const unsigned int m_deviceRate;
+    std::vector<char> m_userBuffer;
+    std::vector<float> m_floatBuffer;
+
+  public:
+    StreamResampler(const FormatType &user, unsigned int deviceRate,
+                    dsp::ResamplerQuality quality)
+        : m_src(user.Channels, user.SamplesPerSec, deviceRate, quality),
+          m_userFormat(user), m_deviceRate(deviceRate)
+    {
+        const size_t maxInput =
+            (size_t)std::ceil(SLICE_FRAMES * m_src.ratio()) + m_src.taps() +
+            2;
+        m_userBuffer.resize(maxInput * user.Channels *
+                            (user.BitsPerSample() / 8));
+        m_floatBuffer.resize(maxInput * user.Channels);
+    }
+
+    unsigned int DeviceRate() const noexcept { return m_deviceRate; }
+
+    // the resampler's look-ahead, in device frames
+    unsigned int LatencyFrames() const noexcept
+    {
+        return (unsigned int)std::ceil(m_src.latency() / m_src.ratio());
+    }
+
+    // realtime thread. render(buffer, frames) must fill buffer with that
+    // many frames in the user's format, and returns the callback's result.
+    template <typename Render>
+    int pull(float *out, unsigned int frames, Render &&render)
+    {
+        const unsigned int nch = m_userFormat.Channels;
+        while (frames > 0)
+        {
+            const unsigned int n = (std::min)(frames, SLICE_FRAMES);
+            const size_t need = m_src.required_input(n);
+            int ret = 0;
+            if (need > 0)
+            {
+                ret = render(m_userBuffer.data(), (unsigned int)need);
+                to_float(m_userBuffer.data(), m_userFormat.Format,
+                         m_floatBuffer.data(), need * nch);
+            }
+            m_src.process(m_floatBuffer.data(), out, n);
+            out += (size_t)n * nch;
+            frames -= n;
+            if (ret != 0) return ret;
+        }
+        return 0;
+    }
+};
+
+// Everything the realtime trampoline needs. Owned by the Stream (and
+// shared by its copies) so its address, which RtAudio holds as userData,
+// is stable for as long as the device stream is open.
+struct StreamContext
+{
+    RtAudio *rta = nullptr;
+    // RtApi is not thread-safe: every control-side call on rta (the
+    // Stream's, and the AutoTuner's reopen) holds this
+    std::mutex rtaMutex;
+    AudioCallback *pcb = nullptr;
+    StreamConfig config = {};
+    FormatType format = {};       // what the AudioCallback sees
+    FormatType deviceFormat = {}; // what the device is opened with
+    StreamParameters outParams = {};
+    StreamOptions options = {};
+    // follows the device if it changes size under a running stream
+    std::atomic<unsigned int> bufferFrames{0};
+    // stream frames played on devices since closed: each reopen starts
+    // the device's stream time again from 0
+    std::atomic<uint64_t> frameBase{0};
+    std::unique_ptr<SwappableCallback> swapper; // is pcb, when set
+    std::unique_ptr<EventQueue> events; // outlives renderAhead
+    std::unique_ptr<RenderAhead> renderAhead;
+    std::unique_ptr<StreamReblocker> reblocker;
+    std::unique_ptr<StreamResampler> resampler;
+    std::unique_ptr<StreamRouter> router;
+    RtAudioStreamStatus pendingStatus = 0; // not yet seen by the callback
+    StatsRecorder stats;
+    // declared last so that it is stopped before anything it uses goes
+    std::unique_ptr<AutoTuner> autoTuner;
+};
+
+} // namespace detail
+
 class Stream
 {
   private:
     Stream(DeviceInstance &deviceOut, RtAudio &rta, AudioCallback *cb,
-           FormatType &fmt)
-        : m_deviceInstance(deviceOut), m_rta(rta), m_pcb(cb), m_format(fmt)
+           FormatType &fmt, const StreamConfig &config)
+        : m_deviceInstance(deviceOut), m_rta(rta), m_pcb(cb), m_format(fmt),
+          m_ctx(std::make_shared<detail::StreamContext>())
 
     {
         assert(m_pcb);
+        m_ctx->rta = &rta;
+        m_ctx->pcb = cb;
+        m_ctx->config = config;
         puts("constructor with just an rtAudio instance");
     }
     DeviceInstance &m_deviceInstance;
     RtAudio &m_rta;
     AudioCallback *m_pcb = nullptr;
     FormatType &m_format;
+    std::shared_ptr<detail::StreamContext> m_ctx;
 
     static int
     static_callback(const void *outputBuffer, const void *inputBuffer,
                     const unsigned int frames, const double streamTime,
                     const RtAudioStreamStatus status, const void *userdata)
     {
-        StreamCallbackInfo info{outputBuffer, inputBuffer, frames, streamTime,
-                                AudioCallbackStatus(status)};
-
-        auto *pcb = (AudioCallback *)userdata;
-        info.format = pcb->format;
-        return pcb->OnAudioCallback(std::forward<StreamCallbackInfo>(info));
+        auto *ctx = (detail::StreamContext *)userdata;
+        const auto started = detail::StatsRecorder::now();
+        const double rate = ctx->format.SamplesPerSec;
+        // the stream frame the user's side is at: ahead of the device by
+        // what is left of a re-blocked block
+        const uint64_t base = ctx->frameBase.load(std::memory_order_relaxed);
+        const auto deviceFrame =
+            base + (uint64_t)std::llround(streamTime * rate);
+        uint64_t frame = deviceFrame +
+            (ctx->reblocker ? ctx->reblocker->Buffered() : 0);
+        ctx->pendingStatus |= status;
+        if (status & RTAUDIO_BUFFER_SIZE_CHANGED)
+        {
+            ctx->bufferFrames.store(frames, std::memory_order_relaxed);
+        }
+        // the user's side of the stream: n frames into buffer
+        auto render = [&](void *buffer, unsigned int n) {
+            if (ctx->renderAhead)
+            {
+                return ctx->renderAhead->pull(buffer, n, status);
+            }
+            const double ahead = (double)(frame - deviceFrame) / rate;
+            StreamCallbackInfo info{buffer, inputBuffer, n,
+                                    (double)base / rate + streamTime + ahead,
+                                    AudioCallbackStatus(ctx->pendingStatus)};
+            ctx->pendingStatus = 0;
+
+            auto *pcb = ctx->pcb;
+            info.format = pcb->format;
+            ctx->rta->getStreamHostTime(info.outputDacNanos,
+                                        info.inputCaptureNanos);
+            if (info.outputDacNanos)
+            {
+                info.outputDacNanos += (long long)std::llround(ahead * 1e9);
+            }
+            const int rv = detail::deliver(pcb, info, ctx->events.get(), frame);
+            frame += n;
+            return rv;
+        };
+        // ... in blocks of the size it asked for
+        auto blocked = [&](void *buffer, unsigned int n) {
+            return ctx->reblocker ? ctx->reblocker->pull(buffer, n, render)
+                                  : render(buffer, n);
+        };
+        // ... at the device's rate
+        auto resampled = [&](void *buffer, unsigned int n) {
+            return ctx->resampler
+                ? ctx->resampler->pull((float *)buffer, n, blocked)
+                : blocked(buffer, n);
+        };
+        // ... in the device's channels
+        const int ret =
+            ctx->router
+                ? ctx->router->pull((void *)outputBuffer, frames, resampled)
+                : resampled((void *)outputBuffer, frames);
+        ctx->stats.Record(started, detail::StatsRecorder::now(), frames,
+                          ctx->deviceFormat.SamplesPerSec, status, streamTime);
+        return ret;
     };
 
+    // (re)opens the device described by ctx. Throws std::runtime_error.
+    static void open_device(detail::StreamContext &ctx,
+                            unsigned int &bufferFrames)
+    {
+        ctx.rta->openStream(&ctx.outParams, nullptr,
+                            (unsigned int)ctx.deviceFormat.Format,
+                            ctx.deviceFormat.SamplesPerSec, &bufferFrames,
+                            &static_callback, &ctx, &ctx.options,
+                            &detail::static_error_callback);
+        ctx.bufferFrames = bufferFrames;
+    }
+
+    // Runs on the AutoTuner's thread. Falls back to the old size if the
+    // device will not take the new one.
+    static bool reopen_device(detail::StreamContext &ctx,
+                              unsigned int &bufferFrames)
+    {
+        std::lock_guard<std::mutex> lock(ctx.rtaMutex);
+        const unsigned int was = ctx.bufferFrames;
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            try
+            {
+                if (ctx.rta->isStreamOpen())
+                {
+                    if (ctx.rta->isStreamRunning()) ctx.rta->stopStream();
+                    ctx.frameBase += (uint64_t)std::llround(
+                        ctx.rta->getStreamTime() * ctx.format.SamplesPerSec);
+                    ctx.rta->closeStream();
+                }
+                open_device(ctx, bufferFrames);
+                ctx.rta->startStream();
+                return true;
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Stream: reopen with " << bufferFrames
+                          << " frames failed: " << e.what() << std::endl;
+                bufferFrames = was;
+            }
+        }
+        return false;
+    }
+
   public:
     Stream(RtAudio &rta, DeviceInstance &deviceOut, AudioCallback *cb,
-           FormatType &fmt)
-        : Stream(deviceOut, rta, cb, fmt)
+           FormatType &fmt, const StreamConfig &config = {})
+        : Stream(deviceOut, rta, cb, fmt, config)
     {
         OpenForOutput();
     }
     Stream(const Stream &rhs)
         : m_deviceInstance(rhs.m_deviceInstance), m_rta(rhs.m_rta),
-          m_pcb(rhs.m_pcb), m_format(rhs.m_format),
+          m_pcb(rhs.m_pcb), m_format(rhs.m_format), m_ctx(rhs.m_ctx),
           m_latencyFrames(rhs.m_latencyFrames)
     {
         puts("copy constructor");
@@ -726,14 +1772,109 @@ class Stream
 
     ~Stream()
     {
+        // the last copy out closes the device stream, as RtAudio holds a
+        // pointer to the context we are about to release.
+        if (m_ctx && m_ctx.use_count() == 1)
+        {
+            m_ctx->autoTuner.reset();
+            std::lock_guard<std::mutex> lock(m_ctx->rtaMutex);
+            if (m_rta.isStreamOpen()) m_rta.closeStream();
+        }
         puts("Stream Destructor");
         puts("\n");
     }
 
     // throws std::runtime_error if problems.
-    void Start() { m_rta.startStream(); }
-    long GetStreamLatency() const { return m_rta.getStreamLatency(); }
+    void Start()
+    {
+        if (m_ctx->renderAhead) m_ctx->renderAhead->Start();
+        {
+            std::lock_guard<std::mutex> lock(m_ctx->rtaMutex);
+            m_rta.startStream();
+        }
+        if (m_ctx->autoTuner) m_ctx->autoTuner->Start();
+    }
+    // The device buffer size currently in use, in frames.
+    unsigned int BufferFrames() const noexcept
+    {
+        return m_ctx->bufferFrames;
+    }
+    long GetStreamLatency() const
+    {
+        long ret;
+        {
+            std::lock_guard<std::mutex> lock(m_ctx->rtaMutex);
+            ret = m_rta.getStreamLatency();
+        }
+        if (m_ctx->renderAhead)
+        {
+            ret += (long)(m_ctx->config.RenderAheadBlocks *
+                          m_ctx->renderAhead->BlockFrames());
+        }
+        if (m_ctx->resampler) ret += m_ctx->resampler->LatencyFrames();
+        if (m_ctx->reblocker)
+        {
+            const unsigned int block = m_ctx->reblocker->BlockFrames();
+            ret += (long)(block - std::gcd(block, m_ctx->bufferFrames.load()));
+        }
+        return ret;
+    }
     bool HasCallback() const noexcept { return m_pcb; }
+    // Lock-free snapshot of callback timing, DSP load and xrun counts.
+    // Safe to call from any thread, as often as you like.
+    StreamStats Stats() const noexcept { return m_ctx->stats.Snapshot(); }
+    const StreamConfig &Config() const noexcept { return m_ctx->config; }
+    // Number of device buffers that found no rendered block ready (and
+    // so played silence). Always zero unless render-ahead is enabled.
+    unsigned long RenderAheadUnderruns() const noexcept
+    {
+        return m_ctx->renderAhead ? m_ctx->renderAhead->Underruns() : 0;
+    }
+
+    // The stream frame playing now: the stream time, in frames, counted
+    // on across any reopen by the AutoTuner.
+    uint64_t StreamFrame() const
+    {
+        std::lock_guard<std::mutex> lock(m_ctx->rtaMutex);
+        return m_ctx->frameBase +
+            (uint64_t)std::llround(m_rta.getStreamTime() *
+                                   m_ctx->format.SamplesPerSec);
+    }
+    // Any thread: schedules OnEvent() for the given stream frame. False
+    // if the queue is full. Throws std::runtime_error unless the stream
+    // was opened with StreamConfig::EventQueueCapacity.
+    bool PostEvent(uint64_t frame, unsigned int target, float value)
+    {
+        if (!m_ctx->events)
+        {
+            throw std::runtime_error("Stream::PostEvent: the stream has no "
+                                     "event queue");
+        }
+        return m_ctx->events->Post(StreamEvent{frame, target, value});
+    }
+    // Any non-realtime thread: replaces the callback, crossfading from the
+    // old one over crossfadeFrames. The old callback is released once the
+    // audio thread is done with it, at a later SwapCallback() or
+    // CollectCallbacks(). Throws std::runtime_error unless the stream was
+    // opened with StreamConfig::HotSwapCallback.
+    void SwapCallback(std::shared_ptr<AudioCallback> next,
+                      unsigned int crossfadeFrames = 0)
+    {
+        if (!m_ctx->swapper)
+        {
+            throw std::runtime_error("Stream::SwapCallback: the stream was "
+                                     "not opened with HotSwapCallback");
+        }
+        m_ctx->swapper->Swap(std::move(next), crossfadeFrames);
+    }
+    // Returns how many replaced callbacks the audio thread may still use.
+    size_t CollectCallbacks()
+    {
+        return m_ctx->swapper ? m_ctx->swapper->Collect() : 0;
+    }
+
+    // The stream's event queue (for its counters), or nullptr.
+    const EventQueue *Events() const noexcept { return m_ctx->events.get(); }
 
   private:
     int OnAudioCallback(StreamCallbackInfo &&info)
@@ -742,10 +1883,21 @@ class Stream
     }
 
   public:
-    bool isRunning() const { return m_rta.isStreamRunning(); }
+    bool isRunning() const
+    {
+        std::lock_guard<std::mutex> lock(m_ctx->rtaMutex);
+        return m_rta.isStreamRunning();
+    }
 
     FormatType Format() const { return m_format; }
 
+    // What the open device was actually set to, and how we convert to it.
+    RtAudio::ConversionInfo Conversion() const
+    {
+        std::lock_guard<std::mutex> lock(m_ctx->rtaMutex);
+        return m_rta.getStreamConversionInfo(false);
+    }
+
   private:
     Stream OpenForOutput()
     {
@@ -784,18 +1936,148 @@ class Stream
         }
 
         opts = &m_deviceInstance.streamOptions();
-        unsigned int bufferFrames = 1024;
+        if (m_ctx->config.RenderAheadBlocks > 0 &&
+            (opts->flags & RTAUDIO_NONINTERLEAVED))
+        {
+            throw std::runtime_error("Stream::OpenForOutput: render-ahead "
+                                     "requires interleaved buffers");
+        }
+        if (m_ctx->config.ResampleToPreferredRate &&
+            (opts->flags & RTAUDIO_NONINTERLEAVED))
+        {
+            throw std::runtime_error("Stream::OpenForOutput: resampling "
+                                     "requires interleaved buffers");
+        }
+        if (m_ctx->config.EventQueueCapacity > 0 &&
+            (opts->flags & RTAUDIO_NONINTERLEAVED))
+        {
+            throw std::runtime_error("Stream::OpenForOutput: events "
+                                     "require interleaved buffers");
+        }
+        if (m_ctx->config.BlockFrames > 0)
+        {
+            if (opts->flags & RTAUDIO_NONINTERLEAVED)
+            {
+                throw std::runtime_error("Stream::OpenForOutput: fixed "
+                                         "blocks require interleaved buffers");
+            }
+            if (m_ctx->config.EventQueueCapacity > 0)
+            {
+                throw std::runtime_error("Stream::OpenForOutput: events "
+                                         "would split the fixed blocks");
+            }
+        }
+        const auto &routing = m_ctx->config.Routing;
+        if (!routing.empty())
+        {
+            if (opts->flags & RTAUDIO_NONINTERLEAVED)
+            {
+                throw std::runtime_error("Stream::OpenForOutput: routing "
+                                         "requires interleaved buffers");
+            }
+            const unsigned int deviceChannels =
+                m_deviceInstance.systemDevice().info.outputChannels;
+            if (outParams->firstChannel + routing.outputs() > deviceChannels)
+            {
+                throw std::runtime_error(
+                    "Stream::OpenForOutput: routing to " +
+                    std::to_string(routing.outputs()) + " channels from " +
+                    std::to_string(outParams->firstChannel) +
+                    " needs more than the device's " +
+                    std::to_string(deviceChannels));
+            }
+        }
+        const auto &config = m_ctx->config;
+        unsigned int bufferFrames = config.BufferFrames;
 
         m_format = m_deviceInstance.Format();
+        if (!routing.empty()) m_format.Channels = routing.inputs();
 
         m_pcb->format =
             m_format; // it's a copy, so its safe to access it from the callback
-        unsigned int fmt = (unsigned int)m_format.Format;
-        m_rta.openStream(outParams, nullptr, fmt, m_format.SamplesPerSec,
-                         &bufferFrames, &static_callback, m_pcb, opts,
-                         &detail::static_error_callback);
+        m_ctx->format = m_format;
+        m_ctx->deviceFormat = m_format;
+        const unsigned int preferredRate =
+            m_deviceInstance.systemDevice().info.preferredSampleRate;
+        if (config.ResampleToPreferredRate && preferredRate != 0 &&
+            preferredRate != m_format.SamplesPerSec)
+        {
+            m_ctx->resampler = std::make_unique<detail::StreamResampler>(
+                m_format, preferredRate, config.ResampleQuality);
+            m_ctx->deviceFormat.Format = AudioFormat::FLOAT32;
+            m_ctx->deviceFormat.SamplesPerSec = preferredRate;
+        }
+        m_ctx->outParams = *outParams;
+        m_ctx->options = *opts;
+        if (!routing.empty())
+        {
+            // open the device in a format it takes natively, so that the
+            // router's pass is the only conversion
+            const AudioFormat from = m_ctx->deviceFormat.Format;
+            const auto native = RtAudio::getCheapestFormat(
+                (RtAudioFormat)from, m_deviceInstance.NativeFormats());
+            if (native != 0)
+            {
+                m_ctx->deviceFormat.Format = static_cast<AudioFormat>(native);
+            }
+            m_ctx->router = std::make_unique<detail::StreamRouter>(
+                routing, from, m_ctx->deviceFormat.Format);
+            m_ctx->deviceFormat.Channels = routing.outputs();
+            m_ctx->outParams.nChannels = routing.outputs();
+        }
 
-        m_latencyFrames = m_rta.getStreamLatency();
+        if (config.AutoTuneBufferFrames)
+        {
+            const auto &sd = m_deviceInstance.systemDevice();
+            const std::string key =
+                RtAudio::getApiName(sd.rtapi) + ":" + sd.info.name;
+            const std::string path =
+                config.AutoTuneStorePath.empty()
+                    ? detail::BufferSizeStore::DefaultPath()
+                    : config.AutoTuneStorePath;
+            auto *ctx = m_ctx.get();
+            m_ctx->autoTuner = std::make_unique<detail::AutoTuner>(
+                key, path, bufferFrames, config.MinBufferFrames,
+                config.MaxBufferFrames, [ctx] { return ctx->stats.Snapshot(); },
+                [ctx](unsigned int &frames) {
+                    return reopen_device(*ctx, frames);
+                });
+            bufferFrames = m_ctx->autoTuner->InitialFrames(bufferFrames);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_ctx->rtaMutex);
+            open_device(*m_ctx, bufferFrames);
+            m_latencyFrames = m_rta.getStreamLatency();
+        }
+        *opts = m_ctx->options; // RtAudio reports back the buffers it used
+        if (m_ctx->autoTuner) m_ctx->autoTuner->Accept(bufferFrames);
+
+        if (config.HotSwapCallback)
+        {
+            // the first callback is the caller's to own
+            m_ctx->swapper = std::make_unique<SwappableCallback>(
+                std::shared_ptr<AudioCallback>(m_pcb, [](AudioCallback *) {}),
+                m_format);
+            m_ctx->pcb = m_ctx->swapper.get();
+        }
+        if (config.EventQueueCapacity > 0)
+        {
+            m_ctx->events =
+                std::make_unique<EventQueue>(config.EventQueueCapacity);
+        }
+        if (m_ctx->config.RenderAheadBlocks > 0)
+        {
+            m_ctx->renderAhead = std::make_unique<detail::RenderAhead>(
+                m_ctx->pcb, m_format,
+                config.BlockFrames > 0 ? config.BlockFrames : bufferFrames,
+                m_ctx->config.RenderAheadBlocks, m_ctx->events.get());
+        }
+        else if (config.BlockFrames > 0)
+        {
+            m_ctx->reblocker = std::make_unique<detail::StreamReblocker>(
+                config.BlockFrames, m_format);
+        }
 
         this->Start();
         while (isRunning())
@@ -869,9 +2151,10 @@ class myaudio : public RtAudio, public no_copy<myaudio>
         return nullptr;
     }
 
-    auto OpenStream(DeviceInstance &deviceOut, AudioCallback *cb)
+    auto OpenStream(DeviceInstance &deviceOut, AudioCallback *cb,
+                    const StreamConfig &config = {})
     {
-        Stream s(*this, deviceOut, cb, deviceOut.Format());
+        Stream s(*this, deviceOut, cb, deviceOut.Format(), config);
         return s;
     }
 };
@@ -879,20 +2162,91 @@ class myaudio : public RtAudio, public no_copy<myaudio>
 namespace dsp
 {
 
+// Writes nFrames of osc into an interleaved buffer of the given format,
+// the same signal on every channel.
+[[maybe_unused]] static inline void generate(oscillator &osc, void *out,
+                                             unsigned int nFrames,
+                                             const FormatType &fmt)
+{
+    const unsigned int nch = fmt.Channels;
+    switch (fmt.Format)
+    {
+    case AudioFormat::SINT8:
+        osc.generate((int8_t *)out, nFrames, nch);
+        break;
+    case AudioFormat::SINT16:
+        osc.generate((int16_t *)out, nFrames, nch);
+        break;
+    case AudioFormat::SINT24:
+        osc.generate((S24 *)out, nFrames, nch);
+        break;
+    case AudioFormat::SINT32:
+        osc.generate((int32_t *)out, nFrames, nch);
+        break;
+    case AudioFormat::FLOAT64:
+        osc.generate((double *)out, nFrames, nch);
+        break;
+    case AudioFormat::FLOAT32:
+    default:
+        osc.generate((float *)out, nFrames, nch);
+        break;
+    }
+}
+
+// Runs a chain in place over a buffer in any of the stream formats.
+template <typename... Stages>
+static inline void apply_chain(const fused_chain<Stages...> &chain,
+                               void *samples, unsigned int nFrames,
+                               const FormatType &fmt)
+{
+    const int n = (int)nFrames, nch = (int)fmt.Channels;
+    switch (fmt.Format)
+    {
+    case AudioFormat::SINT8:
+        chain.processSamples(n, (int8_t *)samples, nch);
+        break;
+    case AudioFormat::SINT16:
+        chain.processSamples(n, (int16_t *)samples, nch);
+        break;
+    case AudioFormat::SINT24:
+        chain.processSamples(n, (S24 *)samples, nch);
+        break;
+    case AudioFormat::SINT32:
+        chain.processSamples(n, (int32_t *)samples, nch);
+        break;
+    case AudioFormat::FLOAT64:
+        chain.processSamples(n, (double *)samples, nch);
+        break;
+    case AudioFormat::FLOAT32:
+    default:
+        chain.processSamples(n, (float *)samples, nch);
+        break;
+    }
+}
+
+// and over a callback's output buffer
+template <typename... Stages>
+static inline void apply_chain(const fused_chain<Stages...> &chain,
+                               const audio::StreamCallbackInfo &info)
+{
+    apply_chain(chain, (void *)info.outputBuffer, info.frames, info.format);
+}
+
+// nsample counts frames, modulo the sample rate, so successive calls carry
+// on from where the last one left off. Writes whatever format the stream
+// is using.
 [[maybe_unused]] static inline void
 fill_buffer_sine(unsigned int &nsample, const audio::StreamCallbackInfo &info,
                  int freq = 440)
 {
-    float *out = (float *)info.outputBuffer;
-    const auto nch = info.format.Channels;
-    for (unsigned int i = 0; i < info.frames; ++i)
-    {
-        auto v = next_sine_sample(nsample, info.format.SamplesPerSec, freq);
-        for (unsigned int ch = 0; ch < nch; ++ch)
-        {
-            *out++ = v;
-        }
-    }
+    const unsigned int sr = info.format.SamplesPerSec;
+    if (sr == 0) return;
+    if (nsample >= sr) nsample = 0;
+    oscillator osc(freq, sr);
+    // signed, so a negative frequency runs backwards from the right phase
+    osc.phase((double)((int64_t)freq * nsample % sr) / sr);
+    generate(osc, (void *)info.outputBuffer, info.frames, info.format);
+    nsample = (unsigned int)(((uint64_t)nsample + info.frames) % sr);
 }
 } // namespace dsp
 
@@ -0,0 +1,470 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include "samples.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+// One cycle of a periodic waveform, as a sum of harmonics. Stored with one
+// guard point before and two after, so both linear and cubic
+// interpolation can read their neighbours without wrapping.
+class wavetable
+{
+  public:
+    static constexpr unsigned int BITS = 11;
+    static constexpr unsigned int SIZE = 1u << BITS;
+
+  private:
+    std::vector<float> m_data; // SIZE + 3
+
+  public:
+    // harmonics[k] is the amplitude of harmonic k + 1 (sine phase)
+    explicit wavetable(const std::vector<float> &harmonics)
+        : m_data(SIZE + 3, 0.0f)
+    {
+        for (unsigned int i = 0; i < SIZE; ++i)
+        {
+            const double x = 2.0 * M_PI * i / SIZE;
+            double v = 0;
+            for (size_t k = 0; k < harmonics.size(); ++k)
+            {
+                if (harmonics[k] == 0) continue;
+                v += harmonics[k] * std::sin(x * (double)(k + 1));
+            }
+            m_data[i + 1] = (float)v;
+        }
+        m_data[0] = m_data[SIZE];
+        m_data[SIZE + 1] = m_data[1];
+        m_data[SIZE + 2] = m_data[2];
+    }
+
+    // the table proper: data()[-1] and data()[SIZE], data()[SIZE + 1] are
+    // valid guard points
+    const float *data() const noexcept { return m_data.data() + 1; }
+
+    static const wavetable &sine()
+    {
+        static const wavetable table(std::vector<float>{1.0f});
+        return table;
+    }
+
+    // Band-limited sawtooth and square waves: only the harmonics that stay
+    // below Nyquist at the highest frequency they will be played at.
+    static wavetable saw(double maxFreq, double samplerate)
+    {
+        std::vector<float> h(harmonics_below_nyquist(maxFreq, samplerate));
+        for (size_t k = 0; k < h.size(); ++k)
+        {
+            h[k] = (float)((k % 2 ? -2.0 : 2.0) / (M_PI * (k + 1)));
+        }
+        return wavetable(h);
+    }
+    static wavetable square(double maxFreq, double samplerate)
+    {
+        std::vector<float> h(harmonics_below_nyquist(maxFreq, samplerate));
+        for (size_t k = 0; k < h.size(); k += 2)
+        {
+            h[k] = (float)(4.0 / (M_PI * (k + 1)));
+        }
+        return wavetable(h);
+    }
+
+    static size_t harmonics_below_nyquist(double maxFreq, double samplerate)
+    {
+        if (maxFreq <= 0) return 1;
+        const size_t n = (size_t)(samplerate / 2.0 / maxFreq);
+        return (std::max)(n, (size_t)1);
+    }
+};
+
+enum class Interpolation
+{
+    linear,
+    cubic
+};
+
+// Wavetable oscillator with a 32-bit phase accumulator: the phase wraps by
+// integer overflow, so it never drifts and never needs resetting, and a
+// frequency change just changes the increment (no discontinuity). The
+// resolution is samplerate / 2^32, about 10 micro-Hz at 48kHz.
+class oscillator
+{
+    static constexpr unsigned int FRAC_BITS = 32 - wavetable::BITS;
+    static constexpr uint32_t FRAC_MASK = (1u << FRAC_BITS) - 1;
+    static constexpr unsigned int BLOCK = 256;
+
+    const wavetable *m_table;
+    Interpolation m_interp;
+    uint32_t m_phase = 0;
+    uint32_t m_inc = 0;
+    float m_amplitude;
+    double m_samplerate;
+
+  public:
+    oscillator(double freq, double samplerate, float amplitude = 1.0f,
+               Interpolation interp = Interpolation::linear,
+               const wavetable &table = wavetable::sine())
+        : m_table(&table), m_interp(interp), m_amplitude(amplitude),
+          m_samplerate(samplerate)
+    {
+        frequency(freq);
+    }
+
+    void frequency(double freq) noexcept
+    {
+        const double cycles = freq / m_samplerate;
+        m_inc = (uint32_t)(int64_t)std::llround(
+            (cycles - std::floor(cycles)) * 4294967296.0);
+    }
+    double frequency() const noexcept
+    {
+        return m_inc / 4294967296.0 * m_samplerate;
+    }
+    void amplitude(float a) noexcept { m_amplitude = a; }
+    float amplitude() const noexcept { return m_amplitude; }
+    // phase in cycles, [0, 1)
+    void phase(double cycles) noexcept
+    {
+        m_phase = (uint32_t)(int64_t)std::llround(
+            (cycles - std::floor(cycles)) * 4294967296.0);
+    }
+    double phase() const noexcept { return m_phase / 4294967296.0; }
+
+    // nFrames of mono output
+    void generate(float *out, unsigned int nFrames) noexcept
+    {
+        const float *t = m_table->data();
+        const float scale = 1.0f / (float)(1u << FRAC_BITS);
+        const float a = m_amplitude;
+        uint32_t phase = m_phase;
+        const uint32_t inc = m_inc;
+        if (m_interp == Interpolation::linear)
+        {
+            for (unsigned int i = 0; i < nFrames; ++i)
+            {
+                const uint32_t p = phase + inc * i;
+                const uint32_t idx = p >> FRAC_BITS;
+                const float f = (float)(p & FRAC_MASK) * scale;
+                out[i] = a * (t[idx] + (t[idx + 1] - t[idx]) * f);
+            }
+        }
+        else
+        {
+            // 4-point, 3rd order Hermite (Catmull-Rom)
+            for (unsigned int i = 0; i < nFrames; ++i)
+            {
+                const uint32_t p = phase + inc * i;
+                const int idx = (int)(p >> FRAC_BITS);
+                const float f = (float)(p & FRAC_MASK) * scale;
+                const float xm1 = t[idx - 1], x0 = t[idx], x1 = t[idx + 1],
+                            x2 = t[idx + 2];
+                const float c1 = 0.5f * (x1 - xm1);
+                const float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+                const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+                out[i] = a * (((c3 * f + c2) * f + c1) * f + x0);
+            }
+        }
+        m_phase = phase + inc * nFrames;
+    }
+
+    // nFrames written to every one of nch interleaved channels, converted
+    // to T on the way (see from_float).
+    template <typename T>
+    void generate(T *out, unsigned int nFrames, unsigned int nch) noexcept
+    {
+        float block[BLOCK];
+        while (nFrames > 0)
+        {
+            const unsigned int n = (std::min)(nFrames, BLOCK);
+            generate(block, n);
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                const T v = from_float<T>(block[i]);
+                for (unsigned int ch = 0; ch < nch; ++ch)
+                {
+                    *out++ = v;
+                }
+            }
+            nFrames -= n;
+        }
+    }
+};
+
+// Sine (and cosine) by rotating a complex phasor each sample rather than
+// looking anything up. LANES phasors run side by side, each a sample
+// apart and each rotated by LANES samples' worth per step, so a block is
+// a loop the compiler can vectorise. Rounding error makes the magnitude
+// wander, so it is renormalised once a block.
+class quadrature_oscillator
+{
+  public:
+    static constexpr unsigned int LANES = 8;
+
+  private:
+    double m_re[LANES];
+    double m_im[LANES];
+    double m_stepRe = 1, m_stepIm = 0; // rotation by LANES samples
+    double m_samplerate;
+    double m_freq = 0;
+    float m_amplitude;
+
+    void set_lanes(double re0, double im0) noexcept
+    {
+        const double w = 2.0 * M_PI * m_freq / m_samplerate;
+        for (unsigned int k = 0; k < LANES; ++k)
+        {
+            const double c = std::cos(w * k), s = std::sin(w * k);
+            m_re[k] = re0 * c - im0 * s;
+            m_im[k] = re0 * s + im0 * c;
+        }
+        m_stepRe = std::cos(w * LANES);
+        m_stepIm = std::sin(w * LANES);
+    }
+
+    void renormalise() noexcept
+    {
+        for (unsigned int k = 0; k < LANES; ++k)
+        {
+            const double m2 = m_re[k] * m_re[k] + m_im[k] * m_im[k];
+            // first order approximation of 1/sqrt(m2), fine this close to 1
+            const double g = 1.5 - 0.5 * m2;
+            m_re[k] *= g;
+            m_im[k] *= g;
+        }
+    }
+
+  public:
+    quadrature_oscillator(double freq, double samplerate,
+                          float amplitude = 1.0f)
+        : m_samplerate(samplerate), m_freq(freq), m_amplitude(amplitude)
+    {
+        set_lanes(1.0, 0.0);
+    }
+
+    // Keeps the current phase: no click.
+    void frequency(double freq) noexcept
+    {
+        m_freq = freq;
+        set_lanes(m_re[0], m_im[0]);
+    }
+    double frequency() const noexcept { return m_freq; }
+    void amplitude(float a) noexcept { m_amplitude = a; }
+
+    // nFrames of sine (and, if wanted, cosine) output. Either may be null.
+    void generate(float *sine, float *cosine, unsigned int nFrames) noexcept
+    {
+        const float a = m_amplitude;
+        unsigned int i = 0;
+        for (; i + LANES <= nFrames; i += LANES)
+        {
+            if (sine)
+            {
+                for (unsigned int k = 0; k < LANES; ++k)
+                {
+                    sine[i + k] = a * (float)m_im[k];
+                }
+            }
+            if (cosine)
+            {
+                for (unsigned int k = 0; k < LANES; ++k)
+                {
+                    cosine[i + k] = a * (float)m_re[k];
+                }
+            }
+            for (unsigned int k = 0; k < LANES; ++k)
+            {
+                const double re = m_re[k] * m_stepRe - m_im[k] * m_stepIm;
+                m_im[k] = m_re[k] * m_stepIm + m_im[k] * m_stepRe;
+                m_re[k] = re;
+            }
+        }
+        if (i < nFrames)
+        {
+            // a part-filled set of lanes: emit what is needed, then restart
+            // the lanes from the first one that was not used.
+            const unsigned int used = nFrames - i;
+            for (unsigned int k = 0; k < used; ++k)
+            {
+                if (sine) sine[i + k] = a * (float)m_im[k];
+                if (cosine) cosine[i + k] = a * (float)m_re[k];
+            }
+            set_lanes(m_re[used], m_im[used]);
+        }
+        renormalise();
+    }
+};
+
+
+// Many sine partials summed into one signal, for dense multi-tone test
+// signals. Each partial is a rotating phasor like quadrature_oscillator,
+// and the state is kept as one array per field (structure of arrays), so
+// the inner loop steps a run of partials at once and vectorises. Partials
+// are taken TILE at a time over a whole sub-block, which keeps the
+// working set in L1 even with thousands of them.
+class oscillator_bank
+{
+  public:
+    static constexpr size_t TILE = 256;
+    // frames between renormalisations of every phasor
+    static constexpr unsigned int RENORM_FRAMES = 1024;
+
+  private:
+    double m_samplerate;
+    std::vector<double> m_re, m_im;     // phasor
+    std::vector<double> m_cos, m_sin;   // per-sample rotation
+    std::vector<double> m_amp;
+
+    void set_rotation(size_t k, double freq)
+    {
+        const double w = 2.0 * M_PI * freq / m_samplerate;
+        m_cos[k] = std::cos(w);
+        m_sin[k] = std::sin(w);
+    }
+
+    static double sum_lanes(const double *v, size_t n) noexcept
+    {
+        constexpr size_t LANES = 8;
+        double lanes[LANES] = {};
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t j = 0; j < LANES; ++j)
+            {
+                lanes[j] += v[i + j];
+            }
+        }
+        double sum = 0;
+        for (; i < n; ++i)
+        {
+            sum += v[i];
+        }
+        for (size_t j = 0; j < LANES; ++j)
+        {
+            sum += lanes[j];
+        }
+        return sum;
+    }
+
+    // out[0, nFrames) = sum of partials [first, last)
+    void generate_range(float *out, unsigned int nFrames, size_t first,
+                        size_t last) noexcept
+    {
+        double scratch[TILE];
+        std::fill(out, out + nFrames, 0.0f);
+        for (unsigned int done = 0; done < nFrames;)
+        {
+            const unsigned int n = (std::min)(nFrames - done, RENORM_FRAMES);
+            for (size_t t = first; t < last; t += TILE)
+            {
+                const size_t end = (std::min)(t + TILE, last);
+                double *re = m_re.data(), *im = m_im.data();
+                const double *c = m_cos.data(), *s = m_sin.data(),
+                             *a = m_amp.data();
+                for (unsigned int i = 0; i < n; ++i)
+                {
+                    // no reduction in this loop, so it vectorises without
+                    // needing the compiler to reorder the additions
+                    for (size_t k = t; k < end; ++k)
+                    {
+                        scratch[k - t] = a[k] * im[k];
+                        const double r = re[k] * c[k] - im[k] * s[k];
+                        im[k] = re[k] * s[k] + im[k] * c[k];
+                        re[k] = r;
+                    }
+                    out[done + i] += (float)sum_lanes(scratch, end - t);
+                }
+            }
+            for (size_t k = first; k < last; ++k)
+            {
+                const double m2 = m_re[k] * m_re[k] + m_im[k] * m_im[k];
+                const double g = 1.5 - 0.5 * m2;
+                m_re[k] *= g;
+                m_im[k] *= g;
+            }
+            done += n;
+        }
+    }
+
+  public:
+    explicit oscillator_bank(double samplerate) : m_samplerate(samplerate) {}
+
+    // Not realtime safe: may allocate. Returns the partial's index.
+    size_t add(double freq, float amplitude, double phaseCycles = 0)
+    {
+        const double ph = 2.0 * M_PI * phaseCycles;
+        m_re.push_back(std::cos(ph));
+        m_im.push_back(std::sin(ph));
+        m_cos.push_back(1);
+        m_sin.push_back(0);
+        m_amp.push_back(amplitude);
+        set_rotation(m_re.size() - 1, freq);
+        return m_re.size() - 1;
+    }
+    void reserve(size_t n)
+    {
+        for (auto *v : {&m_re, &m_im, &m_cos, &m_sin, &m_amp})
+        {
+            v->reserve(n);
+        }
+    }
+    size_t size() const noexcept { return m_re.size(); }
+
+    // Keeps the partial's phase.
+    void frequency(size_t k, double freq) { set_rotation(k, freq); }
+    void amplitude(size_t k, float a) { m_amp[k] = a; }
+
+    // nFrames of the summed partials, overwriting out
+    void generate(float *out, unsigned int nFrames) noexcept
+    {
+        generate_range(out, nFrames, 0, size());
+    }
+
+    // Offline rendering: the partials are shared out between threads, each
+    // of which renders its share into a buffer of its own; the buffers are
+    // then summed into out. threads == 0 uses one per core.
+    void render(float *out, unsigned int nFrames, unsigned int threads = 0)
+    {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        const size_t per = (size() + threads - 1) / (std::max)(threads, 1u);
+        if (threads <= 1 || per < TILE)
+        {
+            generate(out, nFrames);
+            return;
+        }
+        std::vector<std::vector<float>> parts;
+        std::vector<std::thread> workers;
+        for (size_t first = 0; first < size(); first += per)
+        {
+            parts.emplace_back(nFrames);
+            float *dest = parts.back().data();
+            const size_t last = (std::min)(first + per, size());
+            workers.emplace_back([this, dest, nFrames, first, last] {
+                generate_range(dest, nFrames, first, last);
+            });
+        }
+        for (auto &w : workers)
+        {
+            w.join();
+        }
+        std::copy(parts[0].begin(), parts[0].end(), out);
+        for (size_t p = 1; p < parts.size(); ++p)
+        {
+            const float *src = parts[p].data();
+            for (unsigned int i = 0; i < nFrames; ++i)
+            {
+                out[i] += src[i];
+            }
+        }
+    }
+};
+
+} // namespace dsp
+} // namespace audio
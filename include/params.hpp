@@ -0,0 +1,256 @@
+#pragma once
+#include "lockfree.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace audio
+{
+
+enum class Smoothing : uint8_t
+{
+    none,   // jumps to the target at the next block
+    linear, // reaches the target in exactly the smoothing time
+    onePole // exponential: 63% of the way in the smoothing time
+};
+
+// A store of float parameters (gains, pans, cutoffs...) shared between
+// any number of control threads and one audio thread. set() is a relaxed
+// store into the parameter's slot plus a bump of its group's generation:
+// the slots are grouped a cache line at a time, each line with its own
+// counter, and a store-wide counter says whether anything changed at all.
+// The audio thread calls update() once per block: it looks only at the
+// groups whose generation moved, reads their latest targets (so any
+// number of writes between blocks cost it one read) and advances the
+// smoothing of the parameters still moving. Within the block it reads
+// each one as a start value and a per-frame step. Nothing locks, and
+// nothing allocates after construction.
+class params
+{
+  public:
+    // slots per cache line, next to the line's generation counter
+    static constexpr size_t GROUP =
+        (lockfree::CACHE_LINE_SIZE - sizeof(uint32_t)) / sizeof(float);
+
+  private:
+    struct alignas(lockfree::CACHE_LINE_SIZE) group
+    {
+        std::atomic<uint32_t> generation{0};
+        std::array<std::atomic<float>, GROUP> target;
+    };
+
+    const size_t m_count;
+    const double m_samplerate;
+    std::vector<group> m_groups;
+    alignas(lockfree::CACHE_LINE_SIZE) std::atomic<uint64_t> m_changed{0};
+
+    // set up by configure(), before the audio thread starts
+    std::vector<Smoothing> m_mode;
+    std::vector<float> m_frames; // smoothing time, in frames
+    std::vector<double> m_pole;  // one-pole decay per frame
+
+    // audio thread state, one entry per parameter
+    alignas(lockfree::CACHE_LINE_SIZE) uint64_t m_seenChanged = 0;
+    std::vector<uint32_t> m_seen; // per group
+    std::vector<float> m_target;
+    std::vector<float> m_current; // at the end of the block
+    std::vector<float> m_start;   // at the start of the block
+    std::vector<float> m_step;    // per frame, within the block
+    std::vector<float> m_inc;     // linear: per frame
+    std::vector<unsigned int> m_left; // linear: frames to go
+    std::vector<size_t> m_moving; // never reallocates: reserved m_count
+    std::vector<bool> m_isMoving;
+
+    void check(size_t i, const char *what) const
+    {
+        if (i >= m_count)
+        {
+            throw std::runtime_error(std::string("params::") + what +
+                                     ": no parameter " + std::to_string(i));
+        }
+    }
+
+    void retarget(size_t i, float t) noexcept
+    {
+        m_target[i] = t;
+        switch (m_mode[i])
+        {
+        case Smoothing::linear:
+        {
+            const unsigned int n =
+                (std::max)(1u, (unsigned int)std::lround(m_frames[i]));
+            m_inc[i] = (t - m_current[i]) / (float)n;
+            m_left[i] = n;
+            break;
+        }
+        case Smoothing::onePole:
+            break;
+        case Smoothing::none:
+        default:
+            m_current[i] = t;
+            m_left[i] = 0;
+            break;
+        }
+        if (!m_isMoving[i])
+        {
+            m_isMoving[i] = true;
+            m_moving.push_back(i);
+        }
+    }
+
+    void pick_up_changes() noexcept
+    {
+        const uint64_t changed = m_changed.load(std::memory_order_acquire);
+        if (changed == m_seenChanged) return;
+        m_seenChanged = changed;
+        for (size_t g = 0; g < m_groups.size(); ++g)
+        {
+            const uint32_t gen =
+                m_groups[g].generation.load(std::memory_order_acquire);
+            if (gen == m_seen[g]) continue;
+            m_seen[g] = gen;
+            const size_t first = g * GROUP;
+            const size_t last = (std::min)(first + GROUP, m_count);
+            for (size_t i = first; i < last; ++i)
+            {
+                const float t = m_groups[g].target[i - first].load(
+                    std::memory_order_relaxed);
+                if (t != m_target[i]) retarget(i, t);
+            }
+        }
+    }
+
+    // moves parameter i on by frames; false when it has arrived
+    bool advance(size_t i, unsigned int frames) noexcept
+    {
+        const float from = m_current[i];
+        float to = m_target[i];
+        bool more = false;
+        if (m_mode[i] == Smoothing::linear && m_left[i] > 0)
+        {
+            const unsigned int n = (std::min)(frames, m_left[i]);
+            m_left[i] -= n;
+            if (m_left[i] > 0)
+            {
+                to = from + m_inc[i] * (float)n;
+                more = true;
+            }
+        }
+        else if (m_mode[i] == Smoothing::onePole)
+        {
+            const float rest =
+                (float)((from - to) * std::pow(m_pole[i], (double)frames));
+            if (std::abs(rest) > 1e-6f * (std::max)(1.0f, std::abs(to)))
+            {
+                to += rest;
+                more = true;
+            }
+        }
+        m_start[i] = from;
+        m_step[i] = frames > 0 ? (to - from) / (float)frames : 0.0f;
+        m_current[i] = to;
+        return more || from != to;
+    }
+
+  public:
+    // count parameters, all 0 with no smoothing until configure()d
+    params(size_t count, double samplerate)
+        : m_count(count), m_samplerate(samplerate),
+          m_groups((count + GROUP - 1) / GROUP), m_mode(count, Smoothing::none),
+          m_frames(count, 0.0f), m_pole(count, 0.0),
+          m_seen(m_groups.size(), 0), m_target(count, 0.0f),
+          m_current(count, 0.0f), m_start(count, 0.0f), m_step(count, 0.0f),
+          m_inc(count, 0.0f), m_left(count, 0), m_isMoving(count, false)
+    {
+        assert(samplerate > 0);
+        for (auto &g : m_groups)
+        {
+            for (auto &t : g.target)
+            {
+                t.store(0.0f, std::memory_order_relaxed);
+            }
+        }
+        m_moving.reserve(count);
+    }
+    params(const params &) = delete;
+    params &operator=(const params &) = delete;
+
+    size_t size() const noexcept { return m_count; }
+
+    // Before the audio thread starts: how parameter i moves towards its
+    // targets, over seconds, and where it starts. Throws
+    // std::runtime_error for a bad index.
+    void configure(size_t i, Smoothing mode, double seconds,
+                   float initial = 0.0f)
+    {
+        check(i, "configure");
+        m_mode[i] = mode;
+        m_frames[i] = (float)(seconds * m_samplerate);
+        m_pole[i] = m_frames[i] > 0 ? std::exp(-1.0 / m_frames[i]) : 0.0;
+        m_groups[i / GROUP].target[i % GROUP].store(initial);
+        m_target[i] = m_current[i] = m_start[i] = initial;
+        m_step[i] = 0.0f;
+    }
+
+    // Any thread. Out of range indices are ignored.
+    void set(size_t i, float target) noexcept
+    {
+        if (i >= m_count) return;
+        group &g = m_groups[i / GROUP];
+        g.target[i % GROUP].store(target, std::memory_order_relaxed);
+        g.generation.fetch_add(1, std::memory_order_release);
+        m_changed.fetch_add(1, std::memory_order_release);
+    }
+    // Any thread: the last target set.
+    float get(size_t i) const noexcept
+    {
+        if (i >= m_count) return 0.0f;
+        return m_groups[i / GROUP].target[i % GROUP].load(
+            std::memory_order_relaxed);
+    }
+
+    // Audio thread, once per block of frames, before reading any values.
+    void update(unsigned int frames) noexcept
+    {
+        pick_up_changes();
+        for (size_t k = 0; k < m_moving.size();)
+        {
+            const size_t i = m_moving[k];
+            if (advance(i, frames))
+            {
+                ++k;
+                continue;
+            }
+            m_isMoving[i] = false;
+            m_moving[k] = m_moving.back();
+            m_moving.pop_back();
+        }
+    }
+
+    // Audio thread, within the block: parameter i at frame 0, its change
+    // per frame, and at frame f.
+    float value(size_t i) const noexcept { return m_start[i]; }
+    float step(size_t i) const noexcept { return m_step[i]; }
+    float at(size_t i, unsigned int f) const noexcept
+    {
+        return m_start[i] + m_step[i] * (float)f;
+    }
+    bool moving(size_t i) const noexcept { return m_step[i] != 0.0f; }
+    // the values of parameter i across the block, one per frame
+    void ramp(size_t i, float *out, unsigned int frames) const noexcept
+    {
+        const float v = m_start[i], s = m_step[i];
+        for (unsigned int f = 0; f < frames; ++f)
+        {
+            out[f] = v + s * (float)f;
+        }
+    }
+};
+
+} // namespace audio
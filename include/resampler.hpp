@@ -0,0 +1,263 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+enum class ResamplerQuality
+{
+    fast,   // 16 taps: fine for monitoring
+    medium, // 32 taps
+    best    // 64 taps: transparent
+};
+
+// Streaming sample-rate converter: a windowed-sinc (Kaiser) low-pass
+// filter, precomputed at a few hundred fractional phases and linearly
+// interpolated between them, so any ratio works, rational or not, and the
+// ratio can be changed on the fly. The read position is kept in 32.32
+// fixed point, so it never drifts.
+//
+// It is pull driven: ask required_input() how many input frames the next
+// outFrames of output need, then hand exactly that many to process(). The
+// filter is centred on the output time (no group delay); the price is
+// that it looks latency() input frames ahead. Nothing allocates after
+// construction.
+class polyphase_resampler
+{
+  public:
+    // history kept beyond the filter length: bounds the input taken in one
+    // inner step, and so the largest usable ratio.
+    static constexpr unsigned int MAX_CHUNK_INPUT = 1024;
+
+  private:
+    unsigned int m_nch;
+    double m_ratio = 1; // input rate / output rate
+    uint64_t m_step = 0; // m_ratio in 32.32
+    unsigned int m_taps = 0;
+    unsigned int m_phases = 0;
+    std::vector<float> m_table; // (m_phases + 1) rows of m_taps
+    std::vector<float> m_coef;  // scratch: one interpolated row
+    std::vector<std::vector<float>> m_history; // per channel
+    size_t m_have = 0;  // frames in m_history
+    uint64_t m_pos = 0; // 32.32: first tap of the next output
+
+    static double bessel_i0(double x)
+    {
+        double sum = 1, term = 1;
+        for (int k = 1; k < 50; ++k)
+        {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+            if (term < sum * 1e-12) break;
+        }
+        return sum;
+    }
+
+    void design(ResamplerQuality q)
+    {
+        unsigned int taps = 32, phases = 256;
+        double beta = 8, cutoff = 0.9;
+        switch (q)
+        {
+        case ResamplerQuality::fast:
+            taps = 16;
+            phases = 128;
+            beta = 6;
+            cutoff = 0.85;
+            break;
+        case ResamplerQuality::best:
+            taps = 64;
+            phases = 512;
+            beta = 10;
+            cutoff = 0.95;
+            break;
+        case ResamplerQuality::medium:
+        default:
+            break;
+        }
+        // when going down in rate the filter must cut below the new
+        // Nyquist, and needs proportionally more taps to do it as well
+        if (m_ratio > 1)
+        {
+            cutoff /= m_ratio;
+            taps = (unsigned int)std::ceil(taps * m_ratio);
+        }
+        taps = (taps + 7) & ~7u; // a whole number of vector lanes
+        m_taps = taps;
+        m_phases = phases;
+        m_table.assign((size_t)(phases + 1) * taps, 0.0f);
+        m_coef.assign(taps, 0.0f);
+
+        const double half = taps / 2.0;
+        const double i0beta = bessel_i0(beta);
+        for (unsigned int p = 0; p <= phases; ++p)
+        {
+            float *row = &m_table[(size_t)p * taps];
+            double sum = 0;
+            std::vector<double> h(taps);
+            for (unsigned int k = 0; k < taps; ++k)
+            {
+                const double t = (half - 1) + (double)p / phases - k;
+                const double x = t / half;
+                if (std::fabs(x) >= 1) continue;
+                const double a = M_PI * cutoff * t;
+                const double sinc = a == 0 ? 1.0 : std::sin(a) / a;
+                h[k] = sinc * bessel_i0(beta * std::sqrt(1 - x * x)) / i0beta;
+                sum += h[k];
+            }
+            for (unsigned int k = 0; k < taps; ++k)
+            {
+                row[k] = (float)(h[k] / sum); // unity gain at DC
+            }
+        }
+    }
+
+    static float dot(const float *a, const float *b, unsigned int n) noexcept
+    {
+        // n is a multiple of 8: separate accumulators let this vectorise
+        // without reordering the additions behind our back
+        float acc[8] = {};
+        for (unsigned int i = 0; i < n; i += 8)
+        {
+            for (unsigned int j = 0; j < 8; ++j)
+            {
+                acc[j] += a[i + j] * b[i + j];
+            }
+        }
+        return ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+               ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    }
+
+    // drop the history that no output will look at again
+    void compact() noexcept
+    {
+        const size_t drop = (size_t)(m_pos >> 32);
+        if (drop == 0) return;
+        for (auto &h : m_history)
+        {
+            memmove(h.data(), h.data() + drop, (m_have - drop) * sizeof(float));
+        }
+        m_have -= drop;
+        m_pos -= (uint64_t)drop << 32;
+    }
+
+    size_t required(uint64_t pos, size_t have, unsigned int outFrames) const
+    {
+        if (outFrames == 0) return 0;
+        const size_t last =
+            (size_t)((pos + (uint64_t)(outFrames - 1) * m_step) >> 32);
+        const size_t need = last + m_taps;
+        return need > have ? need - have : 0;
+    }
+
+  public:
+    polyphase_resampler(unsigned int nch, double inRate, double outRate,
+                        ResamplerQuality q = ResamplerQuality::medium)
+        : m_nch(nch)
+    {
+        assert(nch > 0 && inRate > 0 && outRate > 0);
+        m_ratio = inRate / outRate;
+        design(q);
+        m_history.assign(nch, std::vector<float>(m_taps + MAX_CHUNK_INPUT));
+        ratio(m_ratio);
+        reset();
+    }
+
+    unsigned int channels() const noexcept { return m_nch; }
+    unsigned int taps() const noexcept { return m_taps; }
+    // how far ahead of the output time the filter reads, in input frames
+    unsigned int latency() const noexcept { return m_taps / 2; }
+
+    double ratio() const noexcept { return m_ratio; }
+    // Input rate / output rate. Can be changed between process() calls:
+    // the filter was designed for the ratio given to the constructor, so
+    // keep to small adjustments (e.g. clock drift) of that.
+    void ratio(double r) noexcept
+    {
+        assert(r > 0 && r < MAX_CHUNK_INPUT / 4);
+        m_ratio = r;
+        m_step = (uint64_t)std::llround(r * 4294967296.0);
+    }
+
+    // back to silence
+    void reset() noexcept
+    {
+        for (auto &h : m_history)
+        {
+            std::fill(h.begin(), h.end(), 0.0f);
+        }
+        // start with half a filter of silence, so the first output is
+        // centred on the first input frame
+        m_have = m_taps / 2 - 1;
+        m_pos = 0;
+    }
+
+    // The number of input frames process() will take to make outFrames.
+    size_t required_input(unsigned int outFrames) const noexcept
+    {
+        return required(m_pos, m_have, outFrames);
+    }
+
+    // Makes outFrames interleaved frames into out, taking exactly
+    // required_input(outFrames) interleaved frames from in.
+    void process(const float *in, float *out, unsigned int outFrames) noexcept
+    {
+        const unsigned int taps = m_taps;
+        const size_t capacity = m_history[0].size();
+        while (outFrames > 0)
+        {
+            compact();
+            // as many outputs as the history has room to feed
+            const uint64_t lastPos = (uint64_t)(capacity - taps) << 32;
+            unsigned int n = outFrames;
+            if (m_pos + (uint64_t)(n - 1) * m_step > lastPos)
+            {
+                n = (unsigned int)((lastPos - m_pos) / m_step) + 1;
+            }
+
+            const size_t take = required(m_pos, m_have, n);
+            for (unsigned int ch = 0; ch < m_nch; ++ch)
+            {
+                float *h = m_history[ch].data() + m_have;
+                for (size_t i = 0; i < take; ++i)
+                {
+                    h[i] = in[i * m_nch + ch];
+                }
+            }
+            in += take * m_nch;
+            m_have += take;
+
+            for (unsigned int j = 0; j < n; ++j)
+            {
+                const size_t ip = (size_t)(m_pos >> 32);
+                const uint64_t frac = (m_pos & 0xffffffffu) * m_phases;
+                const float *row0 = &m_table[(size_t)(frac >> 32) * taps];
+                const float *row1 = row0 + taps;
+                const float pf =
+                    (float)((double)(frac & 0xffffffffu) / 4294967296.0);
+                float *coef = m_coef.data();
+                for (unsigned int k = 0; k < taps; ++k)
+                {
+                    coef[k] = row0[k] + pf * (row1[k] - row0[k]);
+                }
+                for (unsigned int ch = 0; ch < m_nch; ++ch)
+                {
+                    *out++ = dot(m_history[ch].data() + ip, coef, taps);
+                }
+                m_pos += m_step;
+            }
+            outFrames -= n;
+        }
+    }
+};
+
+} // namespace dsp
+} // namespace audio
@@ -0,0 +1,204 @@
+#pragma once
+#include "samples.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+// Routes and mixes inputs() interleaved channels to outputs() interleaved
+// channels: output o is the sum over i of gain(i, o) * input i. The
+// matrix is kept dense for set() and get(), and compiled, on every set(),
+// into a sparse list of (input, gain) taps per output, so the cost is per
+// non-zero gain rather than per entry. process() works a block of frames
+// at a time: it converts and de-interleaves only the inputs that are used,
+// accumulates each output from its taps with unit-stride multiply-adds
+// (which vectorise), then converts and interleaves into the output type;
+// so format conversion costs no extra pass over the buffer. Not for use
+// by two threads at once: the block scratch is a member.
+class routing_matrix
+{
+    static constexpr unsigned int BLOCK = 64;
+
+    struct tap
+    {
+        unsigned int input;
+        float gain;
+    };
+
+    unsigned int m_inputs = 0;
+    unsigned int m_outputs = 0;
+    std::vector<float> m_gains;       // [input * outputs + output]
+    std::vector<tap> m_taps;          // grouped by output
+    std::vector<unsigned int> m_first; // outputs + 1: into m_taps
+    std::vector<unsigned int> m_used;  // inputs with any tap
+    std::vector<float> m_planar;      // BLOCK per input
+    std::vector<float> m_acc;         // BLOCK
+
+    void compile()
+    {
+        m_taps.clear();
+        m_first.assign(1, 0);
+        std::vector<bool> used(m_inputs, false);
+        for (unsigned int o = 0; o < m_outputs; ++o)
+        {
+            for (unsigned int i = 0; i < m_inputs; ++i)
+            {
+                const float g = m_gains[(size_t)i * m_outputs + o];
+                if (g == 0.0f) continue;
+                m_taps.push_back(tap{i, g});
+                used[i] = true;
+            }
+            m_first.push_back((unsigned int)m_taps.size());
+        }
+        m_used.clear();
+        for (unsigned int i = 0; i < m_inputs; ++i)
+        {
+            if (used[i]) m_used.push_back(i);
+        }
+    }
+
+    void check(unsigned int input, unsigned int output, const char *what) const
+    {
+        if (input >= m_inputs || output >= m_outputs)
+        {
+            throw std::runtime_error(
+                std::string("routing_matrix::") + what + ": no route from " +
+                std::to_string(input) + " to " + std::to_string(output) +
+                " in a " + std::to_string(m_inputs) + "x" +
+                std::to_string(m_outputs) + " matrix");
+        }
+    }
+
+  public:
+    // an empty matrix: no routing at all
+    routing_matrix() = default;
+    // inputs x outputs, all gains zero
+    routing_matrix(unsigned int inputs, unsigned int outputs)
+        : m_inputs(inputs), m_outputs(outputs),
+          m_gains((size_t)inputs * outputs, 0.0f),
+          m_planar((size_t)inputs * BLOCK), m_acc(BLOCK)
+    {
+        compile();
+    }
+
+    // channel n to channel n
+    static routing_matrix identity(unsigned int nch)
+    {
+        routing_matrix m(nch, nch);
+        for (unsigned int c = 0; c < nch; ++c)
+        {
+            m.set(c, c, 1.0f);
+        }
+        return m;
+    }
+    // one channel to every one of nch
+    static routing_matrix mono_to(unsigned int nch, float gain = 1.0f)
+    {
+        routing_matrix m(1, nch);
+        for (unsigned int c = 0; c < nch; ++c)
+        {
+            m.set(0, c, gain);
+        }
+        return m;
+    }
+    // 5.1 (L R C LFE Ls Rs, as in WAV files) to stereo, ITU-R BS.775:
+    // centre and surrounds at -3dB, LFE dropped. Can clip at full scale.
+    static routing_matrix downmix_5_1()
+    {
+        const float m3db = 0.70710678f;
+        routing_matrix m(6, 2);
+        m.set(0, 0, 1.0f);
+        m.set(1, 1, 1.0f);
+        m.set(2, 0, m3db);
+        m.set(2, 1, m3db);
+        m.set(4, 0, m3db);
+        m.set(5, 1, m3db);
+        return m;
+    }
+
+    unsigned int inputs() const noexcept { return m_inputs; }
+    unsigned int outputs() const noexcept { return m_outputs; }
+    bool empty() const noexcept { return m_outputs == 0; }
+    // non-zero gains
+    size_t taps() const noexcept { return m_taps.size(); }
+
+    // Not while process() runs. Throws std::runtime_error out of range.
+    void set(unsigned int input, unsigned int output, float gain)
+    {
+        check(input, output, "set");
+        m_gains[(size_t)input * m_outputs + output] = gain;
+        compile();
+    }
+    float get(unsigned int input, unsigned int output) const
+    {
+        check(input, output, "get");
+        return m_gains[(size_t)input * m_outputs + output];
+    }
+
+    // frames of inputs() interleaved In samples to frames of outputs()
+    // interleaved Out samples. in and out must not overlap.
+    template <typename In, typename Out>
+    void process(const In *in, Out *out, size_t frames) noexcept
+    {
+        const unsigned int nin = m_inputs, nout = m_outputs;
+        for (size_t start = 0; start < frames; start += BLOCK)
+        {
+            const size_t n = (std::min)((size_t)BLOCK, frames - start);
+            const In *src = in + start * nin;
+            for (unsigned int i : m_used)
+            {
+                float *AUDIO_RESTRICT x = m_planar.data() + (size_t)i * BLOCK;
+                for (size_t f = 0; f < n; ++f)
+                {
+                    x[f] = to_float(src[f * nin + i]);
+                }
+            }
+            Out *dst = out + start * nout;
+            for (unsigned int o = 0; o < nout; ++o)
+            {
+                float *AUDIO_RESTRICT acc = m_acc.data();
+                const unsigned int t0 = m_first[o], t1 = m_first[o + 1];
+                if (t0 == t1)
+                {
+                    for (size_t f = 0; f < n; ++f)
+                    {
+                        dst[f * nout + o] = from_float<Out>(0.0f);
+                    }
+                    continue;
+                }
+                {
+                    const float g = m_taps[t0].gain;
+                    const float *AUDIO_RESTRICT x =
+                        m_planar.data() + (size_t)m_taps[t0].input * BLOCK;
+                    for (size_t f = 0; f < n; ++f)
+                    {
+                        acc[f] = g * x[f];
+                    }
+                }
+                for (unsigned int t = t0 + 1; t < t1; ++t)
+                {
+                    const float g = m_taps[t].gain;
+                    const float *AUDIO_RESTRICT x =
+                        m_planar.data() + (size_t)m_taps[t].input * BLOCK;
+                    for (size_t f = 0; f < n; ++f)
+                    {
+                        acc[f] += g * x[f];
+                    }
+                }
+                for (size_t f = 0; f < n; ++f)
+                {
+                    dst[f * nout + o] = from_float<Out>(acc[f]);
+                }
+            }
+        }
+    }
+};
+
+} // namespace dsp
+} // namespace audio
@@ -0,0 +1,125 @@
+#pragma once
+#include "../rtAudio/RtAudio.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+// restrict-qualified pointers, for loops the compiler should vectorise
+#ifndef AUDIO_RESTRICT
+#if defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__)
+#define AUDIO_RESTRICT __restrict
+#else
+#define AUDIO_RESTRICT
+#endif
+#endif
+
+namespace audio
+{
+namespace dsp
+{
+
+namespace detail
+{
+// saturate, then round half away from zero, as lround() would; but
+// with no library call, so loops of conversions vectorise
+template <typename I, typename F> inline I round_clip(F v, F max) noexcept
+{
+    v = v > max ? max : (v < -max - 1 ? -max - 1 : v);
+    return (I)(v + std::copysign(F(0.5), v));
+}
+} // namespace detail
+
+// float [-1, 1] to a device sample, with the same full-scale convention as
+// RtAudio's own conversions: x * 2^(bits - 1), clipped.
+template <typename T> inline T from_float(float x) noexcept;
+template <> inline float from_float<float>(float x) noexcept { return x; }
+template <> inline double from_float<double>(float x) noexcept
+{
+    return x;
+}
+template <> inline int8_t from_float<int8_t>(float x) noexcept
+{
+    return detail::round_clip<int8_t>(x * 128.f, 127.f);
+}
+template <> inline int16_t from_float<int16_t>(float x) noexcept
+{
+    return detail::round_clip<int16_t>(x * 32768.f, 32767.f);
+}
+template <> inline S24 from_float<S24>(float x) noexcept
+{
+    return S24((double)detail::round_clip<int32_t>(x * 8388608.f, 8388607.f));
+}
+template <> inline int32_t from_float<int32_t>(float x) noexcept
+{
+    return detail::round_clip<int32_t>((double)x * 2147483648.0,
+                                       2147483647.0);
+}
+
+// and back again
+template <typename T> inline float to_float(T x) noexcept;
+template <> inline float to_float<float>(float x) noexcept { return x; }
+template <> inline float to_float<double>(double x) noexcept
+{
+    return (float)x;
+}
+template <> inline float to_float<int8_t>(int8_t x) noexcept
+{
+    return x * (1.0f / 128.f);
+}
+template <> inline float to_float<int16_t>(int16_t x) noexcept
+{
+    return x * (1.0f / 32768.f);
+}
+template <> inline float to_float<S24>(S24 x) noexcept
+{
+    return (float)x.asInt() * (1.0f / 8388608.f);
+}
+template <> inline float to_float<int32_t>(int32_t x) noexcept
+{
+    return (float)((double)x * (1.0 / 2147483648.0));
+}
+
+// n samples, converted
+template <typename T>
+inline void to_float(const T *src, float *dst, size_t n) noexcept
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        dst[i] = to_float<T>(src[i]);
+    }
+}
+template <typename T>
+inline void from_float(const float *src, T *dst, size_t n) noexcept
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        dst[i] = from_float<T>(src[i]);
+    }
+}
+
+// the most channels to_float_frames() takes: it converts at least a whole
+// frame at a time, through a buffer of this many samples on the stack
+constexpr unsigned int MAX_CONVERT_CHANNELS = 1024;
+
+// frames of nch interleaved channels, converted a buffer at a time, each
+// piece handed on as sink(const float *, unsigned int frames)
+template <typename T, typename Sink>
+inline void to_float_frames(const T *src, unsigned int frames,
+                            unsigned int nch, Sink &&sink) noexcept
+{
+    assert(nch > 0 && nch <= MAX_CONVERT_CHANNELS);
+    float buf[MAX_CONVERT_CHANNELS];
+    const unsigned int per = MAX_CONVERT_CHANNELS / nch;
+    while (frames > 0)
+    {
+        const unsigned int n = (std::min)(frames, per);
+        to_float(src, buf, (size_t)n * nch);
+        sink(buf, n);
+        src += (size_t)n * nch;
+        frames -= n;
+    }
+}
+
+} // namespace dsp
+} // namespace audio
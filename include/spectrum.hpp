@@ -0,0 +1,338 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include "fft.hpp"
+#include "lockfree.hpp"
+#include "samples.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace audio
+{
+namespace dsp
+{
+
+enum class Window
+{
+    rectangular,
+    hann,
+    hamming,
+    blackmanHarris // 4 term: -92dB sidelobes
+};
+
+namespace detail
+{
+inline std::vector<float> make_window(Window w, unsigned int n)
+{
+    std::vector<float> v(n);
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        const double x = 2.0 * M_PI * i / n; // periodic
+        switch (w)
+        {
+        case Window::hann:
+            v[i] = (float)(0.5 - 0.5 * std::cos(x));
+            break;
+        case Window::hamming:
+            v[i] = (float)(0.54 - 0.46 * std::cos(x));
+            break;
+        case Window::blackmanHarris:
+            v[i] = (float)(0.35875 - 0.48829 * std::cos(x) +
+                           0.14128 * std::cos(2 * x) -
+                           0.01168 * std::cos(3 * x));
+            break;
+        case Window::rectangular:
+        default:
+            v[i] = 1.0f;
+            break;
+        }
+    }
+    return v;
+}
+
+// Windows, transforms and accumulates the power spectrum of one frame.
+// The scaling makes a full-scale sine centred on a bin read 1.0.
+class power_spectrum
+{
+    real_fft m_fft;
+    std::vector<float> m_window;
+    std::vector<float> m_frame, m_re, m_im;
+    float m_scale; // applied to magnitudes
+
+  public:
+    power_spectrum(unsigned int size, Window w)
+        : m_fft(size), m_window(make_window(w, size)), m_frame(size),
+          m_re(m_fft.bins()), m_im(m_fft.bins())
+    {
+        double sum = 0;
+        for (float x : m_window)
+        {
+            sum += x;
+        }
+        m_scale = (float)(2.0 / sum);
+    }
+
+    unsigned int size() const noexcept { return m_fft.size(); }
+    unsigned int bins() const noexcept { return m_fft.bins(); }
+
+    // power[k] = a * power[k] + b * |X[k]|^2, over size() samples
+    // spaced stride apart
+    template <typename T>
+    void accumulate(const T *in, size_t stride, float *power, float a,
+                    float b) noexcept
+    {
+        const unsigned int n = m_fft.size();
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            m_frame[i] = to_float(in[i * stride]) * m_window[i];
+        }
+        m_fft.forward(m_frame.data(), m_re.data(), m_im.data());
+        // DC and Nyquist have no negative-frequency twin to add in
+        const unsigned int bins = m_fft.bins();
+        m_re[0] *= 0.5f;
+        m_re[bins - 1] *= 0.5f;
+        m_im[bins - 1] *= 0.5f;
+        const float s2 = m_scale * m_scale;
+        for (unsigned int k = 0; k < bins; ++k)
+        {
+            const float p = (m_re[k] * m_re[k] + m_im[k] * m_im[k]) * s2;
+            power[k] = a * power[k] + b * p;
+        }
+    }
+};
+} // namespace detail
+
+struct SpectrumConfig
+{
+    unsigned int fftSize = 2048;
+    double overlap = 0.5;        // of one frame by the next: [0, 1)
+    Window window = Window::hann;
+    double averagingSecs = 0.1;  // exponential; 0 for none
+    double updateRate = 30;      // spectra published per second, at most
+    double ringSeconds = 0.5;    // queued between analysis passes
+};
+
+// The latest from a spectrum engine: per channel magnitudes, bins() of
+// them each, linear, where 1.0 is a full-scale sine.
+struct SpectrumReadings
+{
+    std::vector<std::vector<float>> magnitude;
+    uint64_t frames = 0;        // analysed so far
+    uint64_t droppedFrames = 0; // the callback found the queue full
+};
+
+// A real-time spectrum analyser, built like loudness_meter: the audio
+// callback push()es interleaved frames onto a lock-free ring, an analysis
+// thread (or a caller of process()) windows overlapping frames, takes
+// their FFTs and averages the power, and publishes per channel magnitude
+// spectra through a triple buffer for one reader thread. Nothing
+// allocates after construction.
+class spectrum
+{
+    const unsigned int m_nch;
+    const double m_samplerate;
+    detail::power_spectrum m_ps;
+    const unsigned int m_hop;
+    unsigned int m_hopsPerUpdate;
+    float m_keep; // averaging: the weight of the previous power
+    lockfree::spsc_ring<float> m_ring;
+    std::atomic<uint64_t> m_dropped{0};
+    lockfree::triple_buffer<SpectrumReadings> m_published;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+
+    // analysis thread
+    std::vector<float> m_frames; // fftSize interleaved frames
+    unsigned int m_fill = 0;
+    std::vector<float> m_power; // per channel, bins() each
+    unsigned int m_hops = 0;
+    bool m_first = true;
+    uint64_t m_analysed = 0;
+
+    void analyse() noexcept
+    {
+        const unsigned int bins = m_ps.bins();
+        const float a = m_first ? 0.0f : m_keep;
+        m_first = false;
+        for (unsigned int ch = 0; ch < m_nch; ++ch)
+        {
+            m_ps.accumulate(m_frames.data() + ch, m_nch,
+                            m_power.data() + (size_t)ch * bins, a, 1 - a);
+        }
+        if (++m_hops < m_hopsPerUpdate) return;
+        m_hops = 0;
+        SpectrumReadings &r = m_published.back();
+        for (unsigned int ch = 0; ch < m_nch; ++ch)
+        {
+            const float *p = m_power.data() + (size_t)ch * bins;
+            float *m = r.magnitude[ch].data();
+            for (unsigned int k = 0; k < bins; ++k)
+            {
+                m[k] = std::sqrt(p[k]);
+            }
+        }
+        r.frames = m_analysed;
+        r.droppedFrames = m_dropped.load(std::memory_order_relaxed);
+        m_published.publish();
+    }
+
+  public:
+    // Throws std::runtime_error for more than MAX_CONVERT_CHANNELS channels
+    // or an overlap outside [0, 1).
+    spectrum(unsigned int nch, double samplerate,
+             const SpectrumConfig &config = SpectrumConfig())
+        : m_nch(nch), m_samplerate(samplerate),
+          m_ps(config.fftSize, config.window),
+          m_hop((std::max)(1u, (unsigned int)std::lround(
+                                   config.fftSize * (1 - config.overlap)))),
+          m_ring((size_t)(config.ringSeconds * samplerate) * nch),
+          m_published(SpectrumReadings{std::vector<std::vector<float>>(
+              nch, std::vector<float>(config.fftSize / 2 + 1))}),
+          m_frames((size_t)config.fftSize * nch),
+          m_power((size_t)(config.fftSize / 2 + 1) * nch)
+    {
+        assert(nch > 0 && samplerate > 0);
+        if (nch > MAX_CONVERT_CHANNELS)
+        {
+            // see to_float_frames()
+            throw std::runtime_error("spectrum: too many channels");
+        }
+        if (config.overlap < 0 || config.overlap >= 1)
+        {
+            throw std::runtime_error("spectrum: overlap must be in [0, 1)");
+        }
+        const double hopSecs = m_hop / samplerate;
+        m_hopsPerUpdate = config.updateRate > 0
+            ? (std::max)(1u, (unsigned int)std::ceil(
+                                 1.0 / (config.updateRate * hopSecs)))
+            : 1u;
+        m_keep = config.averagingSecs > 0
+            ? (float)std::exp(-hopSecs / config.averagingSecs)
+            : 0.0f;
+    }
+    spectrum(const spectrum &) = delete;
+    spectrum &operator=(const spectrum &) = delete;
+    ~spectrum() { stop(); }
+
+    unsigned int channels() const noexcept { return m_nch; }
+    unsigned int fftSize() const noexcept { return m_ps.size(); }
+    unsigned int bins() const noexcept { return m_ps.bins(); }
+    double binFrequency(unsigned int k) const noexcept
+    {
+        return k * m_samplerate / m_ps.size();
+    }
+
+    // Audio callback: queue frames of interleaved samples. Never blocks;
+    // what does not fit is dropped (and counted).
+    void push(const float *interleaved, unsigned int frames) noexcept
+    {
+        const size_t n = (size_t)frames * m_nch;
+        const size_t pushed = m_ring.push(
+            interleaved, (std::min)(n, m_ring.capacity() - m_ring.size()) /
+                             m_nch * m_nch);
+        if (pushed < n)
+        {
+            m_dropped.fetch_add((n - pushed) / m_nch,
+                                std::memory_order_relaxed);
+        }
+    }
+    template <typename T>
+    void push(const T *interleaved, unsigned int frames) noexcept
+    {
+        to_float_frames(interleaved, frames, m_nch,
+                        [this](const float *f, unsigned int n) { push(f, n); });
+    }
+
+    // Analysis thread: everything queued so far.
+    void process() noexcept
+    {
+        const unsigned int size = m_ps.size();
+        for (;;)
+        {
+            const size_t got =
+                m_ring.pop(m_frames.data() + (size_t)m_fill * m_nch,
+                           (size_t)(size - m_fill) * m_nch) /
+                m_nch;
+            if (got == 0) return;
+            m_fill += (unsigned int)got;
+            m_analysed += got;
+            if (m_fill < size) continue;
+            analyse();
+            if (m_hop < size)
+            {
+                float *f = m_frames.data();
+                memmove(f, f + (size_t)m_hop * m_nch,
+                        (size_t)(size - m_hop) * m_nch * sizeof(float));
+                m_fill = size - m_hop;
+            }
+            else
+            {
+                m_fill = 0;
+            }
+        }
+    }
+
+    void start()
+    {
+        if (m_running) return;
+        m_running = true;
+        m_thread = std::thread([this] {
+            while (m_running)
+            {
+                process();
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+    }
+    void stop()
+    {
+        m_running = false;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    // Reader thread (one only): the latest spectra.
+    const SpectrumReadings &readings() noexcept { return m_published.read(); }
+};
+
+// Offline: the average magnitude spectrum (Welch's method) of each channel
+// of a planar buffer, such as an AudioFile<T>'s samples. Channels shorter
+// than one frame give all zeros.
+template <typename T>
+std::vector<std::vector<float>>
+average_spectrum(const std::vector<std::vector<T>> &channels,
+                 unsigned int fftSize = 4096, double overlap = 0.5,
+                 Window window = Window::hann)
+{
+    detail::power_spectrum ps(fftSize, window);
+    const size_t hop = (std::max)(
+        (size_t)1, (size_t)std::lround(fftSize * (1 - overlap)));
+    std::vector<std::vector<float>> result;
+    for (const auto &x : channels)
+    {
+        std::vector<float> power(ps.bins(), 0.0f);
+        size_t frames = 0;
+        for (size_t start = 0; start + fftSize <= x.size(); start += hop)
+        {
+            ++frames;
+            // running mean
+            ps.accumulate(x.data() + start, 1, power.data(),
+                          1.0f - 1.0f / frames, 1.0f / frames);
+        }
+        for (float &p : power)
+        {
+            p = std::sqrt(p);
+        }
+        result.push_back(std::move(power));
+    }
+    return result;
+}
+
+} // namespace dsp
+} // namespace audio
@@ -0,0 +1,187 @@
+#pragma once
+#include "../rtAudio/RtAudio.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace audio
+{
+
+// A point-in-time copy of a Stream's callback statistics. Durations are in
+// nanoseconds of wall (monotonic) time spent inside the callback.
+struct StreamStats
+{
+    static constexpr unsigned int HISTOGRAM_BUCKETS = 32;
+
+    uint64_t callbackCount = 0;
+    uint64_t minNanos = 0;
+    uint64_t meanNanos = 0;
+    uint64_t p99Nanos = 0; // upper edge of the bucket holding the 99th pct.
+    uint64_t maxNanos = 0;
+    double dspLoad = 0;     // total callback time / total buffer time
+    double peakDspLoad = 0; // the worst single callback, same measure
+    // the running totals behind dspLoad: subtract two snapshots to get the
+    // load over just that interval.
+    uint64_t busyNanos = 0;
+    uint64_t periodNanos = 0;
+    // bucket i counts callbacks that took [2^i, 2^(i+1)) nanoseconds
+    std::array<uint64_t, HISTOGRAM_BUCKETS> histogram{};
+    uint64_t inputOverflows = 0;
+    uint64_t outputUnderflows = 0;
+    // std::chrono::steady_clock (CLOCK_MONOTONIC on linux) time of the most
+    // recent xrun, in nanoseconds. Zero if there has never been one.
+    int64_t lastXrunNanos = 0;
+    double lastXrunStreamTime = 0;
+};
+
+namespace detail
+{
+
+static inline unsigned int log2_bucket(uint64_t v) noexcept
+{
+    if (v == 0) return 0;
+#if defined(__GNUC__) || defined(__clang__)
+    const unsigned int b = 63u - (unsigned int)__builtin_clzll(v);
+#else
+    unsigned int b = 0;
+    while (v >>= 1)
+        ++b;
+#endif
+    return b < StreamStats::HISTOGRAM_BUCKETS
+               ? b
+               : StreamStats::HISTOGRAM_BUCKETS - 1;
+}
+
+// Written only by the audio thread, read by anyone. A sequence counter
+// (seqlock) lets readers take a consistent snapshot without ever making
+// the writer wait: the writer only does relaxed stores and two counter
+// bumps per callback.
+class StatsRecorder
+{
+    using clock = std::chrono::steady_clock;
+
+    std::atomic<uint64_t> m_seq{0};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_min{(std::numeric_limits<uint64_t>::max)()};
+    std::atomic<uint64_t> m_max{0};
+    std::atomic<uint64_t> m_sumNanos{0};
+    std::atomic<uint64_t> m_sumPeriodNanos{0};
+    std::atomic<double> m_peakLoad{0};
+    std::array<std::atomic<uint64_t>, StreamStats::HISTOGRAM_BUCKETS>
+        m_histogram{};
+    std::atomic<uint64_t> m_inputOverflows{0};
+    std::atomic<uint64_t> m_outputUnderflows{0};
+    std::atomic<int64_t> m_lastXrunNanos{0};
+    std::atomic<double> m_lastXrunStreamTime{0};
+
+    template <typename T>
+    static void bump(std::atomic<T> &v, T by = 1) noexcept
+    {
+        v.store(v.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+    }
+
+  public:
+    StatsRecorder() = default;
+    StatsRecorder(const StatsRecorder &) = delete;
+    StatsRecorder &operator=(const StatsRecorder &) = delete;
+
+    static clock::time_point now() noexcept { return clock::now(); }
+
+    // audio thread only
+    void Record(clock::time_point start, clock::time_point end,
+                unsigned int frames, unsigned int sampleRate,
+                RtAudioStreamStatus status, double streamTime) noexcept
+    {
+        using namespace std::chrono;
+        const auto o = std::memory_order_relaxed;
+        const uint64_t ns =
+            (uint64_t)duration_cast<nanoseconds>(end - start).count();
+        const uint64_t periodNs =
+            sampleRate ? (uint64_t)frames * 1000000000ull / sampleRate : 0;
+
+        const uint64_t seq = m_seq.load(o);
+        m_seq.store(seq + 1, o);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        bump(m_count);
+        if (ns < m_min.load(o)) m_min.store(ns, o);
+        if (ns > m_max.load(o)) m_max.store(ns, o);
+        bump(m_sumNanos, ns);
+        bump(m_sumPeriodNanos, periodNs);
+        if (periodNs)
+        {
+            const double load = (double)ns / (double)periodNs;
+            if (load > m_peakLoad.load(o)) m_peakLoad.store(load, o);
+        }
+        bump(m_histogram[log2_bucket(ns)]);
+        if (status)
+        {
+            if (status & RTAUDIO_INPUT_OVERFLOW) bump(m_inputOverflows);
+            if (status & RTAUDIO_OUTPUT_UNDERFLOW) bump(m_outputUnderflows);
+            m_lastXrunNanos.store(
+                (int64_t)duration_cast<nanoseconds>(start.time_since_epoch())
+                    .count(),
+                o);
+            m_lastXrunStreamTime.store(streamTime, o);
+        }
+
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // any thread. Retries (briefly) if it raced with the audio thread.
+    StreamStats Snapshot() const noexcept
+    {
+        const auto o = std::memory_order_relaxed;
+        StreamStats s;
+        for (;;)
+        {
+            const uint64_t seq = m_seq.load(std::memory_order_acquire);
+            if (seq & 1) continue;
+            s.callbackCount = m_count.load(o);
+            s.minNanos = m_min.load(o);
+            s.maxNanos = m_max.load(o);
+            s.busyNanos = m_sumNanos.load(o);
+            s.periodNanos = m_sumPeriodNanos.load(o);
+            s.peakDspLoad = m_peakLoad.load(o);
+            for (unsigned int i = 0; i < StreamStats::HISTOGRAM_BUCKETS; ++i)
+            {
+                s.histogram[i] = m_histogram[i].load(o);
+            }
+            s.inputOverflows = m_inputOverflows.load(o);
+            s.outputUnderflows = m_outputUnderflows.load(o);
+            s.lastXrunNanos = m_lastXrunNanos.load(o);
+            s.lastXrunStreamTime = m_lastXrunStreamTime.load(o);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(o) == seq) break;
+        }
+
+        if (s.callbackCount == 0)
+        {
+            s.minNanos = 0;
+            return s;
+        }
+        s.meanNanos = s.busyNanos / s.callbackCount;
+        if (s.periodNanos) s.dspLoad = (double)s.busyNanos / s.periodNanos;
+
+        const uint64_t p99Count = s.callbackCount - s.callbackCount / 100;
+        uint64_t cumulative = 0;
+        for (unsigned int i = 0; i < StreamStats::HISTOGRAM_BUCKETS; ++i)
+        {
+            cumulative += s.histogram[i];
+            if (cumulative >= p99Count)
+            {
+                const uint64_t upper = 2ull << i;
+                s.p99Nanos = (std::min)(upper, s.maxNanos);
+                break;
+            }
+        }
+        return s;
+    }
+};
+
+} // namespace detail
+} // namespace audio
@@ -0,0 +1,235 @@
+#pragma once
+#include "events.hpp"
+#include "faderbank.hpp"
+#include "myaudio.hpp"
+#include "samples.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace audio
+{
+
+// Switches one open stream between any number of sources (file players,
+// live inputs, generators: each an AudioCallback rendering interleaved
+// float frames), crossfading with an equal-power law. A switch is
+// scheduled for an exact stream frame through an EventQueue, so the
+// callback is split there and the fade starts on that frame. Only the
+// source playing (and, during a fade, the one fading in) is called;
+// the rest are parked and cost nothing. The fade gains come from the
+// fader_bank curve tables, a block at a time, and the mix is one
+// unit-stride multiply-add pass.
+//
+// add() is for the control thread, before the stream starts; switch_to()
+// is for any thread; process() and OnAudioCallback() for one audio thread.
+class switcher : public AudioCallback
+{
+    static constexpr int NONE = -1;
+    using curve_tables = dsp::detail::fade_curve_tables;
+
+    const unsigned int m_nch;
+    const unsigned int m_maxFrames;
+    const unsigned int m_samplerate;
+    const curve_tables &m_tables;
+    std::vector<std::shared_ptr<AudioCallback>> m_sources;
+    EventQueue m_events;
+    std::atomic<int> m_playing{NONE}; // published for other threads
+
+    // audio thread
+    int m_active = NONE;
+    int m_incoming = NONE;
+    unsigned int m_fadeFrames = 0;
+    unsigned int m_fadePos = 0;
+    std::vector<float> m_a, m_b, m_gainIn, m_gainOut;
+    std::vector<float> m_scratch; // OnAudioCallback, for other formats
+
+    void start_switch(const StreamEvent &e) noexcept
+    {
+        const int to = (int)e.target;
+        if (to >= (int)m_sources.size()) return;
+        // a switch during a fade lands the fade first
+        if (m_incoming != NONE) m_active = m_incoming;
+        m_incoming = NONE;
+        if (to == m_active) return;
+        const unsigned int frames = (unsigned int)e.value;
+        if (frames == 0 || m_active == NONE)
+        {
+            m_active = to;
+        }
+        else
+        {
+            m_incoming = to;
+            m_fadeFrames = frames;
+            m_fadePos = 0;
+        }
+        m_playing.store(to, std::memory_order_relaxed);
+    }
+
+    void render_source(int idx, float *out, unsigned int frames,
+                       double streamTime) noexcept
+    {
+        if (idx == NONE)
+        {
+            std::fill(out, out + (size_t)frames * m_nch, 0.0f);
+            return;
+        }
+        StreamCallbackInfo info{out, nullptr, frames, streamTime};
+        info.format = m_sources[idx]->format;
+        m_sources[idx]->OnAudioCallback(info);
+    }
+
+    // at most m_maxFrames, and within one fade
+    void render(float *out, unsigned int frames, double streamTime) noexcept
+    {
+        if (m_incoming == NONE)
+        {
+            render_source(m_active, out, frames, streamTime);
+            return;
+        }
+        render_source(m_active, m_a.data(), frames, streamTime);
+        render_source(m_incoming, m_b.data(), frames, streamTime);
+        const int rising =
+            curve_tables::index(dsp::FadeCurve::equalPower, false);
+        const int falling =
+            curve_tables::index(dsp::FadeCurve::equalPower, true);
+        float *AUDIO_RESTRICT gi = m_gainIn.data();
+        float *AUDIO_RESTRICT go = m_gainOut.data();
+        const float inc = 1.0f / (float)m_fadeFrames;
+        for (unsigned int f = 0; f < frames; ++f)
+        {
+            const float p = (float)(m_fadePos + f) * inc;
+            gi[f] = m_tables.lookup(rising, p);        // sin
+            go[f] = 1.0f - m_tables.lookup(falling, p); // cos
+        }
+        const float *AUDIO_RESTRICT a = m_a.data();
+        const float *AUDIO_RESTRICT b = m_b.data();
+        float *AUDIO_RESTRICT o = out;
+        if (m_nch == 2)
+        {
+            for (unsigned int f = 0; f < frames; ++f)
+            {
+                o[2 * f] = a[2 * f] * go[f] + b[2 * f] * gi[f];
+                o[2 * f + 1] = a[2 * f + 1] * go[f] + b[2 * f + 1] * gi[f];
+            }
+        }
+        else
+        {
+            for (unsigned int f = 0; f < frames; ++f)
+            {
+                for (unsigned int c = 0; c < m_nch; ++c)
+                {
+                    const size_t j = (size_t)f * m_nch + c;
+                    o[j] = a[j] * go[f] + b[j] * gi[f];
+                }
+            }
+        }
+        m_fadePos += frames;
+        if (m_fadePos >= m_fadeFrames)
+        {
+            m_active = m_incoming;
+            m_incoming = NONE;
+        }
+    }
+
+  public:
+    switcher(unsigned int nch, unsigned int samplerate,
+             unsigned int maxFrames = 1024, size_t maxPending = 64)
+        : m_nch(nch), m_maxFrames(maxFrames), m_samplerate(samplerate),
+          m_tables(curve_tables::get()), m_events(maxPending),
+          m_a((size_t)nch * maxFrames), m_b((size_t)nch * maxFrames),
+          m_gainIn(maxFrames), m_gainOut(maxFrames),
+          m_scratch((size_t)nch * maxFrames)
+    {
+        assert(nch > 0 && samplerate > 0 && maxFrames > 0);
+    }
+
+    // Control thread, before the stream starts. The source is given the
+    // switcher's channels and rate, as FLOAT32. The first one added plays
+    // until the first switch. Returns its index.
+    unsigned int add(std::shared_ptr<AudioCallback> source)
+    {
+        if (!source)
+        {
+            throw std::runtime_error("switcher::add: no source");
+        }
+        source->format.Format = AudioFormat::FLOAT32;
+        source->format.Channels = m_nch;
+        source->format.SamplesPerSec = m_samplerate;
+        m_sources.push_back(std::move(source));
+        if (m_active == NONE)
+        {
+            m_active = 0;
+            m_playing = 0;
+        }
+        return (unsigned int)m_sources.size() - 1;
+    }
+    size_t size() const noexcept { return m_sources.size(); }
+
+    // Any thread: from stream frame atFrame on, crossfade to source over
+    // fadeFrames (0 cuts). A frame already played means as soon as
+    // possible. False if too many switches are pending.
+    bool switch_to(unsigned int source, uint64_t atFrame,
+                   unsigned int fadeFrames)
+    {
+        if (source >= m_sources.size())
+        {
+            throw std::runtime_error("switcher::switch_to: no source " +
+                                     std::to_string(source));
+        }
+        return m_events.Post(
+            StreamEvent{atFrame, source, (float)fadeFrames});
+    }
+
+    // Any thread: the source playing, or fading in; -1 for none.
+    int playing() const noexcept
+    {
+        return m_playing.load(std::memory_order_relaxed);
+    }
+    // switches that came in after their frame had played
+    uint64_t late() const noexcept { return m_events.Late(); }
+
+    // Audio thread: frames interleaved float frames, the first of which
+    // is stream frame firstFrame.
+    void process(float *out, unsigned int frames,
+                 uint64_t firstFrame) noexcept
+    {
+        m_events.Process(
+            firstFrame, frames,
+            [this](const StreamEvent &e) { start_switch(e); },
+            [&](unsigned int offset, unsigned int n) {
+                while (n > 0)
+                {
+                    unsigned int k = (std::min)(n, m_maxFrames);
+                    if (m_incoming != NONE)
+                    {
+                        k = (std::min)(k, m_fadeFrames - m_fadePos);
+                    }
+                    render(out + (size_t)offset * m_nch, k,
+                           (double)(firstFrame + offset) / m_samplerate);
+                    offset += k;
+                    n -= k;
+                }
+            });
+    }
+
+    // As a stream's callback, in whatever format the stream runs.
+    int OnAudioCallback(const StreamCallbackInfo &info) override
+    {
+        assert(info.format.Channels == m_nch);
+        uint64_t frame = (uint64_t)std::llround(info.streamTime *
+                                                info.format.SamplesPerSec);
+        auto render = [this, &frame](float *out, unsigned int n) {
+            process(out, n, frame);
+            frame += n;
+        };
+        detail::render_float(info, m_scratch, render);
+        return 0;
+    }
+};
+
+} // namespace audio
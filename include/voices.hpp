@@ -0,0 +1,443 @@
+#pragma once
+#include "audiofile.hpp"
+#include "lockfree.hpp"
+#include "myaudio.hpp"
+#include "samples.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace audio
+{
+
+// A polyphonic sample player: a fixed pool of voices, each playing one
+// sample at a pitch ratio with a linear attack / sustain / release
+// envelope, mixed into interleaved float frames.
+//
+// Samples are added before the stream starts, either copied from an
+// AudioFile or as a view of memory owned elsewhere (a memory-mapped file,
+// say), planar or interleaved. After that, any thread can trigger() and
+// release() voices: the requests go through a lock-free MPMC queue and
+// the audio thread picks them up at the start of its next block. Voice
+// state is kept as parallel arrays and nothing allocates on the audio
+// thread. When the pool is full the quietest voice is stolen.
+//
+// Each voice renders in runs that end on an envelope stage or the end of
+// its sample, so the inner loops have no branches: linear interpolation
+// between neighbouring frames, with positions kept relative to the run,
+// into a multiply-add onto the mix. These vectorise (using gathers, where
+// the target has them); a voice at its original pitch is a plain
+// multiply-add.
+class voice_engine : public AudioCallback
+{
+  public:
+    using handle = uint32_t; // 0: none
+
+  private:
+    static constexpr unsigned int NO_VOICE = ~0u;
+    static constexpr unsigned int FOREVER = ~0u;
+
+    struct sample_view
+    {
+        const float *data = nullptr;
+        size_t frames = 0;
+        unsigned int channels = 0;
+        size_t frameStride = 1;   // between frames of a channel
+        size_t channelStride = 0; // between channels
+        double samplerate = 0;
+    };
+
+    enum class stage : uint8_t
+    {
+        attack,
+        sustain,
+        release
+    };
+
+    struct command
+    {
+        handle id;
+        unsigned int sample; // NO_VOICE: a release (of all, if id is 0)
+        float pitch;
+        float gain;
+        unsigned int attack;
+        unsigned int release;
+    };
+
+    const unsigned int m_nch;
+    const double m_samplerate;
+    const unsigned int m_nVoices;
+    std::vector<sample_view> m_samples;
+    std::vector<std::unique_ptr<std::vector<float>>> m_owned;
+    lockfree::mpmc_queue<command> m_commands;
+    std::atomic<handle> m_nextHandle{1};
+    std::atomic<unsigned int> m_activeCount{0};
+    std::atomic<uint64_t> m_stolen{0};
+    std::atomic<uint64_t> m_dropped{0};
+
+    // audio thread: per voice
+    std::vector<handle> m_id;
+    std::vector<unsigned int> m_sample;
+    std::vector<double> m_pos;
+    std::vector<float> m_ratio;
+    std::vector<float> m_gain;
+    std::vector<float> m_env;
+    std::vector<float> m_envStep;
+    std::vector<unsigned int> m_envLeft; // frames to the end of the stage
+    std::vector<unsigned int> m_releaseFrames;
+    std::vector<stage> m_stage;
+    std::vector<unsigned int> m_active; // voice indices, reserved
+    std::vector<unsigned int> m_free;   // voice indices, reserved
+    std::vector<float> m_scratch; // OnAudioCallback, for other formats
+
+    static constexpr unsigned int SCRATCH_FRAMES = 512;
+
+    unsigned int frames_for(double seconds) const noexcept
+    {
+        return (unsigned int)std::lround((std::max)(0.0, seconds) *
+                                         m_samplerate);
+    }
+
+    void begin_release(unsigned int v) noexcept
+    {
+        if (m_stage[v] == stage::release) return;
+        m_stage[v] = stage::release;
+        const unsigned int n = (std::max)(1u, m_releaseFrames[v]);
+        m_envLeft[v] = n;
+        m_envStep[v] = -m_env[v] / (float)n;
+    }
+
+    unsigned int steal() noexcept
+    {
+        size_t quietest = 0;
+        float level = std::numeric_limits<float>::max();
+        for (size_t k = 0; k < m_active.size(); ++k)
+        {
+            const unsigned int v = m_active[k];
+            const float l = m_env[v] * m_gain[v];
+            if (l < level)
+            {
+                level = l;
+                quietest = k;
+            }
+        }
+        const unsigned int v = m_active[quietest];
+        m_active[quietest] = m_active.back();
+        m_active.pop_back();
+        m_stolen.fetch_add(1, std::memory_order_relaxed);
+        return v;
+    }
+
+    void start(const command &c) noexcept
+    {
+        if (c.sample >= m_samples.size()) return;
+        unsigned int v;
+        if (!m_free.empty())
+        {
+            v = m_free.back();
+            m_free.pop_back();
+        }
+        else
+        {
+            v = steal();
+        }
+        const sample_view &s = m_samples[c.sample];
+        m_id[v] = c.id;
+        m_sample[v] = c.sample;
+        m_pos[v] = 0.0;
+        m_ratio[v] = (float)(c.pitch * s.samplerate / m_samplerate);
+        m_gain[v] = c.gain;
+        m_releaseFrames[v] = c.release;
+        if (c.attack > 0)
+        {
+            m_stage[v] = stage::attack;
+            m_env[v] = 0.0f;
+            m_envStep[v] = 1.0f / (float)c.attack;
+            m_envLeft[v] = c.attack;
+        }
+        else
+        {
+            m_stage[v] = stage::sustain;
+            m_env[v] = 1.0f;
+            m_envStep[v] = 0.0f;
+            m_envLeft[v] = FOREVER;
+        }
+        m_active.push_back(v);
+    }
+
+    bool push_release(handle id) noexcept
+    {
+        if (m_commands.push(command{id, NO_VOICE, 0, 0, 0, 0})) return true;
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void pick_up_commands() noexcept
+    {
+        command c;
+        while (m_commands.pop(c))
+        {
+            if (c.sample != NO_VOICE)
+            {
+                start(c);
+                continue;
+            }
+            for (unsigned int v : m_active)
+            {
+                if (c.id == 0 || m_id[v] == c.id) begin_release(v);
+            }
+        }
+    }
+
+    // n frames of voice v onto out, with gain g0 + i * dg at frame i
+    void mix(unsigned int v, float *out, unsigned int n, float g0,
+             float dg) const noexcept
+    {
+        const sample_view &s = m_samples[m_sample[v]];
+        const size_t base = (size_t)m_pos[v];
+        const float frac = (float)(m_pos[v] - (double)base);
+        const float ratio = m_ratio[v];
+        const size_t fs = s.frameStride;
+        // guards the read of frame j + 1 against rounding in q
+        const size_t jmax = s.frames - 2 - base;
+        if (m_nch == 2 && (ratio != 1.0f || frac != 0.0f))
+        {
+            // stereo out: one set of positions for both channels
+            const float *AUDIO_RESTRICT l = s.data + base * fs;
+            const float *AUDIO_RESTRICT r =
+                l + (s.channels > 1 ? s.channelStride : 0);
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                const float q = frac + ratio * (float)i;
+                const size_t j = (std::min)((size_t)q, jmax);
+                const float t = q - (float)j;
+                const float g = g0 + dg * (float)i;
+                const float la = l[j * fs], lb = l[(j + 1) * fs];
+                const float ra = r[j * fs], rb = r[(j + 1) * fs];
+                out[2 * i] += (la + t * (lb - la)) * g;
+                out[2 * i + 1] += (ra + t * (rb - ra)) * g;
+            }
+            return;
+        }
+        for (unsigned int c = 0; c < m_nch; ++c)
+        {
+            const float *AUDIO_RESTRICT x =
+                s.data + (c % s.channels) * s.channelStride + base * fs;
+            float *AUDIO_RESTRICT o = out + c;
+            const unsigned int nch = m_nch;
+            if (ratio == 1.0f && frac == 0.0f)
+            {
+                for (unsigned int i = 0; i < n; ++i)
+                {
+                    o[i * nch] += x[i * fs] * (g0 + dg * (float)i);
+                }
+                continue;
+            }
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                const float q = frac + ratio * (float)i;
+                const size_t j = (std::min)((size_t)q, jmax);
+                const float t = q - (float)j;
+                const float a = x[j * fs], b = x[(j + 1) * fs];
+                o[i * nch] += (a + t * (b - a)) * (g0 + dg * (float)i);
+            }
+        }
+    }
+
+    // false once the voice has finished
+    bool render(unsigned int v, float *out, unsigned int frames) noexcept
+    {
+        const sample_view &s = m_samples[m_sample[v]];
+        const double last = (double)s.frames - 1;
+        unsigned int done = 0;
+        while (done < frames)
+        {
+            if (m_pos[v] >= last) return false;
+            const double toEnd = std::ceil((last - m_pos[v]) / m_ratio[v]);
+            unsigned int n = frames - done;
+            if (toEnd < n) n = (unsigned int)toEnd;
+            n = (std::min)(n, m_envLeft[v]);
+            mix(v, out + (size_t)done * m_nch, n, m_env[v] * m_gain[v],
+                m_envStep[v] * m_gain[v]);
+            m_pos[v] += (double)m_ratio[v] * n;
+            m_env[v] += m_envStep[v] * (float)n;
+            done += n;
+            if (m_envLeft[v] == FOREVER) continue;
+            m_envLeft[v] -= n;
+            if (m_envLeft[v] > 0) continue;
+            if (m_stage[v] == stage::release) return false;
+            m_stage[v] = stage::sustain;
+            m_env[v] = 1.0f;
+            m_envStep[v] = 0.0f;
+            m_envLeft[v] = FOREVER;
+        }
+        return true;
+    }
+
+    unsigned int add(const sample_view &s)
+    {
+        if (s.frames < 2 || s.channels == 0 || !s.data)
+        {
+            throw std::runtime_error("voice_engine: a sample needs at least "
+                                     "two frames of audio");
+        }
+        if (s.frames >= (size_t)std::numeric_limits<int32_t>::max())
+        {
+            throw std::runtime_error("voice_engine: sample too long");
+        }
+        m_samples.push_back(s);
+        return (unsigned int)m_samples.size() - 1;
+    }
+
+  public:
+    // nch: output channels. Samples with fewer channels repeat theirs
+    // across the output (so mono plays in every channel).
+    voice_engine(unsigned int nch, double samplerate,
+                 unsigned int voices = 1024, size_t queue = 4096)
+        : m_nch(nch), m_samplerate(samplerate), m_nVoices(voices),
+          m_commands(queue), m_id(voices, 0), m_sample(voices, 0),
+          m_pos(voices, 0.0), m_ratio(voices, 1.0f), m_gain(voices, 0.0f),
+          m_env(voices, 0.0f), m_envStep(voices, 0.0f),
+          m_envLeft(voices, 0), m_releaseFrames(voices, 0),
+          m_stage(voices, stage::sustain),
+          m_scratch((size_t)SCRATCH_FRAMES * nch)
+    {
+        assert(nch > 0 && samplerate > 0 && voices > 0);
+        m_active.reserve(voices);
+        m_free.reserve(voices);
+        for (unsigned int v = voices; v-- > 0;)
+        {
+            m_free.push_back(v);
+        }
+    }
+
+    // Control thread, before the stream starts: copies the file's audio.
+    // Returns the sample's index.
+    unsigned int add_sample(const AudioFile<float> &file)
+    {
+        const unsigned int nch = (unsigned int)file.getNumChannels();
+        const size_t len = (size_t)file.getNumSamplesPerChannel();
+        auto data = std::make_unique<std::vector<float>>(len * nch);
+        for (unsigned int ch = 0; ch < nch; ++ch)
+        {
+            std::copy(file.samples[ch].begin(),
+                      file.samples[ch].begin() + len,
+                      data->begin() + ch * len);
+        }
+        sample_view s;
+        s.data = data->data();
+        s.frames = len;
+        s.channels = nch;
+        s.frameStride = 1;
+        s.channelStride = len;
+        s.samplerate = file.getSampleRate();
+        const unsigned int idx = add(s);
+        m_owned.push_back(std::move(data));
+        return idx;
+    }
+    // Control thread, before the stream starts: plays from memory the
+    // caller keeps alive, of frames interleaved (or, if planar, one channel
+    // after another) float frames.
+    unsigned int add_sample(const float *data, size_t frames,
+                            unsigned int channels, double samplerate,
+                            bool planar = false)
+    {
+        sample_view s;
+        s.data = data;
+        s.frames = frames;
+        s.channels = channels;
+        s.frameStride = planar ? 1 : channels;
+        s.channelStride = planar ? frames : 1;
+        s.samplerate = samplerate;
+        return add(s);
+    }
+    size_t samples() const noexcept { return m_samples.size(); }
+    unsigned int voices() const noexcept { return m_nVoices; }
+
+    // Any thread: plays sample at pitch (a ratio: 2 is an octave up), and
+    // returns a handle for release(); 0 if the queue is full. Throws
+    // std::runtime_error unless pitch is finite and above 0.
+    handle trigger(unsigned int sample, float pitch = 1.0f, float gain = 1.0f,
+                   double attackSecs = 0.002, double releaseSecs = 0.02)
+    {
+        if (sample >= m_samples.size())
+        {
+            throw std::runtime_error("voice_engine::trigger: no sample " +
+                                     std::to_string(sample));
+        }
+        if (!(pitch > 0) || !std::isfinite(pitch))
+        {
+            throw std::runtime_error("voice_engine::trigger: bad pitch " +
+                                     std::to_string(pitch));
+        }
+        handle id = m_nextHandle.fetch_add(1, std::memory_order_relaxed);
+        if (id == 0) id = m_nextHandle.fetch_add(1); // wrapped
+        const command c{id, sample, pitch, gain, frames_for(attackSecs),
+                        frames_for(releaseSecs)};
+        if (m_commands.push(c)) return id;
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    // Any thread: into the release stage. The 0 of a dropped trigger is
+    // no voice, and releases nothing.
+    bool release(handle id) noexcept
+    {
+        return id == 0 || push_release(id);
+    }
+    // Any thread: every voice into the release stage
+    bool release_all() noexcept { return push_release(0); }
+
+    // Any thread: voices playing at the end of the last block
+    unsigned int active() const noexcept
+    {
+        return m_activeCount.load(std::memory_order_relaxed);
+    }
+    uint64_t stolen() const noexcept
+    {
+        return m_stolen.load(std::memory_order_relaxed);
+    }
+    // triggers and releases lost to a full queue
+    uint64_t dropped() const noexcept
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Audio thread: frames interleaved float frames of the mix.
+    void process(float *out, unsigned int frames) noexcept
+    {
+        pick_up_commands();
+        std::fill(out, out + (size_t)frames * m_nch, 0.0f);
+        for (size_t k = 0; k < m_active.size();)
+        {
+            const unsigned int v = m_active[k];
+            if (render(v, out, frames))
+            {
+                ++k;
+                continue;
+            }
+            m_active[k] = m_active.back();
+            m_active.pop_back();
+            m_free.push_back(v);
+        }
+        m_activeCount.store((unsigned int)m_active.size(),
+                            std::memory_order_relaxed);
+    }
+
+    // As a stream's callback, in whatever format the stream runs.
+    int OnAudioCallback(const StreamCallbackInfo &info) override
+    {
+        assert(info.format.Channels == m_nch);
+        auto render = [this](float *out, unsigned int n) { process(out, n); };
+        detail::render_float(info, m_scratch, render);
+        return 0;
+    }
+};
+
+} // namespace audio
@@ -43,11 +43,14 @@
 
 #include "RtAudio.h"
 #include <algorithm>
+#include <chrono>
 #include <climits>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <new>
+#include <utility>
 
 // Static variable definitions.
 const unsigned int RtApi::MAX_SAMPLE_RATES = 14;
@@ -205,6 +208,65 @@ RtAudio::Api RtAudio ::getCompiledApiByName(const std::string &name)
     return RtAudio::Api::UNSPECIFIED;
 }
 
+// Rows: user format, columns: device format, both in the order
+// SINT8, SINT16, SINT24, SINT32, FLOAT32, FLOAT64.
+static const unsigned int FORMAT_COST[6][6] = {
+    {0, 1, 3, 2, 2, 4}, // SINT8
+    {8, 0, 3, 1, 2, 4}, // SINT16
+    {9, 8, 0, 1, 2, 3}, // SINT24
+    {9, 8, 6, 0, 4, 3}, // SINT32
+    {9, 8, 5, 1, 0, 3}, // FLOAT32
+    {9, 8, 5, 2, 1, 0}, // FLOAT64
+};
+
+static int formatCostIndex(RtAudioFormat format)
+{
+    switch (format)
+    {
+    case RTAUDIO_SINT8:
+        return 0;
+    case RTAUDIO_SINT16:
+        return 1;
+    case RTAUDIO_SINT24:
+        return 2;
+    case RTAUDIO_SINT32:
+        return 3;
+    case RTAUDIO_FLOAT32:
+        return 4;
+    case RTAUDIO_FLOAT64:
+        return 5;
+    default:
+        return -1;
+    }
+}
+
+unsigned int RtAudio ::getFormatConversionCost(RtAudioFormat userFormat,
+                                               RtAudioFormat deviceFormat)
+{
+    const int u = formatCostIndex(userFormat);
+    const int d = formatCostIndex(deviceFormat);
+    if (u < 0 || d < 0) return UINT_MAX;
+    return FORMAT_COST[u][d];
+}
+
+RtAudioFormat RtAudio ::getCheapestFormat(RtAudioFormat userFormat,
+                                          RtAudioFormat nativeFormats)
+{
+    RtAudioFormat best = 0;
+    unsigned int bestCost = UINT_MAX;
+    for (RtAudioFormat f = RTAUDIO_SINT8; f <= RTAUDIO_FLOAT64; f <<= 1)
+    {
+        if (!(nativeFormats & f)) continue;
+        const unsigned int cost = getFormatConversionCost(userFormat, f);
+        if (cost < bestCost)
+        {
+            best = f;
+            bestCost = cost;
+        }
+    }
+    return best;
+}
+
 void RtAudio ::openRtApi(RtAudio::Api api)
 {
     if (rtapi_) delete rtapi_;
@@ -423,6 +485,14 @@ void RtApi ::openStream(const RtAudio::StreamParameters *oParams,
         }
     }
 
+    // Backends that do not query the opened device at least know the one
+    // format they settled on.
+    for (int i = 0; i < 2; i++)
+    {
+        if (stream_.nativeFormats[i] == 0)
+            stream_.nativeFormats[i] = stream_.deviceFormat[i];
+    }
+
     stream_.callbackInfo.callback = (void *)callback;
     stream_.callbackInfo.userData = userData;
     stream_.callbackInfo.errorCallback = (void *)errorCallback;
@@ -519,6 +589,70 @@ void RtApi ::setStreamTime(double time)
 #endif
 }
 
+long long RtApi ::monotonicNanos(void)
+{
+    // steady_clock is clock_gettime(CLOCK_MONOTONIC) on linux, which is also
+    // the clock ALSA and JACK are asked to timestamp with.
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void RtApi ::getStreamHostTime(long long &outputNanos, long long &inputNanos)
+{
+    // No verifyStream() here: this is called from the callback thread.
+    outputNanos = 0;
+    inputNanos = 0;
+    const bool hasOutput = stream_.mode == OUTPUT || stream_.mode == DUPLEX;
+    const bool hasInput = stream_.mode == INPUT || stream_.mode == DUPLEX;
+    if (!hasOutput && !hasInput) return;
+
+    // Backends without timestamp support leave hostTime at 0: estimate
+    // from the reported latency instead.
+    long long now = 0;
+    if (hasOutput)
+    {
+        outputNanos = stream_.hostTime[0];
+        if (outputNanos == 0)
+        {
+            now = monotonicNanos();
+            outputNanos = now + framesToNanos(stream_.latency[0]);
+        }
+    }
+    if (hasInput)
+    {
+        inputNanos = stream_.hostTime[1];
+        if (inputNanos == 0)
+        {
+            if (now == 0) now = monotonicNanos();
+            inputNanos = now - framesToNanos(stream_.latency[1] +
+                                             stream_.bufferSize);
+        }
+    }
+}
+
+RtAudio::ConversionInfo RtApi ::getStreamConversionInfo(bool input)
+{
+    verifyStream();
+
+    RtAudio::ConversionInfo info;
+    const unsigned int i = input ? 1 : 0;
+    const StreamMode wanted = input ? INPUT : OUTPUT;
+    if (stream_.mode != wanted && stream_.mode != DUPLEX) return info;
+
+    info.userFormat = stream_.userFormat;
+    info.deviceFormat = stream_.deviceFormat[i];
+    info.nativeFormats = stream_.nativeFormats[i];
+    info.userChannels = stream_.nUserChannels[i];
+    info.deviceChannels = stream_.nDeviceChannels[i];
+    info.cost =
+        RtAudio::getFormatConversionCost(info.userFormat, info.deviceFormat);
+    info.convert = stream_.doConvertBuffer[i];
+    info.byteSwap = stream_.doByteSwap[i];
+    info.deviceInterleaved = stream_.deviceInterleaved[i];
+    return info;
+}
+
 unsigned int RtApi ::getStreamSampleRate(void)
 {
     verifyStream();
@@ -2474,6 +2608,28 @@ struct JackHandle
     }
 };
 
+struct RtApiJack::Resize
+{
+    unsigned int bufferSize;
+    char *userBuffer[2];
+    char *deviceBuffer;
+    ConvertInfo convertInfo[2];
+    Resize *next; // on retiredResize_
+
+    explicit Resize(unsigned int frames)
+        : bufferSize(frames), deviceBuffer(0), next(0)
+    {
+        userBuffer[0] = 0;
+        userBuffer[1] = 0;
+    }
+    ~Resize()
+    {
+        free(userBuffer[0]);
+        free(userBuffer[1]);
+        free(deviceBuffer);
+    }
+};
+
 #if !defined(__RTAUDIO_DEBUG__)
 static void jackSilentError(const char *){};
 #endif
@@ -2692,6 +2848,18 @@ static int jackXrun(void *infoPointer)
     return 0;
 }
 
+// Called on a JACK thread that is not the process thread, before the
+// first process callback with the new size.
+static int jackBufferSize(jack_nframes_t nframes, void *infoPointer)
+{
+    CallbackInfo *info = (CallbackInfo *)infoPointer;
+
+    RtApiJack *object = (RtApiJack *)info->object;
+    if (object->bufferSizeEvent((unsigned long)nframes) == false) return 1;
+
+    return 0;
+}
+
 bool RtApiJack ::probeDeviceOpen(unsigned int device, StreamMode mode,
                                  unsigned int channels,
                                  unsigned int firstChannel,
@@ -2951,6 +3119,8 @@ bool RtApiJack ::probeDeviceOpen(unsigned int device, StreamMode mode,
                                   (void *)&stream_.callbackInfo);
         jack_set_xrun_callback(handle->client, jackXrun,
                                (void *)&stream_.apiHandle);
+        jack_set_buffer_size_callback(handle->client, jackBufferSize,
+                                      (void *)&stream_.callbackInfo);
         jack_on_shutdown(handle->client, jackShutdown,
                          (void *)&stream_.callbackInfo);
     }
@@ -3036,6 +3206,7 @@ void RtApiJack ::closeStream(void)
 
         jack_client_close(handle->client);
     }
+    freeResizes();
 
     if (handle)
     {
@@ -3065,6 +3236,72 @@ void RtApiJack ::closeStream(void)
     stream_.state = STREAM_CLOSED;
 }
 
+// Only once no callbacks can run, or from the buffer size callback.
+void RtApiJack ::freeResizes(void)
+{
+    delete pendingResize_.exchange(nullptr);
+    Resize *r = retiredResize_.exchange(nullptr);
+    while (r)
+    {
+        Resize *next = r->next;
+        delete r;
+        r = next;
+    }
+}
+
+bool RtApiJack ::bufferSizeEvent(unsigned long nframes)
+{
+    if (stream_.state == STREAM_CLOSED) return SUCCESS;
+
+    // What the process callback swapped out is no longer in use, and
+    // what it has not picked up yet is out of date.
+    freeResizes();
+    if (nframes == stream_.bufferSize) return SUCCESS;
+
+    Resize *r = new (std::nothrow) Resize((unsigned int)nframes);
+    if (r == NULL)
+    {
+        errorText_ = "RtApiJack::bufferSizeEvent: error allocating memory.";
+        error(RtAudioError::WARNING);
+        return FAILURE;
+    }
+
+    // The same sizes probeDeviceOpen() allocates, for nframes.
+    unsigned long deviceBytes = 0;
+    bool ok = true;
+    for (int i = 0; i < 2; i++)
+    {
+        if (stream_.mode != DUPLEX && stream_.mode != (StreamMode)i)
+            continue;
+        r->userBuffer[i] = (char *)calloc(stream_.nUserChannels[i] * nframes *
+                                              formatBytes(stream_.userFormat),
+                                          1);
+        if (r->userBuffer[i] == NULL) ok = false;
+        if (!stream_.doConvertBuffer[i]) continue;
+        unsigned long bytes = stream_.nDeviceChannels[i] *
+                              formatBytes(stream_.deviceFormat[i]);
+        if (bytes > deviceBytes) deviceBytes = bytes;
+        setConvertInfo((StreamMode)i, 0, (unsigned int)nframes,
+                       r->convertInfo[i]);
+    }
+    if (deviceBytes > 0)
+    {
+        r->deviceBuffer = (char *)calloc(deviceBytes * nframes, 1);
+        if (r->deviceBuffer == NULL) ok = false;
+    }
+    if (!ok)
+    {
+        delete r;
+        errorText_ =
+            "RtApiJack::bufferSizeEvent: error allocating buffer memory.";
+        error(RtAudioError::WARNING);
+        return FAILURE;
+    }
+
+    pendingResize_.store(r, std::memory_order_release);
+    return SUCCESS;
+}
+
 void RtApiJack ::startStream(void)
 {
     verifyStream();
@@ -3232,12 +3469,41 @@ bool RtApiJack ::callbackEvent(unsigned long nframes)
         error(RtAudioError::WARNING);
         return FAILURE;
     }
+    bool resized = false;
     if (stream_.bufferSize != nframes)
     {
-        errorText_ = "RtApiCore::callbackEvent(): the JACK buffer size has "
-                     "changed ... cannot process!";
-        error(RtAudioError::WARNING);
-        return FAILURE;
+        // Swap in what bufferSizeEvent() made ready, and hand the old
+        // buffers back for it to free: nothing (de)allocates here.
+        Resize *r =
+            pendingResize_.exchange(nullptr, std::memory_order_acquire);
+        if (r && r->bufferSize == nframes)
+        {
+            std::swap(stream_.userBuffer[0], r->userBuffer[0]);
+            std::swap(stream_.userBuffer[1], r->userBuffer[1]);
+            std::swap(stream_.deviceBuffer, r->deviceBuffer);
+            std::swap(stream_.convertInfo[0], r->convertInfo[0]);
+            std::swap(stream_.convertInfo[1], r->convertInfo[1]);
+            r->bufferSize = stream_.bufferSize;
+            stream_.bufferSize = (unsigned int)nframes;
+            resized = true;
+        }
+        if (r)
+        {
+            Resize *head = retiredResize_.load(std::memory_order_relaxed);
+            do
+            {
+                r->next = head;
+            } while (!retiredResize_.compare_exchange_weak(
+                head, r, std::memory_order_release,
+                std::memory_order_relaxed));
+        }
+        if (!resized)
+        {
+            errorText_ = "RtApiJack::callbackEvent(): the JACK buffer size "
+                         "has changed ... cannot process!";
+            error(RtAudioError::WARNING);
+            return FAILURE;
+        }
     }
 
     CallbackInfo *info = (CallbackInfo *)&stream_.callbackInfo;
@@ -3262,6 +3528,7 @@ bool RtApiJack ::callbackEvent(unsigned long nframes)
         RtAudioCallback callback = (RtAudioCallback)info->callback;
         double streamTime = getStreamTime();
         RtAudioStreamStatus status = 0;
+        if (resized) status |= RTAUDIO_BUFFER_SIZE_CHANGED;
         if (stream_.mode != INPUT && handle->xrun[0] == true)
         {
             status |= RTAUDIO_OUTPUT_UNDERFLOW;
@@ -3272,6 +3539,26 @@ bool RtApiJack ::callbackEvent(unsigned long nframes)
             status |= RTAUDIO_INPUT_OVERFLOW;
             handle->xrun[1] = false;
         }
+
+        // JACK time is CLOCK_MONOTONIC microseconds on linux. Output written
+        // in this cycle starts playing one period later, plus the port's
+        // playback latency. The user sees last cycle's input (it is copied
+        // after the callback), captured a period before this one started.
+        const jack_nframes_t cycleStart = jack_last_frame_time(handle->client);
+        if (stream_.mode != INPUT)
+            stream_.hostTime[0] =
+                (long long)jack_frames_to_time(
+                    handle->client, cycleStart + (jack_nframes_t)nframes +
+                                        (jack_nframes_t)stream_.latency[0]) *
+                1000LL;
+        if (stream_.mode != OUTPUT)
+            stream_.hostTime[1] =
+                (long long)jack_frames_to_time(
+                    handle->client,
+                    cycleStart - 2 * (jack_nframes_t)nframes -
+                        (jack_nframes_t)stream_.latency[1]) *
+                1000LL;
+
         int cbReturnValue =
             callback(stream_.userBuffer[0], stream_.userBuffer[1],
                      stream_.bufferSize, streamTime, status, info->userData);
@@ -7962,6 +8249,20 @@ void RtApiDs ::callbackEvent()
             status |= RTAUDIO_INPUT_OVERFLOW;
             handle->xrun[1] = false;
         }
+
+        // DirectSound has no timestamps. Both pointers run nBuffers
+        // buffers (the lead time) from the play and capture positions, so
+        // output written now plays that long from now, and the input the
+        // user sees (read at the end of the last event) was captured a
+        // buffer before that much ago.
+        const long long now = monotonicNanos();
+        const long long lead =
+            framesToNanos((long long)stream_.nBuffers * stream_.bufferSize);
+        if (stream_.mode != INPUT) stream_.hostTime[0] = now + lead;
+        if (stream_.mode != OUTPUT)
+            stream_.hostTime[1] =
+                now - lead - framesToNanos(stream_.bufferSize);
+
         int cbReturnValue =
             callback(stream_.userBuffer[0], stream_.userBuffer[1],
                      stream_.bufferSize, streamTime, status, info->userData);
@@ -9239,70 +9540,42 @@ foundDevice:
         return FAILURE;
     }
 
-    // Determine how to set the device format.
+    // Determine how to set the device format: the user format if the
+    // device takes it, else whichever of the formats it does take is the
+    // cheapest to convert to (rather than always trying FLOAT64 first).
     stream_.userFormat = format;
     snd_pcm_format_t deviceFormat = SND_PCM_FORMAT_UNKNOWN;
-
-    if (format == RTAUDIO_SINT8)
-        deviceFormat = SND_PCM_FORMAT_S8;
-    else if (format == RTAUDIO_SINT16)
-        deviceFormat = SND_PCM_FORMAT_S16;
-    else if (format == RTAUDIO_SINT24)
-        deviceFormat = SND_PCM_FORMAT_S24;
-    else if (format == RTAUDIO_SINT32)
-        deviceFormat = SND_PCM_FORMAT_S32;
-    else if (format == RTAUDIO_FLOAT32)
-        deviceFormat = SND_PCM_FORMAT_FLOAT;
-    else if (format == RTAUDIO_FLOAT64)
-        deviceFormat = SND_PCM_FORMAT_FLOAT64;
-
-    if (snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat) == 0)
-    {
-        stream_.deviceFormat[mode] = format;
-        goto setFormat;
-    }
-
-    // The user requested format is not natively supported by the device.
-    deviceFormat = SND_PCM_FORMAT_FLOAT64;
-    if (snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat) == 0)
-    {
-        stream_.deviceFormat[mode] = RTAUDIO_FLOAT64;
-        goto setFormat;
-    }
-
-    deviceFormat = SND_PCM_FORMAT_FLOAT;
-    if (snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat) == 0)
-    {
-        stream_.deviceFormat[mode] = RTAUDIO_FLOAT32;
-        goto setFormat;
-    }
-
-    deviceFormat = SND_PCM_FORMAT_S32;
-    if (snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat) == 0)
     {
-        stream_.deviceFormat[mode] = RTAUDIO_SINT32;
-        goto setFormat;
-    }
-
-    deviceFormat = SND_PCM_FORMAT_S24;
-    if (snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat) == 0)
-    {
-        stream_.deviceFormat[mode] = RTAUDIO_SINT24;
-        goto setFormat;
-    }
+        static const struct
+        {
+            snd_pcm_format_t alsa;
+            RtAudioFormat rt;
+        } formats[] = {{SND_PCM_FORMAT_S8, RTAUDIO_SINT8},
+                       {SND_PCM_FORMAT_S16, RTAUDIO_SINT16},
+                       {SND_PCM_FORMAT_S24, RTAUDIO_SINT24},
+                       {SND_PCM_FORMAT_S32, RTAUDIO_SINT32},
+                       {SND_PCM_FORMAT_FLOAT, RTAUDIO_FLOAT32},
+                       {SND_PCM_FORMAT_FLOAT64, RTAUDIO_FLOAT64}};
 
-    deviceFormat = SND_PCM_FORMAT_S16;
-    if (snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat) == 0)
-    {
-        stream_.deviceFormat[mode] = RTAUDIO_SINT16;
-        goto setFormat;
-    }
+        RtAudioFormat native = 0;
+        for (const auto &f : formats)
+        {
+            if (snd_pcm_hw_params_test_format(phandle, hw_params, f.alsa) == 0)
+                native |= f.rt;
+        }
+        stream_.nativeFormats[mode] = native;
 
-    deviceFormat = SND_PCM_FORMAT_S8;
-    if (snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat) == 0)
-    {
-        stream_.deviceFormat[mode] = RTAUDIO_SINT8;
-        goto setFormat;
+        const RtAudioFormat cheapest =
+            RtAudio::getCheapestFormat(format, native);
+        for (const auto &f : formats)
+        {
+            if (f.rt == cheapest)
+            {
+                deviceFormat = f.alsa;
+                stream_.deviceFormat[mode] = cheapest;
+                goto setFormat;
+            }
+        }
     }
 
     // If we get here, no supported format was found.
@@ -9484,6 +9757,13 @@ setFormat:
     snd_pcm_sw_params_get_boundary(sw_params, &val);
     snd_pcm_sw_params_set_silence_size(phandle, sw_params, val);
 
+    // Timestamp hardware pointer updates on the monotonic clock, so that
+    // snd_pcm_htimestamp() can be handed straight to the callback.
+    snd_pcm_sw_params_set_tstamp_mode(phandle, sw_params,
+                                      SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type(phandle, sw_params,
+                                      SND_PCM_TSTAMP_TYPE_MONOTONIC);
+
     result = snd_pcm_sw_params(phandle, sw_params);
     if (result < 0)
     {
@@ -9976,6 +10256,24 @@ void RtApiAlsa ::callbackEvent()
         status |= RTAUDIO_INPUT_OVERFLOW;
         apiInfo->xrun[1] = false;
     }
+    if (stream_.mode != INPUT)
+    {
+        // Everything still queued plays before the buffer we are about to
+        // fill, so its first frame reaches the DAC after that delay.
+        snd_pcm_uframes_t avail;
+        snd_htimestamp_t tstamp;
+        if (snd_pcm_htimestamp(apiInfo->handles[0], &avail, &tstamp) == 0 &&
+            (tstamp.tv_sec || tstamp.tv_nsec))
+        {
+            const long long queued =
+                (long long)stream_.bufferSize * stream_.nBuffers - avail;
+            stream_.hostTime[0] = tstamp.tv_sec * 1000000000LL +
+                                  tstamp.tv_nsec +
+                                  framesToNanos(queued > 0 ? queued : 0);
+        }
+        else
+            stream_.hostTime[0] = 0;
+    }
     doStopStream = callback(stream_.userBuffer[0], stream_.userBuffer[1],
                             stream_.bufferSize, streamTime, status,
                             stream_.callbackInfo.userData);
@@ -10077,6 +10375,21 @@ void RtApiAlsa ::callbackEvent()
         // Check stream latency
         result = snd_pcm_delay(handle[1], &frames);
         if (result == 0 && frames > 0) stream_.latency[1] = frames;
+
+        // The next callback sees this buffer: its first frame was captured
+        // (what we just read + what is still waiting) frames before the
+        // last hardware pointer update.
+        snd_pcm_uframes_t avail;
+        snd_htimestamp_t tstamp;
+        if (snd_pcm_htimestamp(handle[1], &avail, &tstamp) == 0 &&
+            (tstamp.tv_sec || tstamp.tv_nsec))
+        {
+            stream_.hostTime[1] =
+                tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec -
+                framesToNanos((long long)avail + stream_.bufferSize);
+        }
+        else
+            stream_.hostTime[1] = 0;
     }
 
 tryOutput:
@@ -10560,6 +10873,16 @@ void RtApiPulse::callbackEvent(void)
     RtAudioCallback callback = (RtAudioCallback)stream_.callbackInfo.callback;
     double streamTime = getStreamTime();
     RtAudioStreamStatus status = 0;
+    int pa_error;
+    if (stream_.mode == OUTPUT || stream_.mode == DUPLEX)
+    {
+        // The simple API has no pa_stream_get_time(); its latency query is
+        // the same server-side timing info, relative to now.
+        pa_usec_t usec = pa_simple_get_latency(pah->s_play, &pa_error);
+        stream_.hostTime[OUTPUT] =
+            usec == (pa_usec_t)-1 ? 0
+                                  : monotonicNanos() + (long long)usec * 1000LL;
+    }
     int doStopStream = callback(
         stream_.userBuffer[OUTPUT], stream_.userBuffer[INPUT],
         stream_.bufferSize, streamTime, status, stream_.callbackInfo.userData);
@@ -10579,7 +10902,6 @@ void RtApiPulse::callbackEvent(void)
 
     if (stream_.state != STREAM_RUNNING) goto unlock;
 
-    int pa_error;
     size_t bytes;
     if (stream_.mode == OUTPUT || stream_.mode == DUPLEX)
     {
@@ -10619,6 +10941,17 @@ void RtApiPulse::callbackEvent(void)
             errorText_ = errorStream_.str();
             error(RtAudioError::WARNING);
         }
+        else
+        {
+            // Seen by the next callback: first frame captured one buffer
+            // plus the recording latency ago.
+            pa_usec_t usec = pa_simple_get_latency(pah->s_rec, &pa_error);
+            stream_.hostTime[INPUT] =
+                usec == (pa_usec_t)-1
+                    ? 0
+                    : monotonicNanos() - (long long)usec * 1000LL -
+                          framesToNanos(stream_.bufferSize);
+        }
         if (stream_.doConvertBuffer[INPUT])
         {
             convertBuffer(stream_.userBuffer[INPUT], stream_.deviceBuffer,
@@ -12316,7 +12649,9 @@ void RtApi ::clearStreamInfo()
         stream_.nDeviceChannels[i] = 0;
         stream_.channelOffset[i] = 0;
         stream_.deviceFormat[i] = 0;
+        stream_.nativeFormats[i] = 0;
         stream_.latency[i] = 0;
+        stream_.hostTime[i] = 0;
         stream_.userBuffer[i] = 0;
         stream_.convertInfo[i].channels = 0;
         stream_.convertInfo[i].inJump = 0;
@@ -12348,26 +12683,33 @@ unsigned int RtApi ::formatBytes(RtAudioFormat format)
 }
 
 void RtApi ::setConvertInfo(StreamMode mode, unsigned int firstChannel)
+{
+    setConvertInfo(mode, firstChannel, stream_.bufferSize,
+                   stream_.convertInfo[mode]);
+}
+
+void RtApi ::setConvertInfo(StreamMode mode, unsigned int firstChannel,
+                            unsigned int bufferSize, ConvertInfo &info)
 {
     if (mode == INPUT)
     { // convert device to user buffer
-        stream_.convertInfo[mode].inJump = stream_.nDeviceChannels[1];
-        stream_.convertInfo[mode].outJump = stream_.nUserChannels[1];
-        stream_.convertInfo[mode].inFormat = stream_.deviceFormat[1];
-        stream_.convertInfo[mode].outFormat = stream_.userFormat;
+        info.inJump = stream_.nDeviceChannels[1];
+        info.outJump = stream_.nUserChannels[1];
+        info.inFormat = stream_.deviceFormat[1];
+        info.outFormat = stream_.userFormat;
     }
     else
     { // convert user to device buffer
-        stream_.convertInfo[mode].inJump = stream_.nUserChannels[0];
-        stream_.convertInfo[mode].outJump = stream_.nDeviceChannels[0];
-        stream_.convertInfo[mode].inFormat = stream_.userFormat;
-        stream_.convertInfo[mode].outFormat = stream_.deviceFormat[0];
+        info.inJump = stream_.nUserChannels[0];
+        info.outJump = stream_.nDeviceChannels[0];
+        info.inFormat = stream_.userFormat;
+        info.outFormat = stream_.deviceFormat[0];
     }
 
-    if (stream_.convertInfo[mode].inJump < stream_.convertInfo[mode].outJump)
-        stream_.convertInfo[mode].channels = stream_.convertInfo[mode].inJump;
+    if (info.inJump < info.outJump)
+        info.channels = info.inJump;
     else
-        stream_.convertInfo[mode].channels = stream_.convertInfo[mode].outJump;
+        info.channels = info.outJump;
 
     // Set up the interleave/deinterleave offsets.
     if (stream_.deviceInterleaved[mode] != stream_.userInterleaved)
@@ -12375,22 +12717,20 @@ void RtApi ::setConvertInfo(StreamMode mode, unsigned int firstChannel)
         if ((mode == OUTPUT && stream_.deviceInterleaved[mode]) ||
             (mode == INPUT && stream_.userInterleaved))
         {
-            for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
+            for (int k = 0; k < info.channels; k++)
             {
-                stream_.convertInfo[mode].inOffset.push_back(
-                    k * stream_.bufferSize);
-                stream_.convertInfo[mode].outOffset.push_back(k);
-                stream_.convertInfo[mode].inJump = 1;
+                info.inOffset.push_back(k * bufferSize);
+                info.outOffset.push_back(k);
+                info.inJump = 1;
             }
         }
         else
         {
-            for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
+            for (int k = 0; k < info.channels; k++)
             {
-                stream_.convertInfo[mode].inOffset.push_back(k);
-                stream_.convertInfo[mode].outOffset.push_back(
-                    k * stream_.bufferSize);
-                stream_.convertInfo[mode].outJump = 1;
+                info.inOffset.push_back(k);
+                info.outOffset.push_back(k * bufferSize);
+                info.outJump = 1;
             }
         }
     }
@@ -12398,22 +12738,20 @@ void RtApi ::setConvertInfo(StreamMode mode, unsigned int firstChannel)
     { // no (de)interleaving
         if (stream_.userInterleaved)
         {
-            for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
+            for (int k = 0; k < info.channels; k++)
             {
-                stream_.convertInfo[mode].inOffset.push_back(k);
-                stream_.convertInfo[mode].outOffset.push_back(k);
+                info.inOffset.push_back(k);
+                info.outOffset.push_back(k);
             }
         }
         else
         {
-            for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
+            for (int k = 0; k < info.channels; k++)
             {
-                stream_.convertInfo[mode].inOffset.push_back(
-                    k * stream_.bufferSize);
-                stream_.convertInfo[mode].outOffset.push_back(
-                    k * stream_.bufferSize);
-                stream_.convertInfo[mode].inJump = 1;
-                stream_.convertInfo[mode].outJump = 1;
+                info.inOffset.push_back(k * bufferSize);
+                info.outOffset.push_back(k * bufferSize);
+                info.inJump = 1;
+                info.outJump = 1;
             }
         }
     }
@@ -12425,28 +12763,26 @@ void RtApi ::setConvertInfo(StreamMode mode, unsigned int firstChannel)
         {
             if (mode == OUTPUT)
             {
-                for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
-                    stream_.convertInfo[mode].outOffset[k] += firstChannel;
+                for (int k = 0; k < info.channels; k++)
+                    info.outOffset[k] += firstChannel;
             }
             else
             {
-                for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
-                    stream_.convertInfo[mode].inOffset[k] += firstChannel;
+                for (int k = 0; k < info.channels; k++)
+                    info.inOffset[k] += firstChannel;
             }
         }
         else
         {
             if (mode == OUTPUT)
             {
-                for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
-                    stream_.convertInfo[mode].outOffset[k] +=
-                        (firstChannel * stream_.bufferSize);
+                for (int k = 0; k < info.channels; k++)
+                    info.outOffset[k] += (firstChannel * bufferSize);
             }
             else
             {
-                for (int k = 0; k < stream_.convertInfo[mode].channels; k++)
-                    stream_.convertInfo[mode].inOffset[k] +=
-                        (firstChannel * stream_.bufferSize);
+                for (int k = 0; k < info.channels; k++)
+                    info.inOffset[k] += (firstChannel * bufferSize);
             }
         }
     }
@@ -68,6 +68,7 @@
 #endif
 #endif
 
+#include <atomic>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -171,13 +172,15 @@ typedef unsigned int RtAudioStreamFlags;
 
     Notification of a stream over- or underflow is indicated by a
     non-zero stream \c status argument in the RtAudioCallback function.
-    The stream status can be one of the following two options,
+    The stream status can be any of the following options,
     depending on whether the stream is open for output and/or input:
 
     - \e RTAUDIO_INPUT_OVERFLOW:   Input data was discarded because of an
    overflow condition at the driver.
     - \e RTAUDIO_OUTPUT_UNDERFLOW: The output buffer ran low, likely producing a
    break in the output sound.
+    - \e RTAUDIO_BUFFER_SIZE_CHANGED: The device changed its buffer size
+   (JACK only); this and later callbacks get the new number of frames.
 */
 typedef unsigned int RtAudioStreamStatus;
 [[maybe_unused]] static const RtAudioStreamStatus RTAUDIO_INPUT_OVERFLOW =
@@ -185,6 +188,8 @@ typedef unsigned int RtAudioStreamStatus;
          // driver.
 [[maybe_unused]] static const RtAudioStreamStatus RTAUDIO_OUTPUT_UNDERFLOW =
     0x2; // The output buffer ran low, likely causing a gap in the output sound.
+[[maybe_unused]] static const RtAudioStreamStatus RTAUDIO_BUFFER_SIZE_CHANGED =
+    0x4; // The buffer size changed; nFrames is the new size.
 
 //! RtAudio callback function prototype.
 /*!
@@ -475,9 +480,39 @@ class RTAUDIO_DLL_PUBLIC RtAudio
         StreamOptions &operator=(StreamOptions &&) = default;
     };
 
+    //! How user data is converted to/from the device in an open stream.
+    struct ConversionInfo
+    {
+        RtAudioFormat userFormat = 0;    /*!< Format the callback sees. */
+        RtAudioFormat deviceFormat = 0;  /*!< Format the device was set to. */
+        RtAudioFormat nativeFormats = 0; /*!< All formats the opened device
+                                            accepts (0 if not known). */
+        unsigned int userChannels = 0;
+        unsigned int deviceChannels = 0;
+        unsigned int cost = 0; /*!< getFormatConversionCost() of the pair. */
+        bool convert = false;  /*!< true if a conversion pass is needed. */
+        bool byteSwap = false;
+        bool deviceInterleaved = true;
+    };
+
     //! A static function to determine the current RtAudio version.
     static std::string getVersion(void);
 
+    //! Relative cost of converting samples between two formats.
+    /*!
+      Zero for the same format.  Lossless and cheap conversions (widening,
+      float <-> 32-bit int) cost little; narrowing (losing resolution) and
+      the packed 3-byte SINT24 cost more.  Returns UINT_MAX for an unknown
+      format.
+    */
+    static unsigned int getFormatConversionCost(RtAudioFormat userFormat,
+                                                RtAudioFormat deviceFormat);
+
+    //! Returns the cheapest format to convert \c userFormat to, out of the
+    //! \c nativeFormats bit mask; 0 if the mask holds no known format.
+    static RtAudioFormat getCheapestFormat(RtAudioFormat userFormat,
+                                           RtAudioFormat nativeFormats);
+
     //! A static function to determine the available compiled audio APIs.
     /*!
       The values returned in the std::vector can be compared against
@@ -701,6 +736,26 @@ class RTAUDIO_DLL_PUBLIC RtAudio
     */
     unsigned int getStreamSampleRate(void);
 
+    //! Returns host timestamps for the buffers of the current callback.
+    /*!
+      Intended to be called from within the stream callback.  Both values
+      are CLOCK_MONOTONIC (std::chrono::steady_clock) times in nanoseconds:
+      \c outputNanos is when the first output frame will reach the DAC and
+      \c inputNanos is when the first input frame was captured.  They are
+      derived from the backend's own delay/timestamp queries where it has
+      them (ALSA, JACK, PulseAudio) and otherwise estimated from the stream
+      latency.  A direction that the stream does not have reports zero.
+    */
+    void getStreamHostTime(long long &outputNanos, long long &inputNanos);
+
+    //! Returns the conversion plan of the open stream, for diagnostics.
+    /*!
+      If a stream is not open, an RtAudioError (type = INVALID_USE) will be
+      thrown.  An output-only stream reports nothing for input, and vice
+      versa.
+    */
+    ConversionInfo getStreamConversionInfo(bool input = false);
+
     //! Specify whether warning messages should be printed to stderr.
     void showWarnings(bool value = true);
 
@@ -839,6 +894,8 @@ class RTAUDIO_DLL_PUBLIC RtApi
     unsigned int getStreamSampleRate(void);
     virtual double getStreamTime(void);
     virtual void setStreamTime(double time);
+    void getStreamHostTime(long long &outputNanos, long long &inputNanos);
+    RtAudio::ConversionInfo getStreamConversionInfo(bool input);
     bool isStreamOpen(void) const { return stream_.state != STREAM_CLOSED; }
     bool isStreamRunning(void) const { return stream_.state == STREAM_RUNNING; }
     void showWarnings(bool value) { showWarnings_ = value; }
@@ -903,11 +960,15 @@ class RTAUDIO_DLL_PUBLIC RtApi
         unsigned long latency[2];      // Playback and record, respectively.
         RtAudioFormat userFormat;
         RtAudioFormat deviceFormat[2]; // Playback and record, respectively.
+        RtAudioFormat nativeFormats[2]; // What the opened devices accept.
         StreamMutex mutex;
         CallbackInfo callbackInfo;
         ConvertInfo convertInfo[2];
         double
             streamTime; // Number of elapsed seconds since the stream started.
+        long long hostTime[2]; // Monotonic ns: first output frame at the DAC
+                               // and first input frame captured, or 0 when
+                               // the backend does not provide it.
 
 #if defined(HAVE_GETTIMEOFDAY)
         struct timeval lastTickTimestamp;
@@ -949,6 +1010,16 @@ class RTAUDIO_DLL_PUBLIC RtApi
     //! A protected function used to increment the stream time.
     void tickStreamTime(void);
 
+    //! Protected common method returning steady (CLOCK_MONOTONIC) time in ns.
+    static long long monotonicNanos(void);
+
+    //! Protected common method converting a frame count to nanoseconds.
+    long long framesToNanos(long long frames) const
+    {
+        return stream_.sampleRate ? frames * 1000000000LL / stream_.sampleRate
+                                  : 0;
+    }
+
     //! Protected common method to clear an RtApiStream structure.
     void clearStreamInfo();
 
@@ -979,6 +1050,10 @@ class RTAUDIO_DLL_PUBLIC RtApi
     //! Protected common method that sets up the parameters for buffer
     //! conversion.
     void setConvertInfo(StreamMode mode, unsigned int firstChannel);
+    // The same, for a buffer of bufferSize frames, into info (which must
+    // be empty) rather than stream_.convertInfo[mode].
+    void setConvertInfo(StreamMode mode, unsigned int firstChannel,
+                        unsigned int bufferSize, ConvertInfo &info);
 };
 
 // **************************************************************** //
@@ -1032,6 +1107,15 @@ inline void RtAudio ::setStreamTime(double time)
 {
     return rtapi_->setStreamTime(time);
 }
+inline void RtAudio ::getStreamHostTime(long long &outputNanos,
+                                        long long &inputNanos)
+{
+    return rtapi_->getStreamHostTime(outputNanos, inputNanos);
+}
+inline RtAudio::ConversionInfo RtAudio ::getStreamConversionInfo(bool input)
+{
+    return rtapi_->getStreamConversionInfo(input);
+}
 inline void RtAudio ::showWarnings(bool value) { rtapi_->showWarnings(value); }
 
 // RtApi Subclass prototypes.
@@ -1084,7 +1168,10 @@ class RtApiJack : public RtApi
   public:
     RtApiJack();
     ~RtApiJack();
-    RtAudio::Api getCurrentApi(void) override { return RtAudio::UNIX_JACK; }
+    RtAudio::Api getCurrentApi(void) override
+    {
+        return RtAudio::Api::UNIX_JACK;
+    }
     unsigned int getDeviceCount(void) override;
     RtAudio::DeviceInfo getDeviceInfo(unsigned int device) override;
     void closeStream(void) override;
@@ -1097,6 +1184,9 @@ class RtApiJack : public RtApi
     // which is not a member of RtAudio.  External use of this function
     // will most likely produce highly undesireable results!
     bool callbackEvent(unsigned long nframes);
+    // Likewise, called on a JACK (non-realtime) thread when the server's
+    // buffer size is about to change to nframes.
+    bool bufferSizeEvent(unsigned long nframes);
 
   private:
     bool probeDeviceOpen(unsigned int device, StreamMode mode,
@@ -1105,7 +1195,15 @@ class RtApiJack : public RtApi
                          unsigned int *bufferSize,
                          RtAudio::StreamOptions *options) override;
 
+    // Buffers and conversion plan for a new buffer size, made ready by
+    // bufferSizeEvent() and swapped in by callbackEvent(), after which it
+    // holds the old ones until they can be freed off the realtime thread.
+    struct Resize;
+    void freeResizes(void);
+
     bool shouldAutoconnect_;
+    std::atomic<Resize *> pendingResize_{nullptr};
+    std::atomic<Resize *> retiredResize_{nullptr};
 };
 
 #endif
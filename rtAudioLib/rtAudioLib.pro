@@ -63,7 +63,27 @@ SOURCES += ../rtAudio/asio/asio.cpp \
 
 
 HEADERS += \
-    ../include/myaudio.hpp
+    ../include/myaudio.hpp \
+    ../include/lockfree.hpp \
+    ../include/streamstats.hpp \
+    ../include/autotune.hpp \
+    ../include/faderbank.hpp \
+    ../include/oscillator.hpp \
+    ../include/biquad.hpp \
+    ../include/samples.hpp \
+    ../include/resampler.hpp \
+    ../include/driftbridge.hpp \
+    ../include/meters.hpp \
+    ../include/fft.hpp \
+    ../include/spectrum.hpp \
+    ../include/convolver.hpp \
+    ../include/graph.hpp \
+    ../include/chain.hpp \
+    ../include/events.hpp \
+    ../include/params.hpp \
+    ../include/router.hpp \
+    ../include/switcher.hpp \
+    ../include/voices.hpp
     win32{
     SOURCES += ../rtAudio/RtAudio.h \
     ../rtAudio/asio/asio.h \
@@ -1,7 +1,21 @@
 #include "../include/myaudio.hpp"
+#include "../include/biquad.hpp"
+#include "../include/convolver.hpp"
+#include "../include/driftbridge.hpp"
+#include "../include/faderbank.hpp"
+#include "../include/graph.hpp"
+#include "../include/meters.hpp"
+#include "../include/params.hpp"
+#include "../include/resampler.hpp"
+#include "../include/spectrum.hpp"
+#include "../include/switcher.hpp"
+#include "../include/voices.hpp"
+#include "../include/audiofile.hpp"
 #include <algorithm> // all_of
 #include <chrono>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <set>
 #include <thread>
 using namespace std::chrono_literals;
@@ -158,8 +172,1648 @@ void create_specific_audio(const audio::HostApi &api)
             "*********\n";
 }
 
+void test_render_ahead()
+{
+    struct counting_callback : audio::AudioCallback
+    {
+        int16_t next = 0;
+        int OnAudioCallback(const audio::StreamCallbackInfo &info) override
+        {
+            auto *out = (int16_t *)info.outputBuffer;
+            for (unsigned int i = 0; i < info.frames * format.Channels; ++i)
+            {
+                *out++ = next++;
+            }
+            return 0;
+        }
+    };
+
+    counting_callback cb;
+    cb.format.Format = audio::AudioFormat::SINT16;
+    cb.format.Channels = 2;
+    audio::detail::RenderAhead ra(&cb, cb.format, 64, 3);
+    ra.Start();
+
+    // device periods which are not a multiple of the block size must still
+    // see one continuous signal.
+    std::vector<int16_t> device(2 * 100);
+    int16_t expected = 0;
+    for (int period = 0; period < 50; ++period)
+    {
+        const int rv = ra.pull(device.data(), 100, 0);
+        assert(rv == 0);
+        for (auto v : device)
+        {
+            assert(v == expected);
+            ++expected;
+        }
+        this_thread::sleep_for(5ms); // give the worker a device period
+    }
+    assert(ra.Underruns() == 0);
+    ra.Stop();
+}
+
+void test_stream_stats()
+{
+    audio::detail::StatsRecorder rec;
+    auto stats = rec.Snapshot();
+    assert(stats.callbackCount == 0 && stats.minNanos == 0);
+
+    // 100 callbacks of 1ms on a 512 frame / 48kHz period (10.67ms)
+    const auto t0 = audio::detail::StatsRecorder::now();
+    for (int i = 0; i < 100; ++i)
+    {
+        const auto status = i == 50 ? RTAUDIO_OUTPUT_UNDERFLOW : 0;
+        rec.Record(t0, t0 + 1ms, 512, 48000, status, i * 0.01);
+    }
+    rec.Record(t0, t0 + 8ms, 512, 48000, RTAUDIO_INPUT_OVERFLOW, 1.0);
+
+    stats = rec.Snapshot();
+    assert(stats.callbackCount == 101);
+    assert(stats.minNanos == 1000000 && stats.maxNanos == 8000000);
+    assert(stats.p99Nanos >= 1000000 && stats.p99Nanos < 8000000);
+    assert(stats.dspLoad > 0.09 && stats.dspLoad < 0.11);
+    assert(stats.peakDspLoad > 0.74 && stats.peakDspLoad < 0.76);
+    assert(stats.histogram[audio::detail::log2_bucket(1000000)] == 100);
+    assert(stats.outputUnderflows == 1 && stats.inputOverflows == 1);
+    assert(stats.lastXrunStreamTime == 1.0 && stats.lastXrunNanos != 0);
+}
+
+void test_stream_host_time()
+{
+    // no stream open: nothing to report
+    RtAudio dummy(RtAudio::Api::RTAUDIO_DUMMY);
+    long long out = -1, in = -1;
+    dummy.getStreamHostTime(out, in);
+    assert(out == 0 && in == 0);
+
+    // a duplex stream on a backend that keeps no timestamps
+    struct untimed_api : RtApi
+    {
+        untimed_api()
+        {
+            clearStreamInfo();
+            stream_.mode = DUPLEX;
+            stream_.sampleRate = 48000;
+            stream_.bufferSize = 480;
+            stream_.latency[0] = 960; // 20ms
+            stream_.latency[1] = 480; // + a buffer: 20ms
+        }
+        void stamp(long long o, long long i)
+        {
+            stream_.hostTime[0] = o;
+            stream_.hostTime[1] = i;
+        }
+        RtAudio::Api getCurrentApi() override
+        {
+            return RtAudio::Api::RTAUDIO_DUMMY;
+        }
+        unsigned int getDeviceCount() override { return 0; }
+        RtAudio::DeviceInfo getDeviceInfo(unsigned int) override
+        {
+            return {};
+        }
+        void startStream() override {}
+        void stopStream() override {}
+        void abortStream() override {}
+    } api;
+    auto nanos = [] {
+        return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    };
+    const long long ms20 = 20000000;
+
+    // ... is estimated from the monotonic clock and the latency
+    const long long t0 = nanos();
+    api.getStreamHostTime(out, in);
+    const long long t1 = nanos();
+    assert(out >= t0 + ms20 && out <= t1 + ms20);
+    assert(in >= t0 - ms20 && in <= t1 - ms20);
+    long long out2 = 0, in2 = 0;
+    api.getStreamHostTime(out2, in2);
+    assert(out2 >= out && in2 >= in);
+
+    // ... unless the backend recorded a timestamp
+    api.stamp(12345, 678);
+    api.getStreamHostTime(out, in);
+    assert(out == 12345 && in == 678);
+}
+
+void test_buffer_tuner()
+{
+    using audio::detail::BufferTuner;
+    BufferTuner tuner(1024, 64, 4096);
+    audio::StreamStats before, now;
+    auto advance = [&](uint64_t callbacks, uint64_t nanosEach,
+                       uint64_t xruns) {
+        before = now;
+        now.callbackCount += callbacks;
+        now.busyNanos += callbacks * nanosEach;
+        now.periodNanos += callbacks * 10000000; // 10ms periods
+        now.histogram[audio::detail::log2_bucket(nanosEach)] += callbacks;
+        now.outputUnderflows += xruns;
+        return tuner.Evaluate(before, now);
+    };
+    auto expect = [&](uint64_t callbacks, uint64_t nanosEach,
+                      uint64_t xruns, unsigned int frames) {
+        const unsigned int got = advance(callbacks, nanosEach, xruns);
+        assert(got == frames);
+    };
+
+    // light load: only shrinks after several quiet windows in a row
+    expect(100, 1000000, 0, 1024);
+    expect(100, 1000000, 0, 1024);
+    expect(100, 1000000, 0, 512);
+    // an xrun grows straight away ...
+    expect(100, 1000000, 1, 1024);
+    // ... and we never go back down to the size that failed
+    for (int i = 0; i < 10; ++i)
+    {
+        expect(100, 1000000, 0, 1024);
+    }
+    // too few callbacks to judge
+    expect(5, 9000000, 3, 1024);
+    // heavy (but xrun free) load grows too, up to the maximum
+    expect(100, 9000000, 0, 2048);
+    expect(100, 9000000, 0, 4096);
+    expect(100, 9000000, 0, 4096);
+
+    const std::string path = "test_buffer_sizes.txt";
+    remove(path.c_str());
+    audio::detail::BufferSizeStore store(path);
+    assert(store.Load("alsa:hw0") == 0);
+    bool saved = store.Save("alsa:hw0", 256);
+    saved = store.Save("jack:system", 128) && saved;
+    saved = store.Save("alsa:hw0", 512) && saved;
+    assert(saved);
+    assert(store.Load("alsa:hw0") == 512 && store.Load("jack:system") == 128);
+    remove(path.c_str());
+}
+
+void test_format_negotiation()
+{
+    // a FLOAT32 stream on an S16/S32 card should go via S32, not FLOAT64
+    assert(RtAudio::getCheapestFormat(RTAUDIO_FLOAT32,
+                                      RTAUDIO_SINT16 | RTAUDIO_SINT32) ==
+           RTAUDIO_SINT32);
+    assert(RtAudio::getCheapestFormat(RTAUDIO_FLOAT32,
+                                      RTAUDIO_SINT16 | RTAUDIO_FLOAT64 |
+                                          RTAUDIO_SINT24) == RTAUDIO_FLOAT64);
+    assert(RtAudio::getCheapestFormat(RTAUDIO_SINT16, RTAUDIO_FLOAT32 |
+                                                          RTAUDIO_SINT16) ==
+           RTAUDIO_SINT16);
+    assert(RtAudio::getCheapestFormat(RTAUDIO_SINT16, 0) == 0);
+    assert(RtAudio::getFormatConversionCost(RTAUDIO_FLOAT32,
+                                            RTAUDIO_FLOAT32) == 0);
+
+    audio::DeviceInfo info;
+    info.probed = true;
+    info.outputChannels = 2;
+    info.nativeFormats = RTAUDIO_SINT16 | RTAUDIO_SINT32;
+    audio::SystemDevice sd(0, info, RtAudio::Api::RTAUDIO_DUMMY);
+
+    audio::DeviceInstance cheapest(sd);
+    auto n = cheapest.NegotiateFormat();
+    assert(n.requested == audio::AudioFormat::FLOAT32);
+    assert(n.userFormat == audio::AudioFormat::FLOAT32);
+    assert(n.deviceFormat == audio::AudioFormat::SINT32 && n.convert());
+
+    audio::DeviceInstance native(sd);
+    n = native.NegotiateFormat(audio::FormatPreference::noConversion);
+    assert(!n.convert() && n.cost == 0);
+    assert(native.Format().Format == audio::AudioFormat::SINT32);
+    assert(!n.toString().empty());
+}
+
+void test_fader()
+{
+    // 100 frames of stereo from 0 to 1: linear, then unity
+    audio::dsp::fader<float> f(1.0f, 0.01f, 10000.0f);
+    std::vector<float> buf(2 * 300, 1.0f);
+    f.processSamples(150, buf.data(), 2);
+    assert(buf[0] == buf[1] && buf[0] == 0.0f);
+    assert(std::fabs(buf[2 * 50] - 0.5f) < 1e-4f);
+    assert(buf[2 * 120] == 1.0f && !f.active() && f.volume() == 1.0f);
+
+    // arm() is picked up at the next block and ramps from the current gain
+    f.arm(0.0f, 10000.0f, 0.005f);
+    assert(f.active());
+    std::vector<float> left(100, 1.0f), right(100, 1.0f);
+    float *chans[] = {left.data(), right.data()};
+    f.processPlanar(100, chans, 2);
+    assert(left[0] == 1.0f && right[25] == left[25]);
+    assert(std::fabs(left[25] - 0.5f) < 1e-4f && left[60] == 0.0f);
+    assert(!f.active() && f.volume() == 0.0f);
+
+    // per-sample processing gives the same ramp as the block version
+    audio::dsp::fader<float> a(1.0f, 0.003f, 10000.0f, 3);
+    audio::dsp::fader<float> b(1.0f, 0.003f, 10000.0f, 3);
+    std::vector<float> x(3 * 50, 0.25f), y(x);
+    a.processSamples(50, x.data(), 3);
+    for (auto &s : y)
+    {
+        b.processSample(s);
+    }
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        assert(std::fabs(x[i] - y[i]) < 1e-5f);
+    }
+}
+
+void test_fader_bank()
+{
+    using audio::dsp::FadeCurve;
+    const int nch = 256;
+    audio::dsp::fader_bank<float> bank(nch, 0.0f);
+    const FadeCurve curves[] = {FadeCurve::linear, FadeCurve::equalPower,
+                                FadeCurve::exponential, FadeCurve::sCurve};
+    for (int ch = 0; ch < nch; ++ch)
+    {
+        // every eighth channel is left alone
+        if (ch % 8 == 7) continue;
+        const bool armed = bank.arm(ch, 1.0f, 12800.0f, 0.01f, curves[ch % 4]);
+        assert(armed);
+    }
+    std::vector<float> buf(nch * 256, 1.0f);
+    bank.processSamples(64, buf.data()); // half way
+    assert(bank.active(0) && !bank.active(7));
+    const float *half = buf.data() + 64 * nch;
+    bank.processSamples(192, buf.data() + 64 * nch);
+    assert(std::fabs(half[0] - 0.5f) < 1e-3f);
+    assert(std::fabs(half[1] - std::sqrt(0.5f)) < 1e-3f);
+    assert(half[2] > 0.0f && half[2] < 0.1f);
+    assert(std::fabs(half[3] - 0.5f) < 1e-3f);
+    assert(half[7] == 0.0f);
+    const float *last = buf.data() + 255 * nch;
+    assert(last[0] == 1.0f && last[1] == 1.0f && last[7] == 0.0f);
+    assert(!bank.active(0) && bank.volume(2) == 1.0f);
+
+    // equal power fade out mirrors the fade in: cos law
+    std::vector<float> l(128, 1.0f), r(128, 1.0f);
+    audio::dsp::fader_bank<float> two(2);
+    float *chans[] = {l.data(), r.data()};
+    two.arm(0, 0.0f, 12800.0f, 0.01f, FadeCurve::equalPower);
+    two.processPlanar(128, chans);
+    assert(std::fabs(l[64] - std::sqrt(0.5f)) < 1e-3f);
+    assert(l[0] == 1.0f && l[127] < 0.05f && r[64] == 1.0f);
+}
+
+void test_oscillator()
+{
+    const double sr = 48000, freq = 997.25;
+    for (auto interp : {audio::dsp::Interpolation::linear,
+                        audio::dsp::Interpolation::cubic})
+    {
+        audio::dsp::oscillator osc(freq, sr, 0.5f, interp);
+        std::vector<float> out(1000);
+        osc.generate(out.data(), 400);
+        osc.generate(out.data() + 400, 600);
+        for (size_t i = 0; i < out.size(); ++i)
+        {
+            const double want = 0.5 * sin(2 * M_PI * freq * i / sr);
+            assert(std::fabs(out[i] - want) < 1e-5);
+        }
+    }
+
+    // a frequency change carries on from the same phase
+    audio::dsp::oscillator osc(1000, sr);
+    std::vector<float> a(48), b(1);
+    osc.generate(a.data(), 48);
+    osc.frequency(1001.5);
+    osc.generate(b.data(), 1);
+    assert(std::fabs(b[0] - sin(2 * M_PI * 1000 * 48 / sr)) < 1e-5);
+
+    // the recursive oscillator, over many odd-sized blocks
+    audio::dsp::quadrature_oscillator q(freq, sr);
+    std::vector<float> qs(100000), qc(100000);
+    for (size_t done = 0, n = 1; done < qs.size(); done += n, n = n * 3 % 997)
+    {
+        n = (std::min)(n, qs.size() - done);
+        q.generate(qs.data() + done, qc.data() + done, (unsigned int)n);
+    }
+    for (size_t i = 0; i < qs.size(); i += 7)
+    {
+        assert(std::fabs(qs[i] - sin(2 * M_PI * freq * i / sr)) < 1e-4);
+        assert(std::fabs(qc[i] - cos(2 * M_PI * freq * i / sr)) < 1e-4);
+    }
+
+    // straight into a 16 bit stereo buffer, continuing across calls
+    std::vector<int16_t> s16(2 * 300);
+    audio::StreamCallbackInfo info;
+    info.format.Format = audio::AudioFormat::SINT16;
+    info.format.SamplesPerSec = 44100;
+    info.frames = 100;
+    unsigned int n = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        info.outputBuffer = s16.data() + 200 * i;
+        audio::dsp::fill_buffer_sine(n, info);
+    }
+    assert(n == 300);
+    for (int i = 0; i < 300; ++i)
+    {
+        const double want = 32768 * sin(2 * M_PI * 440 * i / 44100);
+        assert(s16[2 * i] == s16[2 * i + 1]);
+        assert(std::fabs(s16[2 * i] - want) <= 1.5);
+    }
+    // a negative frequency carries on from its own phase too
+    for (int i = 0; i < 3; ++i)
+    {
+        info.outputBuffer = s16.data() + 200 * i;
+        audio::dsp::fill_buffer_sine(n, info, -440);
+    }
+    for (int i = 0; i < 300; ++i)
+    {
+        const double want = -32768 * sin(2 * M_PI * 440 * (300 + i) / 44100);
+        assert(std::fabs(s16[2 * i] - want) <= 1.5);
+    }
+
+    unsigned int sn = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        const float v = audio::dsp::next_sine_sample(sn, 44100, 441);
+        assert(std::fabs(v - sin(2 * M_PI * 441 * i / 44100)) < 1e-5);
+    }
+}
+
+void test_oscillator_bank()
+{
+    const double sr = 48000;
+    audio::dsp::oscillator_bank bank(sr);
+    bank.add(100, 0.5f);
+    bank.add(1234.5, 0.25f, 0.25); // starts at the peak
+    bank.add(15000, 0.125f);
+    std::vector<float> out(20000);
+    bank.generate(out.data(), 777);
+    bank.generate(out.data() + 777, 20000 - 777);
+    for (size_t i = 0; i < out.size(); i += 3)
+    {
+        const double t = 2 * M_PI * i / sr;
+        const double want = 0.5 * sin(100 * t) +
+                            0.25 * sin(1234.5 * t + M_PI / 2) +
+                            0.125 * sin(15000 * t);
+        assert(std::fabs(out[i] - want) < 1e-4);
+    }
+
+    // threaded offline rendering gives the same answer as a single thread
+    audio::dsp::oscillator_bank one(sr), many(sr);
+    for (int k = 0; k < 2000; ++k)
+    {
+        one.add(20.0 + k * 10.25, 1.0f / 2000, k * 0.01);
+        many.add(20.0 + k * 10.25, 1.0f / 2000, k * 0.01);
+    }
+    std::vector<float> a(4800), b(4800);
+    one.generate(a.data(), 4800);
+    many.render(b.data(), 4800, 4);
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        assert(std::fabs(a[i] - b[i]) < 1e-5);
+    }
+}
+
+void test_biquad_bank()
+{
+    using audio::dsp::biquad_coeffs;
+    const float sr = 48000;
+    const int nch = 3, nstages = 2, frames = 4800;
+    const biquad_coeffs lp = biquad_coeffs::lowpass(sr, 1000);
+    const biquad_coeffs eq = biquad_coeffs::peaking(sr, 3000, 1.0, 6.0);
+
+    audio::dsp::biquad_bank<float> bank(nch, nstages, sr);
+    bank.set(-1, 0, lp, false);
+    bank.set(2, 1, eq, false); // only the last channel gets the eq
+
+    // white-ish noise, different on each channel
+    std::vector<float> in(nch * frames);
+    unsigned int seed = 1;
+    for (auto &v : in)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        v = (float)(seed >> 8) / (float)(1u << 24) - 0.5f;
+    }
+    std::vector<float> out(in);
+    bank.processSamples(1000, out.data());
+    bank.processSamples(frames - 1000, out.data() + 1000 * nch);
+
+    // scalar transposed direct form II, as a reference
+    for (int ch = 0; ch < nch; ++ch)
+    {
+        double z[nstages][2] = {};
+        for (int i = 0; i < frames; ++i)
+        {
+            double x = in[i * nch + ch];
+            for (int s = 0; s < nstages; ++s)
+            {
+                const biquad_coeffs c =
+                    s == 0 ? lp : (ch == 2 ? eq : biquad_coeffs{});
+                const double y = c.b0 * x + z[s][0];
+                z[s][0] = c.b1 * x - c.a1 * y + z[s][1];
+                z[s][1] = c.b2 * x - c.a2 * y;
+                x = y;
+            }
+            assert(std::fabs(out[i * nch + ch] - x) < 1e-4);
+        }
+    }
+
+    // planar goes through the same kernel
+    audio::dsp::biquad_bank<float> planar(nch, nstages, sr);
+    planar.set(-1, 0, lp, false);
+    planar.set(2, 1, eq, false);
+    std::vector<std::vector<float>> chans(nch, std::vector<float>(frames));
+    for (int ch = 0; ch < nch; ++ch)
+    {
+        for (int i = 0; i < frames; ++i)
+        {
+            chans[ch][i] = in[i * nch + ch];
+        }
+    }
+    float *ptrs[nch] = {chans[0].data(), chans[1].data(), chans[2].data()};
+    planar.processPlanar(frames, ptrs);
+    for (int ch = 0; ch < nch; ++ch)
+    {
+        for (int i = 0; i < frames; ++i)
+        {
+            assert(chans[ch][i] == out[i * nch + ch]);
+        }
+    }
+
+    // a smoothed change glides to the new response: a 10kHz tone is
+    // passed before and stopped after
+    audio::dsp::biquad_bank<float> mono(1, 1, sr, 0.01f);
+    audio::dsp::oscillator osc(10000, sr);
+    std::vector<float> tone(9600);
+    osc.generate(tone.data(), 9600);
+    mono.processSamples(4800, tone.data());
+    float before = 0;
+    for (int i = 2400; i < 4800; ++i)
+    {
+        before = (std::max)(before, std::fabs(tone[i]));
+    }
+    mono.set(0, 0, lp);
+    mono.processSamples(4800, tone.data() + 4800);
+    float after = 0;
+    for (int i = 9600 - 1200; i < 9600; ++i)
+    {
+        after = (std::max)(after, std::fabs(tone[i]));
+    }
+    assert(before > 0.99f && after < 0.02f);
+}
+
+void test_resampler()
+{
+    using audio::dsp::ResamplerQuality;
+    struct
+    {
+        double inRate, outRate;
+        ResamplerQuality q;
+        double tolerance;
+    } cases[] = {{44100, 48000, ResamplerQuality::fast, 2e-3},
+                 {44100, 48000, ResamplerQuality::best, 1e-4},
+                 {48000, 44100, ResamplerQuality::medium, 1e-3},
+                 {48000, 48000 * M_SQRT2, ResamplerQuality::medium, 1e-3},
+                 {96000, 22050, ResamplerQuality::medium, 1e-3}};
+    for (const auto &c : cases)
+    {
+        const double freq = 1000.25;
+        audio::dsp::polyphase_resampler src(2, c.inRate, c.outRate, c.q);
+        std::vector<float> in, out;
+        size_t inFrames = 0, outFrames = 0;
+        // odd-sized pulls, as a device would make them
+        for (unsigned int n = 1; outFrames < 20000; n = n * 7 % 1501 + 1)
+        {
+            const size_t need = src.required_input(n);
+            for (size_t i = 0; i < need; ++i, ++inFrames)
+            {
+                const float v = (float)(0.5 * sin(2 * M_PI * freq *
+                                                  inFrames / c.inRate));
+                in.push_back(v);
+                in.push_back(-v);
+            }
+            out.resize((outFrames + n) * 2);
+            src.process(in.data() + in.size() - need * 2,
+                        out.data() + outFrames * 2, n);
+            outFrames += n;
+        }
+        // no delay: output frame j is the input signal at time j / outRate
+        // (once past the silence the filter starts from)
+        for (size_t j = src.taps(); j < outFrames; ++j)
+        {
+            const double want = 0.5 * sin(2 * M_PI * freq * j / c.outRate);
+            assert(std::fabs(out[2 * j] - want) < c.tolerance);
+            assert(out[2 * j + 1] == -out[2 * j]);
+        }
+        const double expectIn = outFrames * c.inRate / c.outRate;
+        assert(std::fabs(inFrames - expectIn) <= src.latency() + 2);
+    }
+
+    // what a Stream puts between a 16 bit, 44.1kHz callback and a 48kHz
+    // float device
+    audio::FormatType user;
+    user.Format = audio::AudioFormat::SINT16;
+    user.SamplesPerSec = 44100;
+    audio::detail::StreamResampler bridge(user, 48000,
+                                          ResamplerQuality::medium);
+    audio::dsp::oscillator osc(440, 44100, 0.5f);
+    size_t rendered = 0;
+    auto render = [&](void *buffer, unsigned int n) {
+        osc.generate((int16_t *)buffer, n, 2);
+        rendered += n;
+        return 0;
+    };
+    std::vector<float> device(2 * 4800);
+    for (int i = 0; i < 4; ++i)
+    {
+        const int rv = bridge.pull(device.data() + i * 2 * 1200, 1200, render);
+        assert(rv == 0);
+    }
+    for (size_t j = 100; j < 4800; ++j)
+    {
+        const double want = 0.5 * sin(2 * M_PI * 440 * j / 48000);
+        assert(std::fabs(device[2 * j] - want) < 2e-3);
+    }
+    assert(rendered >= 4410 && rendered < 4410 + 64);
+}
+
+void test_drift_bridge()
+{
+    // a capture card running 200ppm fast into a playback card, simulated
+    // for two minutes, with and without stream timestamps
+    for (bool timestamps : {true, false})
+    {
+        // with timestamps the latency is end to end, so it must cover the
+        // (simulated) 10ms of output latency and both block sizes too
+        const double rate = 48000, drift = 200e-6;
+        const double target = timestamps ? 0.04 : 0.02;
+        audio::dsp::drift_bridge bridge(1, rate, rate, target, 1024,
+                                        audio::dsp::ResamplerQuality::fast);
+        std::vector<float> in(256, 0.25f), out(480);
+        const double inPeriod = 256 / (rate * (1 + drift));
+        const double outPeriod = 480 / rate;
+        double nextIn = 0, nextOut = 0.001;
+        unsigned long underrunsAtMinute = 0;
+        while (nextOut < 120)
+        {
+            if (nextIn <= nextOut)
+            {
+                bridge.write(in.data(), 256,
+                             timestamps ? (long long)(nextIn * 1e9) + 1 : 0);
+                nextIn += inPeriod;
+            }
+            else
+            {
+                bridge.read(out.data(), 480,
+                            timestamps ? (long long)((nextOut + 0.01) * 1e9)
+                                       : 0);
+                nextOut += outPeriod;
+                if (nextOut >= 60 && underrunsAtMinute == 0)
+                {
+                    underrunsAtMinute = bridge.underruns() + 1;
+                }
+            }
+        }
+        // settled: no more glitches, latency held, and the drift found
+        assert(bridge.underruns() + 1 == underrunsAtMinute);
+        assert(bridge.overflows() == 0);
+        assert(std::fabs(bridge.correction() - drift) < 30e-6);
+        assert(std::fabs(bridge.latency() - target) <
+               (timestamps ? 0.001 : 0.005));
+        assert(std::fabs(out[100] - 0.25f) < 1e-3f);
+    }
+
+    // an overflow drops whole frames: the ring (1023 samples here, so
+    // 511.5 frames) must not be left holding half a stereo frame
+    audio::dsp::drift_bridge stereo(2, 48000, 48000, 0.001, 64,
+                                    audio::dsp::ResamplerQuality::fast);
+    std::vector<float> lr(600), out(128);
+    for (size_t i = 0; i < lr.size(); i += 2)
+    {
+        lr[i] = 0.5f;
+        lr[i + 1] = -0.5f;
+    }
+    const unsigned int first = stereo.write(lr.data(), 300);
+    const unsigned int second = stereo.write(lr.data(), 300);
+    assert(first == 300 && second == 211);
+    assert(stereo.overflows() == 1);
+    for (int i = 0; i < 20; ++i)
+    {
+        stereo.read(out.data(), 64);
+        stereo.write(lr.data(), 64);
+    }
+    assert(stereo.underruns() == 0);
+    for (size_t i = 0; i < out.size(); i += 2)
+    {
+        assert(std::fabs(out[i] - 0.5f) < 0.01f);
+        assert(std::fabs(out[i + 1] + 0.5f) < 0.01f);
+    }
+}
+
+void test_meters()
+{
+    // EBU Tech 3341 case 1: a 1kHz stereo sine at -23dBFS reads -23 LUFS
+    const double rate = 48000;
+    audio::dsp::loudness_meter meter(2, rate);
+    const float amp = (float)std::pow(10.0, -23.0 / 20);
+    audio::dsp::oscillator osc(1000, rate, amp);
+    std::vector<float> mono(480), block(960);
+    auto feed = [&](double seconds, bool silent) {
+        for (int n = (int)(seconds * rate / 480); n > 0; --n)
+        {
+            osc.generate(mono.data(), 480);
+            for (size_t i = 0; i < 480; ++i)
+            {
+                block[2 * i] = block[2 * i + 1] = silent ? 0.0f : mono[i];
+            }
+            meter.push(block.data(), 480);
+            meter.process();
+        }
+    };
+    feed(20, false);
+    const audio::dsp::MeterReadings r = meter.readings();
+    assert(r.frames == (uint64_t)(20 * rate) && r.droppedFrames == 0);
+    assert(std::fabs(r.momentary + 23) < 0.1);
+    assert(std::fabs(r.shortTerm + 23) < 0.1);
+    assert(std::fabs(r.integrated + 23) < 0.1);
+    assert(std::fabs(r.peak[0] - amp) < 1e-3f * amp);
+    assert(std::fabs(r.rms[1] - amp * (float)M_SQRT1_2) < 1e-3f * amp);
+    // silence is gated out of the integrated loudness
+    feed(20, true);
+    const audio::dsp::MeterReadings &q = meter.readings();
+    assert(std::fabs(q.integrated + 23) < 0.1);
+    assert(q.momentary < -100 && q.peak[0] == 0 && q.rms[0] == 0);
+
+    // a sine at fs/4, sampled 45 degrees off its peaks: the samples only
+    // reach 0.707 of the true peak
+    audio::dsp::loudness_meter tp(1, rate);
+    std::vector<float> x(4800);
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        x[i] = 0.5f * (float)std::sin(M_PI / 2 * i + M_PI / 4);
+    }
+    tp.push(x.data(), (unsigned int)x.size());
+    tp.process();
+    const audio::dsp::MeterReadings &t = tp.readings();
+    assert(std::fabs(t.peak[0] - 0.5f * (float)M_SQRT1_2) < 1e-4f);
+    assert(std::fabs(t.truePeak[0] - 0.5f) < 0.01f);
+    assert(t.maxTruePeak == t.truePeak[0]);
+
+    // a full queue drops whole frames, and counts them; 16 bit is
+    // converted on the way in
+    audio::dsp::loudness_meter small(2, rate, 0.01); // 511 frames
+    const std::vector<int16_t> pcm(960, 8192);
+    for (int i = 0; i < 10; ++i)
+    {
+        small.push(pcm.data(), 480);
+    }
+    for (int i = 0; i < 10; ++i)
+    {
+        small.push(pcm.data(), 480);
+        small.process();
+    }
+    // all but the first 511 frames went, up to the first process()
+    assert(small.readings().droppedFrames == 11 * 480 - 511);
+    assert(small.readings().peak[1] == 0.25f);
+
+    // push() converts a frame at a time at least
+    bool threw = false;
+    try
+    {
+        audio::dsp::loudness_meter wide(audio::dsp::MAX_CONVERT_CHANNELS + 1,
+                                        rate);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void test_fft()
+{
+    // against a plain DFT: sizes with an odd and an even number of
+    // radix-4 stages
+    for (unsigned int n : {8u, 64u, 128u, 1024u})
+    {
+        audio::dsp::real_fft fft(n);
+        assert(fft.bins() == n / 2 + 1);
+        std::vector<float> x(n), re(fft.bins()), im(fft.bins());
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            x[i] = (float)std::sin(i * 0.37) + (float)(i % 7) * 0.1f;
+        }
+        fft.forward(x.data(), re.data(), im.data());
+        for (unsigned int k = 0; k < fft.bins(); ++k)
+        {
+            double r = 0, j = 0;
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                r += x[i] * std::cos(2 * M_PI * k * i / n);
+                j -= x[i] * std::sin(2 * M_PI * k * i / n);
+            }
+            assert(std::fabs(re[k] - r) < 1e-4 * n);
+            assert(std::fabs(im[k] - j) < 1e-4 * n);
+        }
+    }
+    bool threw = false;
+    try
+    {
+        audio::dsp::real_fft bad(1000);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void test_spectrum()
+{
+    // a 0.5 amplitude sine centred on bin 40 of a 2048 point FFT, left
+    // only; the right channel is silent
+    const double rate = 48000;
+    audio::dsp::SpectrumConfig config;
+    config.updateRate = 10;
+    audio::dsp::spectrum spec(2, rate, config);
+    assert(spec.bins() == 1025 && spec.binFrequency(40) == 937.5);
+    audio::dsp::oscillator osc(937.5, rate, 0.5f);
+    std::vector<float> mono(480), block(960);
+    for (int n = 0; n < 100; ++n)
+    {
+        osc.generate(mono.data(), 480);
+        for (size_t i = 0; i < 480; ++i)
+        {
+            block[2 * i] = mono[i];
+            block[2 * i + 1] = 0;
+        }
+        spec.push(block.data(), 480);
+        spec.process();
+    }
+    const audio::dsp::SpectrumReadings &r = spec.readings();
+    assert(r.frames > 40000 && r.droppedFrames == 0); // 10 a second
+    const std::vector<float> &left = r.magnitude[0];
+    assert(std::max_element(left.begin(), left.end()) - left.begin() == 40);
+    assert(std::fabs(left[40] - 0.5f) < 0.005f);
+    assert(left[300] < 1e-4f && r.magnitude[1][40] == 0);
+
+    // offline, on an AudioFile's buffer: the same answer
+    AudioFile<float> file;
+    file.setAudioBufferSize(1, 48000);
+    audio::dsp::oscillator osc2(937.5, rate, 0.5f);
+    osc2.generate(file.samples[0].data(), 48000);
+    const auto avg = audio::dsp::average_spectrum(file.samples, 2048);
+    assert(avg.size() == 1 && avg[0].size() == 1025);
+    assert(std::fabs(avg[0][40] - 0.5f) < 0.005f && avg[0][300] < 1e-4f);
+
+    bool threw = false;
+    try
+    {
+        audio::dsp::spectrum wide(audio::dsp::MAX_CONVERT_CHANNELS + 1, rate);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void test_convolver()
+{
+    // inverse FFT first: it must undo the forward one
+    audio::dsp::real_fft fft(256);
+    std::vector<float> x(256), re(129), im(129), y(256);
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        x[i] = (float)std::cos(i * 0.91) * (i % 3 ? 1.0f : -0.5f);
+    }
+    fft.forward(x.data(), re.data(), im.data());
+    fft.inverse(re.data(), im.data(), y.data());
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        assert(std::fabs(x[i] - y[i]) < 1e-5f);
+    }
+
+    // a decaying noise IR long enough for all three levels (partitions
+    // of 64, 512 and 4096 frames), against direct convolution
+    const unsigned int irLen = 20000, frames = 30000;
+    std::vector<std::vector<float>> ir(2, std::vector<float>(irLen));
+    unsigned int seed = 1;
+    auto noise = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(seed >> 8) / (1 << 24) - 0.5f;
+    };
+    for (unsigned int i = 0; i < irLen; ++i)
+    {
+        ir[0][i] = noise() * std::exp(-(float)i / 4000);
+        ir[1][i] = i == 3 ? 0.5f : 0.0f; // the right channel: a delay
+    }
+    std::vector<float> in((size_t)frames * 2);
+    for (float &v : in)
+    {
+        v = noise();
+    }
+    auto check = [&](const std::vector<float> &out, unsigned int latency) {
+        for (unsigned int n = latency; n < frames; n += 97)
+        {
+            const unsigned int t = n - latency;
+            double want = 0;
+            for (unsigned int k = 0; k < irLen && k <= t; ++k)
+            {
+                want += (double)ir[0][k] * in[(size_t)(t - k) * 2];
+            }
+            assert(std::fabs(out[(size_t)n * 2] - want) < 1e-3);
+            const float delayed = t >= 3 ? 0.5f * in[(size_t)(t - 3) * 2 + 1]
+                                         : 0.0f;
+            assert(std::fabs(out[(size_t)n * 2 + 1] - delayed) < 1e-5f);
+        }
+    };
+
+    // inline, in callback-sized pieces that are not the block size
+    {
+        audio::dsp::convolver conv(2, ir, 64, 3, false);
+        assert((conv.partitions() == std::vector<unsigned int>{64, 512, 4096}));
+        std::vector<float> out(in.size());
+        for (unsigned int done = 0; done < frames;)
+        {
+            const unsigned int n = (std::min)(frames - done, 100u);
+            conv.process(&in[(size_t)done * 2], &out[(size_t)done * 2], n);
+            done += n;
+        }
+        assert(conv.latency() == 64 && conv.late() == 0);
+        check(out, 64);
+    }
+
+    // in place, in whole blocks of another size
+    {
+        audio::dsp::convolver conv(2, ir, 256, 3, false);
+        std::vector<float> out(in);
+        for (unsigned int done = 0; done + 256 <= frames; done += 256)
+        {
+            conv.process(&out[(size_t)done * 2], &out[(size_t)done * 2], 256);
+        }
+        assert(conv.late() == 0 && conv.dropped() == 0);
+        out.resize((size_t)(frames / 256 * 256) * 2);
+        check(out, 256);
+    }
+
+    // on worker threads, paced like a device: 256 frames every 2ms. How
+    // far behind the workers fall is up to the scheduler, so the output
+    // is only exact when none of them was late.
+    {
+        audio::dsp::convolver conv(2, ir, 256, 3, true);
+        std::vector<float> out(in);
+        for (unsigned int done = 0; done + 256 <= frames; done += 256)
+        {
+            conv.process(&out[(size_t)done * 2], &out[(size_t)done * 2], 256);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        out.resize((size_t)(frames / 256 * 256) * 2);
+        if (conv.late() == 0 && conv.dropped() == 0)
+        {
+            check(out, 256);
+        }
+        else
+        {
+            cout << "convolver: workers late " << conv.late()
+                 << " times, dropped " << conv.dropped() << endl;
+        }
+    }
+
+    // from a file at another rate: a unit impulse stays a unit impulse
+    AudioFile<float> file;
+    file.setSampleRate(44100);
+    file.setAudioBufferSize(1, 4410);
+    file.samples[0][100] = 1.0f;
+    const auto loaded = audio::dsp::load_impulse(file, 48000);
+    assert(loaded.size() == 1 && loaded[0].size() == 4800);
+    float sum = 0;
+    for (float v : loaded[0])
+    {
+        sum += v;
+    }
+    assert(std::fabs(sum - 1.0f) < 1e-3f);
+    const auto peak = std::max_element(loaded[0].begin(), loaded[0].end());
+    assert(peak - loaded[0].begin() == 109); // 100 * 48000 / 44100
+    audio::dsp::convolver fromFile(2, file, 48000);
+    assert((fromFile.partitions() == std::vector<unsigned int>{256, 2048}));
+}
+
+void test_graph()
+{
+    // 32 branches of source -> gain, all into one mixer; each source takes
+    // a while, so the branches must be spread across the workers
+    audio::graph g(2, 256, 3);
+    assert(g.workers() == 3);
+    std::mutex mtx;
+    std::set<std::thread::id> threads;
+    std::vector<std::shared_ptr<audio::graph::mixer_node>> gains;
+    auto master = std::make_shared<audio::graph::mixer_node>(32);
+    const auto out = g.add(master);
+    std::vector<audio::graph::node_id> sources;
+    for (int k = 0; k < 32; ++k)
+    {
+        const float level = (k + 1) * 0.001f;
+        auto src = std::make_shared<audio::graph::source_node>(
+            [&, level](float *buf, unsigned int frames, unsigned int nch) {
+                std::fill(buf, buf + (size_t)frames * nch, level);
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                std::lock_guard<std::mutex> lock(mtx);
+                threads.insert(std::this_thread::get_id());
+            });
+        gains.push_back(std::make_shared<audio::graph::mixer_node>(1, 0.5f));
+        sources.push_back(g.add(src));
+        const auto gain = g.add(gains.back());
+        g.connect(sources.back(), gain);
+        g.connect(gain, out);
+    }
+    g.output(out);
+
+    // nothing is heard until commit()
+    std::vector<float> buf(600 * 2, 1.0f);
+    g.process(buf.data(), 600);
+    assert(buf[0] == 0 && buf[1199] == 0);
+    g.commit();
+    const float all = 0.5f * 0.001f * (32 * 33 / 2);
+    for (int i = 0; i < 20; ++i)
+    {
+        g.process(buf.data(), 600); // bigger than a graph block
+        assert(std::fabs(buf[0] - all) < 1e-6f);
+        assert(std::fabs(buf[1199] - all) < 1e-6f);
+    }
+    assert(threads.size() > 1);
+    // the workers take on this thread's (normal) scheduling
+    for (int i = 0; i < 1000 && !g.realtime_workers(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(g.realtime_workers());
+
+    // edits: no cycles, and a new schedule swaps in whole
+    bool threw = false;
+    try
+    {
+        g.connect(out, sources[0]);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    for (int k = 16; k < 32; ++k)
+    {
+        g.remove(sources[k]);
+    }
+    gains[0]->gain(0, 1.0f);
+    g.process(buf.data(), 600);
+    assert(std::fabs(buf[0] - all - 0.0005f) < 1e-6f);
+    g.commit();
+    g.process(buf.data(), 600);
+    const float half = 0.5f * 0.001f * (16 * 17 / 2) + 0.0005f;
+    assert(std::fabs(buf[0] - half) < 1e-6f);
+
+    // as a stream callback, in 16 bit
+    audio::StreamCallbackInfo info;
+    std::vector<int16_t> pcm(2 * 100);
+    info.outputBuffer = pcm.data();
+    info.frames = 100;
+    info.format.Format = audio::AudioFormat::SINT16;
+    info.format.Channels = 2;
+    const int rv = g.OnAudioCallback(info);
+    assert(rv == 0);
+    assert(pcm[0] == audio::dsp::from_float<int16_t>(half));
+}
+
+void test_chain()
+{
+    using namespace audio::dsp;
+    // a compile-time chain
+    constexpr auto c = chain(gain(2.0f), pan(-0.5f), soft_clip(),
+                             gain(0.9f), to<int16_t>());
+    static_assert(std::is_same<decltype(c)::output_type, int16_t>::value,
+                  "to<int16_t> sets the output type");
+    static_assert(c(0.0f, 0) == 0.0f, "constexpr evaluation");
+    static_assert(c(10.0f, 1) == 0.9f, "clipped, then scaled");
+
+    // fused == stage by stage
+    const int frames = 1000;
+    std::vector<float> in(frames * 2);
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        in[i] = 0.8f * (float)std::sin(i * 0.01);
+    }
+    std::vector<int16_t> out(in.size());
+    c.process(in.data(), out.data(), frames, 2);
+    const float l = (float)std::sin(0.375 * M_PI);
+    const float r = (float)std::cos(0.375 * M_PI);
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        float x = in[i] * 2.0f * (i % 2 ? r : l);
+        x = std::max(-1.0f, std::min(1.0f, x));
+        x = (1.5f * x - 0.5f * x * x * x) * 0.9f;
+        assert(std::abs(out[i] - from_float<int16_t>(x)) <= 1);
+    }
+
+    // in place, on any of the stream formats, through the callback info
+    const auto half = chain(gain(0.5f), hard_clip(0.25f));
+    std::vector<int32_t> pcm(8, 1 << 30); // 0.5 of full scale
+    audio::StreamCallbackInfo info;
+    info.outputBuffer = pcm.data();
+    info.frames = 4;
+    info.format.Format = audio::AudioFormat::SINT32;
+    info.format.Channels = 2;
+    apply_chain(half, info);
+    assert(pcm[0] == 1 << 29 && pcm[7] == 1 << 29);
+    std::vector<float> f(6, 2.0f);
+    half.processSamples(2, f.data(), 3);
+    assert(f[0] == 0.25f && f[5] == 0.25f);
+}
+
+void test_event_queue()
+{
+    // out of order, from several threads; split exactly at each frame
+    audio::EventQueue q(64);
+    std::vector<std::thread> posters;
+    for (unsigned int t = 0; t < 4; ++t)
+    {
+        posters.emplace_back([&q, t] {
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                const uint64_t frame = 1000 - 60 * (4 * i + t);
+                const bool posted =
+                    q.Post(audio::StreamEvent{frame, t, (float)i});
+                assert(posted);
+            }
+        });
+    }
+    for (auto &p : posters)
+    {
+        p.join();
+    }
+    std::vector<uint64_t> applied;
+    unsigned int rendered = 0;
+    for (uint64_t first = 0; first < 1024; first += 256)
+    {
+        q.Process(
+            first, 256,
+            [&](const audio::StreamEvent &e) {
+                assert(first + rendered % 256 == e.frame);
+                applied.push_back(e.frame);
+            },
+            [&](unsigned int offset, unsigned int n) {
+                assert(offset == rendered % 256);
+                rendered += n;
+            });
+    }
+    assert(rendered == 1024 && applied.size() == 16);
+    assert(std::is_sorted(applied.begin(), applied.end()));
+    assert(q.Late() == 0 && q.Dropped() == 0);
+
+    // late ones go at the start of the next buffer; a full queue drops
+    q.Post(audio::StreamEvent{10, 0, 0});
+    q.Process(2048, 256, [](const audio::StreamEvent &) {},
+              [](unsigned int offset, unsigned int n) {
+                  assert(offset == 0 && n == 256);
+              });
+    assert(q.Late() == 1);
+    unsigned int posted = 0;
+    while (q.Post(audio::StreamEvent{5000, 0, 0}))
+    {
+        ++posted;
+    }
+    assert(posted == 64 && q.Dropped() == 1);
+
+    // through render-ahead: the callback sees the change at its frame
+    struct stepping_callback : audio::AudioCallback
+    {
+        float level = 0;
+        int OnAudioCallback(const audio::StreamCallbackInfo &info) override
+        {
+            auto *out = (float *)info.outputBuffer;
+            for (unsigned int i = 0; i < info.frames; ++i)
+            {
+                out[i] = level;
+            }
+            return 0;
+        }
+        void OnEvent(const audio::StreamEvent &e) override
+        {
+            level = e.value;
+        }
+    };
+    stepping_callback cb;
+    cb.format.Format = audio::AudioFormat::FLOAT32;
+    cb.format.Channels = 1;
+    audio::EventQueue events(16);
+    events.Post(audio::StreamEvent{100, 0, 1.0f});
+    events.Post(audio::StreamEvent{333, 0, 0.5f});
+    audio::detail::RenderAhead ra(&cb, cb.format, 64, 2, &events);
+    ra.Start();
+    std::vector<float> device(512);
+    size_t got = 0;
+    while (got < device.size())
+    {
+        const int rv = ra.pull(device.data() + got, 64, 0);
+        assert(rv == 0);
+        got += 64;
+        this_thread::sleep_for(2ms);
+    }
+    ra.Stop();
+    for (size_t i = 0; i < device.size(); ++i)
+    {
+        assert(device[i] == (i < 100 ? 0.0f : (i < 333 ? 1.0f : 0.5f)));
+    }
+}
+
+void test_hot_swap()
+{
+    // rcu: nothing replaced is released until the reader quiesces
+    audio::lockfree::rcu<int> slot(std::make_shared<int>(1));
+    std::weak_ptr<int> first = slot.current();
+    const int *seen = slot.read();
+    slot.publish(std::make_shared<int>(2));
+    size_t waiting = slot.collect();
+    assert(waiting == 1 && !first.expired() && *seen == 1);
+    slot.quiesce();
+    waiting = slot.collect();
+    assert(waiting == 0 && first.expired() && *slot.read() == 2);
+    // ... nor what it goes on holding through a quiescent point
+    std::weak_ptr<int> second = slot.current();
+    seen = slot.read();
+    slot.publish(std::make_shared<int>(3));
+    slot.quiesce(seen);
+    waiting = slot.collect();
+    assert(waiting == 1 && !second.expired() && *seen == 2);
+    slot.quiesce();
+    waiting = slot.collect();
+    assert(waiting == 0 && second.expired());
+
+    struct level_callback : audio::AudioCallback
+    {
+        float level;
+        explicit level_callback(float l) : level(l) {}
+        int OnAudioCallback(const audio::StreamCallbackInfo &info) override
+        {
+            auto *out = (float *)info.outputBuffer;
+            for (unsigned int i = 0; i < info.frames * format.Channels; ++i)
+            {
+                out[i] = level;
+            }
+            return 0;
+        }
+    };
+    audio::FormatType fmt;
+    fmt.Format = audio::AudioFormat::FLOAT32;
+    fmt.Channels = 2;
+    fmt.SamplesPerSec = 48000;
+    audio::SwappableCallback swapper(std::make_shared<level_callback>(1.0f),
+                                     fmt);
+    std::vector<float> buf(2 * 300);
+    audio::StreamCallbackInfo info;
+    info.outputBuffer = buf.data();
+    info.frames = 300;
+    info.format = fmt;
+    auto run = [&] {
+        const int rv = swapper.OnAudioCallback(info);
+        assert(rv == 0);
+        return buf;
+    };
+    run();
+    assert(buf[599] == 1.0f);
+
+    // cut over at the next callback
+    std::weak_ptr<audio::AudioCallback> was = swapper.Current();
+    swapper.Swap(std::make_shared<level_callback>(0.5f));
+    assert(!was.expired());
+    run();
+    assert(buf[0] == 0.5f);
+    waiting = swapper.Collect();
+    assert(waiting == 0 && was.expired());
+
+    // crossfade: equal power from 0.5 to 0.25 over 512 frames
+    swapper.Swap(std::make_shared<level_callback>(0.25f), 512);
+    std::vector<float> out = run();
+    waiting = swapper.Collect();
+    assert(waiting == 1); // still fading
+    const auto more = run();
+    out.insert(out.end(), more.begin(), more.end());
+    waiting = swapper.Collect();
+    assert(waiting == 0);
+    for (size_t f = 0; f < 600; ++f)
+    {
+        const double t = M_PI_2 * (f + 0.5) / 512;
+        const double want =
+            f < 512 ? 0.25 * std::sin(t) + 0.5 * std::cos(t) : 0.25;
+        assert(std::abs(out[2 * f] - want) < 1e-6);
+        assert(out[2 * f + 1] == out[2 * f]);
+    }
+
+    // a swap from inside a callback, and a Collect() before the next:
+    // the callback swapped out is still there to fade out from
+    struct swapping_callback : level_callback
+    {
+        audio::SwappableCallback *owner = nullptr;
+        std::shared_ptr<audio::AudioCallback> next;
+        using level_callback::level_callback;
+        int OnAudioCallback(const audio::StreamCallbackInfo &info) override
+        {
+            if (next) owner->Swap(std::move(next), 512);
+            return level_callback::OnAudioCallback(info);
+        }
+    };
+    auto swapping = std::make_shared<swapping_callback>(1.0f);
+    audio::SwappableCallback midway(swapping, fmt);
+    swapping->owner = &midway;
+    swapping->next = std::make_shared<level_callback>(0.25f);
+    was = swapping;
+    swapping.reset();
+    int rv = midway.OnAudioCallback(info);
+    assert(rv == 0 && buf[599] == 1.0f);
+    waiting = midway.Collect();
+    assert(waiting == 1 && !was.expired());
+    rv = midway.OnAudioCallback(info);
+    const double t0 = M_PI_2 * 0.5 / 512;
+    assert(rv == 0);
+    assert(std::abs(buf[0] - (0.25 * std::sin(t0) + std::cos(t0))) < 1e-6);
+    rv = midway.OnAudioCallback(info);
+    assert(rv == 0 && buf[599] == 0.25f);
+    waiting = midway.Collect();
+    assert(waiting == 0 && was.expired());
+}
+
+void test_params()
+{
+    static_assert(sizeof(float) * audio::params::GROUP + sizeof(uint32_t) <=
+                      audio::lockfree::CACHE_LINE_SIZE,
+                  "a group fits a cache line");
+    audio::params p(100, 48000);
+    p.configure(0, audio::Smoothing::linear, 0.01, 1.0f); // 480 frames
+    p.configure(1, audio::Smoothing::onePole, 0.005);
+    p.configure(99, audio::Smoothing::none, 0, 0.5f);
+    p.update(64);
+    assert(p.value(0) == 1.0f && !p.moving(0) && p.value(99) == 0.5f);
+
+    // 10000 writes from 4 threads between two blocks: one pick-up
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t)
+    {
+        writers.emplace_back([&p, t] {
+            for (int i = 0; i < 2500; ++i)
+            {
+                p.set((size_t)(2 + t * 24 + i % 24), (float)i);
+            }
+        });
+    }
+    for (auto &w : writers)
+    {
+        w.join();
+    }
+    p.set(0, 0.0f);
+    p.set(1, 1.0f);
+    p.set(99, 0.25f);
+    p.update(240);
+    assert(p.value(99) == 0.25f && p.step(99) == 0.0f);
+    assert(p.value(2 + 3) == 2499.0f); // the last write wins
+    // linear: halfway after 240 of 480 frames, there at 480
+    assert(p.value(0) == 1.0f && std::abs(p.at(0, 240) - 0.5f) < 1e-6f);
+    p.update(240);
+    assert(std::abs(p.value(0) - 0.5f) < 1e-6f);
+    assert(std::abs(p.at(0, 240)) < 1e-6f);
+    std::vector<float> r(240);
+    p.ramp(0, r.data(), 240);
+    assert(std::is_sorted(r.rbegin(), r.rend()));
+    p.update(240);
+    assert(p.value(0) == 0.0f && !p.moving(0));
+    // one-pole: 1 - e^-3 after three time constants (720 frames)
+    assert(std::abs(p.at(1, 240) - (1 - std::exp(-3.0))) < 1e-4);
+    for (int i = 0; i < 100; ++i)
+    {
+        p.update(256);
+    }
+    assert(p.value(1) == 1.0f && !p.moving(1));
+    assert(p.get(1) == 1.0f && p.get(100) == 0.0f);
+}
+
+void test_routing_matrix()
+{
+    using audio::dsp::routing_matrix;
+    // 5.1 to stereo, int16 in, float out
+    routing_matrix down = routing_matrix::downmix_5_1();
+    assert(down.inputs() == 6 && down.outputs() == 2 && down.taps() == 6);
+    const size_t frames = 150; // not a whole number of blocks
+    std::vector<int16_t> surround(frames * 6);
+    for (size_t f = 0; f < frames; ++f)
+    {
+        for (int ch = 0; ch < 6; ++ch)
+        {
+            surround[f * 6 + ch] = (int16_t)((ch + 1) * 1000 + f);
+        }
+    }
+    std::vector<float> stereo(frames * 2);
+    down.process(surround.data(), stereo.data(), frames);
+    for (size_t f = 0; f < frames; ++f)
+    {
+        const auto x = [&](int ch) {
+            return audio::dsp::to_float(surround[f * 6 + ch]);
+        };
+        const float l = x(0) + 0.70710678f * (x(2) + x(4));
+        const float r = x(1) + 0.70710678f * (x(2) + x(5));
+        assert(std::abs(stereo[f * 2] - l) < 1e-6f);
+        assert(std::abs(stereo[f * 2 + 1] - r) < 1e-6f);
+    }
+
+    // any channel anywhere; unrouted outputs are silent
+    routing_matrix m(2, 4);
+    m.set(1, 0, 1.0f);
+    m.set(0, 3, 0.5f);
+    m.set(1, 3, 0.5f);
+    assert(m.taps() == 3 && m.get(0, 3) == 0.5f && m.get(0, 0) == 0.0f);
+    bool threw = false;
+    try
+    {
+        m.set(2, 0, 1.0f);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    // through the stream's router, a slice at a time: float to int32
+    audio::detail::StreamRouter router(m, audio::AudioFormat::FLOAT32,
+                                       audio::AudioFormat::SINT32);
+    std::vector<int32_t> device(600 * 4, -1);
+    size_t rendered = 0;
+    auto render = [&](void *buf, unsigned int n) {
+        auto *f = (float *)buf;
+        for (unsigned int i = 0; i < n; ++i, ++rendered)
+        {
+            f[2 * i] = 0.25f;
+            f[2 * i + 1] = rendered % 2 ? -0.5f : 0.5f;
+        }
+        return 0;
+    };
+    const int rv = router.pull(device.data(), 600, render);
+    assert(rv == 0 && rendered == 600);
+    for (size_t f = 0; f < 600; ++f)
+    {
+        const float r = f % 2 ? -0.5f : 0.5f;
+        assert(device[f * 4] == audio::dsp::from_float<int32_t>(r));
+        assert(device[f * 4 + 1] == 0 && device[f * 4 + 2] == 0);
+        assert(device[f * 4 + 3] ==
+               audio::dsp::from_float<int32_t>(0.5f * 0.25f + 0.5f * r));
+    }
+
+    // mono to eight
+    routing_matrix up = routing_matrix::mono_to(8, 0.5f);
+    std::vector<double> mono{1.0, -1.0};
+    std::vector<int8_t> eight(16);
+    up.process(mono.data(), eight.data(), 2);
+    assert(std::all_of(eight.begin(), eight.begin() + 8,
+                       [](int8_t v) { return v == 64; }));
+    assert(std::all_of(eight.begin() + 8, eight.end(),
+                       [](int8_t v) { return v == -64; }));
+}
+
+void test_switcher()
+{
+    struct level_source : audio::AudioCallback
+    {
+        float level;
+        unsigned long frames = 0; // rendered
+        explicit level_source(float l) : level(l) {}
+        int OnAudioCallback(const audio::StreamCallbackInfo &info) override
+        {
+            auto *out = (float *)info.outputBuffer;
+            std::fill(out, out + info.frames * format.Channels, level);
+            frames += info.frames;
+            return 0;
+        }
+    };
+    auto a = std::make_shared<level_source>(1.0f);
+    auto b = std::make_shared<level_source>(-0.5f);
+    audio::switcher sw(2, 48000, 128);
+    const unsigned int ia = sw.add(a), ib = sw.add(b);
+    assert(ia == 0 && ib == 1 && sw.playing() == 0);
+    assert(a->format.Channels == 2 && a->format.SamplesPerSec == 48000);
+
+    // fade to b over 480 frames from frame 1000
+    const bool queued = sw.switch_to(1, 1000, 480);
+    assert(queued);
+    std::vector<float> out(2 * 2048);
+    for (unsigned int f = 0; f < 2048; f += 256)
+    {
+        sw.process(out.data() + 2 * f, 256, f);
+        if (f + 256 <= 1000) assert(b->frames == 0); // parked
+    }
+    assert(sw.playing() == 1);
+    for (unsigned int f = 0; f < 2048; ++f)
+    {
+        double want = 1.0;
+        if (f >= 1480)
+        {
+            want = -0.5;
+        }
+        else if (f >= 1000)
+        {
+            const double t = M_PI_2 * (f - 1000) / 480;
+            want = std::cos(t) - 0.5 * std::sin(t);
+        }
+        assert(std::abs(out[2 * f] - want) < 1e-4);
+        assert(out[2 * f + 1] == out[2 * f]);
+    }
+    assert(a->frames == 1480 && b->frames == 2048 - 1000);
+
+    // a cut, as an int16 stream's callback; and a late switch
+    sw.switch_to(0, 2048 + 100, 0);
+    std::vector<int16_t> pcm(2 * 300);
+    audio::StreamCallbackInfo info;
+    info.outputBuffer = pcm.data();
+    info.frames = 300;
+    info.streamTime = 2048.0 / 48000;
+    info.format.Format = audio::AudioFormat::SINT16;
+    info.format.Channels = 2;
+    info.format.SamplesPerSec = 48000;
+    sw.OnAudioCallback(info);
+    assert(pcm[2 * 99] == -16384 && pcm[2 * 100] == 32767);
+    sw.switch_to(1, 0, 0);
+    sw.process(out.data(), 16, 4096);
+    assert(sw.late() == 1 && out[0] == -0.5f);
+}
+
+void test_voice_engine()
+{
+    // a mono ramp, 0, 1, 2 ... scaled down, from memory
+    std::vector<float> ramp(1000);
+    for (size_t i = 0; i < ramp.size(); ++i)
+    {
+        ramp[i] = (float)i / 1000;
+    }
+    audio::voice_engine engine(2, 48000, 4, 64);
+    const unsigned int smp = engine.add_sample(ramp.data(), ramp.size(), 1,
+                                               48000);
+
+    // half speed, no envelope: interpolated, in both channels
+    const auto id = engine.trigger(smp, 0.5f, 1.0f, 0, 0);
+    assert(id != 0);
+    std::vector<float> out(2 * 256);
+    engine.process(out.data(), 256);
+    assert(engine.active() == 1);
+    for (unsigned int i = 0; i < 256; ++i)
+    {
+        assert(std::abs(out[2 * i] - 0.5f * i / 1000) < 1e-6f);
+        assert(out[2 * i + 1] == out[2 * i]);
+    }
+    // release over 100 frames, then the voice is free again
+    engine.release(id);
+    std::vector<float> tail(2 * 256);
+    engine.process(tail.data(), 256);
+    assert(engine.active() == 0 && tail[2 * 100] == 0.0f);
+    assert(tail[0] > 0.12f && tail[2 * 99] < 0.01f);
+
+    // the end of the sample ends the voice, at any pitch
+    engine.trigger(smp, 3.7f, 1.0f, 0, 0);
+    std::vector<float> end(2 * 512);
+    engine.process(end.data(), 512);
+    assert(engine.active() == 0);
+    const unsigned int last = (unsigned int)std::ceil(999 / 3.7);
+    assert(end[2 * (last - 1)] > 0.99f && end[2 * last] == 0.0f);
+
+    // a full pool steals the quietest voice
+    for (int i = 0; i < 4; ++i)
+    {
+        engine.trigger(smp, 0.01f, 0.5f + i * 0.1f, 0, 0);
+    }
+    engine.process(out.data(), 16);
+    engine.trigger(smp, 0.01f, 1.0f, 0, 0);
+    engine.process(out.data(), 16);
+    assert(engine.active() == 4 && engine.stolen() == 1);
+    // the 0 of a dropped trigger releases nothing
+    engine.release(0);
+    engine.process(out.data(), 16);
+    assert(engine.active() == 4);
+    engine.release_all();
+    engine.process(out.data(), 256);
+    assert(engine.active() == 0);
+
+    // a pitch that is not a finite ratio above 0 is refused
+    for (float pitch : {0.0f, -1.0f, std::numeric_limits<float>::quiet_NaN(),
+                        std::numeric_limits<float>::infinity()})
+    {
+        bool threw = false;
+        try
+        {
+            engine.trigger(smp, pitch);
+        }
+        catch (const std::runtime_error &)
+        {
+            threw = true;
+        }
+        assert(threw);
+    }
+    assert(engine.active() == 0 && engine.dropped() == 0);
+
+    // 1000 voices of a stereo file, a second of audio
+    AudioFile<float> file;
+    file.setAudioBufferSize(2, 48000);
+    file.setSampleRate(44100);
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        for (int i = 0; i < 48000; ++i)
+        {
+            file.samples[ch][i] = (float)std::sin(i * 0.01 * (ch + 1));
+        }
+    }
+    audio::voice_engine big(2, 48000, 1000, 2048);
+    const unsigned int stereo = big.add_sample(file);
+    for (int v = 0; v < 1000; ++v)
+    {
+        big.trigger(stereo, 0.5f + v * 0.0004f, 0.001f);
+    }
+    std::vector<float> mix(2 * 512);
+    const auto started = std::chrono::steady_clock::now();
+    for (int block = 0; block < 48000 / 512; ++block)
+    {
+        big.process(mix.data(), 512);
+    }
+    const std::chrono::duration<double> took =
+        std::chrono::steady_clock::now() - started;
+    assert(big.active() == 1000 && big.stolen() == 0);
+    cout << "voice_engine: 1000 voices, 1s of audio in " << took.count()
+         << "s" << endl;
+}
+
+void test_reblocker()
+{
+    audio::FormatType fmt;
+    fmt.Format = audio::AudioFormat::SINT32;
+    fmt.Channels = 2;
+    audio::detail::StreamReblocker rb(256, fmt);
+    int32_t next = 0;
+    std::vector<unsigned int> asked;
+    auto render = [&](void *buffer, unsigned int n) {
+        asked.push_back(n);
+        auto *out = (int32_t *)buffer;
+        for (unsigned int i = 0; i < 2 * n; ++i)
+        {
+            out[i] = next++;
+        }
+        return 0;
+    };
+    // device periods of any size: one continuous signal, rendered only
+    // in blocks of 256, never more than a block ahead
+    const unsigned int periods[] = {100, 300, 37, 512, 1, 256, 1000, 93};
+    std::vector<int32_t> device(2 * 1000);
+    int32_t expected = 0;
+    unsigned int played = 0;
+    for (unsigned int frames : periods)
+    {
+        const int rv = rb.pull(device.data(), frames, render);
+        assert(rv == 0);
+        played += frames;
+        for (unsigned int i = 0; i < 2 * frames; ++i)
+        {
+            assert(device[i] == expected);
+            ++expected;
+        }
+        assert(rb.Buffered() < 256);
+        assert(asked.size() * 256 == played + rb.Buffered());
+    }
+    assert(std::all_of(asked.begin(), asked.end(),
+                       [](unsigned int n) { return n == 256; }));
+
+    // periods a multiple of the block go straight through
+    audio::detail::StreamReblocker aligned(128, fmt);
+    asked.clear();
+    aligned.pull(device.data(), 512, render);
+    assert(asked.size() == 4 && aligned.Buffered() == 0);
+}
+
 int main()
 {
+    test_fader();
+    test_fader_bank();
+    test_oscillator();
+    test_oscillator_bank();
+    test_biquad_bank();
+    test_resampler();
+    test_drift_bridge();
+    test_meters();
+    test_fft();
+    test_spectrum();
+    test_convolver();
+    test_graph();
+    test_chain();
+    test_event_queue();
+    test_hot_swap();
+    test_params();
+    test_routing_matrix();
+    test_switcher();
+    test_voice_engine();
+    test_render_ahead();
+    test_reblocker();
+    test_stream_stats();
+    test_stream_host_time();
+    test_buffer_tuner();
+    test_format_negotiation();
     {
         test_opening_output_stream();
     }